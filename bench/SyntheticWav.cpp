@@ -0,0 +1,229 @@
+#include "SyntheticWav.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace mp3_converter::bench {
+
+namespace {
+// odd on purpose, so readers have to honour the RIFF pad byte.
+constexpr char     list_payload[]   = "bench";
+constexpr uint32_t list_size        = sizeof(list_payload) - 1;
+constexpr uint32_t list_padded_size = list_size + (list_size & 1);
+
+// RIFF header, fmt chunk, LIST chunk with its pad byte, data chunk header.
+constexpr uint64_t header_bytes = 12 + (8 + 16) + (8 + list_padded_size) + 8;
+
+// frames generated and written at once.
+constexpr size_t block_frames = 4096;
+
+constexpr double two_pi = 6.283185307179586;
+
+// the folder of short files, see write_small_file_corpus.
+constexpr size_t small_file_count = 1000;
+constexpr size_t min_small_files  = 50;
+
+/**
+ * @brief xorshift64, deterministic on every platform unlike the standard
+ * distributions.
+ */
+class Noise
+{
+  public:
+    explicit Noise(uint64_t seed)
+        : m_state(seed | 1)
+    {
+    }
+
+    /// Uniform in [-1, 1).
+    double next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return static_cast<double>(m_state >> 11) / 4503599627370496.0 - 1.0;
+    }
+
+  private:
+    uint64_t m_state;
+};
+
+void put_le(std::vector<char> &out, uint64_t value, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; ++i, value >>= 8)
+        out.push_back(static_cast<char>(value & 0xFF));
+}
+
+void put_sample(std::vector<char> &    out,
+                const SyntheticFormat &format,
+                double                 value)
+{
+    const unsigned bytes = format.bits_per_sample / 8;
+
+    if (format.audio_format == 3)
+    {
+        if (bytes == sizeof(float))
+        {
+            const float sample = static_cast<float>(value);
+            uint32_t    bits;
+            std::memcpy(&bits, &sample, sizeof(bits));
+            put_le(out, bits, 4);
+        }
+        else
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            put_le(out, bits, 8);
+        }
+        return;
+    }
+
+    const double full_scale =
+        std::ldexp(1.0, static_cast<int>(format.bits_per_sample) - 1) - 1.0;
+    const auto sample = static_cast<int64_t>(std::lround(value * full_scale));
+    put_le(out, static_cast<uint64_t>(sample), bytes);
+}
+} // namespace
+
+std::vector<SyntheticFormat> corpus_formats(double scale)
+{
+    std::vector<SyntheticFormat> formats {
+        {"pcm16_mono_22050", 1, 1, 16, 22050, 5},
+        {"pcm16_stereo_44100", 1, 2, 16, 44100, 30},
+        {"pcm16_stereo_48000_long", 1, 2, 16, 48000, 150},
+        {"pcm32_mono_16000", 1, 1, 32, 16000, 10},
+        {"pcm32_stereo_44100", 1, 2, 32, 44100, 30},
+        {"float_mono_48000", 3, 1, 32, 48000, 10},
+        {"float_stereo_44100", 3, 2, 32, 44100, 30},
+        {"double_mono_32000", 3, 1, 64, 32000, 10},
+        {"double_stereo_44100", 3, 2, 64, 44100, 20},
+        {"pcm24_stereo_48000", 1, 2, 24, 48000, 30},
+        {"pcm24_surround51_48000", 1, 6, 24, 48000, 20},
+        {"float_surround71_48000", 3, 8, 32, 48000, 10},
+    };
+
+    for (auto &format : formats)
+        format.seconds *= scale;
+    return formats;
+}
+
+void write_synthetic_wav(const std::filesystem::path &file,
+                         const SyntheticFormat &      format)
+{
+    const uint16_t block_align =
+        static_cast<uint16_t>(format.num_channels * format.bits_per_sample / 8);
+    const uint64_t num_frames =
+        static_cast<uint64_t>(format.seconds * format.sample_rate);
+    const uint64_t data_bytes = format.data_bytes();
+
+    std::vector<char> bytes;
+    bytes.insert(bytes.end(), {'R', 'I', 'F', 'F'});
+    put_le(bytes, header_bytes - 8 + data_bytes, 4);
+    bytes.insert(bytes.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    put_le(bytes, 16, 4);
+    put_le(bytes, format.audio_format, 2);
+    put_le(bytes, format.num_channels, 2);
+    put_le(bytes, format.sample_rate, 4);
+    put_le(bytes, uint64_t {format.sample_rate} * block_align, 4);
+    put_le(bytes, block_align, 2);
+    put_le(bytes, format.bits_per_sample, 2);
+    bytes.insert(bytes.end(), {'L', 'I', 'S', 'T'});
+    put_le(bytes, list_size, 4);
+    bytes.insert(bytes.end(), list_payload, list_payload + list_padded_size);
+    bytes.insert(bytes.end(), {'d', 'a', 't', 'a'});
+    put_le(bytes, data_bytes, 4);
+
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+
+    // a chord that moves between the channels, with a little noise on top so
+    // the encoder can not take shortcuts on pure tones.
+    Noise noise(format.sample_rate * 131 + format.bits_per_sample * 7
+                + format.num_channels);
+    for (uint64_t frame = 0; frame < num_frames;)
+    {
+        bytes.clear();
+        const uint64_t end = std::min<uint64_t>(num_frames, frame + block_frames);
+        for (; frame < end; ++frame)
+        {
+            const double t = static_cast<double>(frame) / format.sample_rate;
+            for (uint16_t channel = 0; channel < format.num_channels; ++channel)
+            {
+                const double pan =
+                    0.5 + 0.5 * std::sin(two_pi * 0.25 * t + channel * 1.5);
+                const double value = 0.3 * pan * std::sin(two_pi * 220.0 * t)
+                                     + 0.2 * std::sin(two_pi * 277.2 * t)
+                                     + 0.15 * (1.0 - pan)
+                                           * std::sin(two_pi * 329.6 * t)
+                                     + 0.02 * noise.next();
+                put_sample(bytes, format, value);
+            }
+        }
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    if (!out.flush())
+        throw std::runtime_error("Could not write " + file.string());
+}
+
+std::vector<std::filesystem::path>
+write_corpus(const std::filesystem::path &       directory,
+             const std::vector<SyntheticFormat> &formats)
+{
+    std::filesystem::create_directories(directory);
+
+    std::vector<std::filesystem::path> files;
+    for (const auto &format : formats)
+    {
+        const auto file = directory / (format.name + ".wav");
+
+        std::error_code error;
+        if (std::filesystem::file_size(file, error)
+            != header_bytes + format.data_bytes())
+            write_synthetic_wav(file, format);
+
+        files.push_back(file);
+    }
+    return files;
+}
+
+std::vector<std::filesystem::path>
+write_small_file_corpus(const std::filesystem::path &directory, double scale)
+{
+    const SyntheticFormat format {"effect", 1, 1, 16, 22050, 2};
+    const size_t          count = std::max(
+        min_small_files, static_cast<size_t>(small_file_count * scale));
+
+    std::filesystem::create_directories(directory);
+
+    std::vector<std::filesystem::path> files;
+    for (size_t i = 0; i < count; ++i)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "effect_%05zu.wav", i);
+        const auto file = directory / name;
+
+        // the samples are the same in every file, generated once.
+        std::error_code error;
+        if (std::filesystem::file_size(file, error)
+            != header_bytes + format.data_bytes())
+        {
+            if (files.empty())
+                write_synthetic_wav(file, format);
+            else
+                std::filesystem::copy_file(
+                    files.front(),
+                    file,
+                    std::filesystem::copy_options::overwrite_existing);
+        }
+
+        files.push_back(file);
+    }
+    return files;
+}
+
+} // namespace mp3_converter::bench
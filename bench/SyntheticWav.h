@@ -0,0 +1,81 @@
+#ifndef MP3_CONVERTER_BENCH_SYNTHETICWAV_H
+#define MP3_CONVERTER_BENCH_SYNTHETICWAV_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace mp3_converter::bench {
+
+/**
+ * @struct SyntheticFormat
+ *
+ * @brief The format and length of one generated wav file.
+ */
+struct SyntheticFormat
+{
+    /// Name of the case, also the file name without extension.
+    std::string name;
+
+    /// 1 for integer PCM, 3 for IEEE float.
+    uint16_t audio_format;
+
+    uint16_t num_channels;
+    uint16_t bits_per_sample;
+    uint32_t sample_rate;
+    double   seconds;
+
+    uint64_t data_bytes() const
+    {
+        return static_cast<uint64_t>(seconds * sample_rate) * num_channels
+               * (bits_per_sample / 8);
+    }
+};
+
+/**
+ * @brief The corpus: every sample type WavefileConversionTask::run dispatches
+ * on, mono and stereo, at several rates and lengths, plus 24 bit and surround
+ * files that are unpacked or downmixed before encoding. The longest case is
+ * long enough to be split into segments by a segmented profile.
+ *
+ * @param scale Factor applied to every length, below 1 for quick runs.
+ */
+std::vector<SyntheticFormat> corpus_formats(double scale = 1.0);
+
+/**
+ * @brief Write a wav file of the given format.
+ *
+ * The samples are a few sines plus noise from a fixed seed, so the same
+ * format always produces the same bytes on every machine. An odd-sized LIST
+ * chunk sits before the data chunk, as written by many editors.
+ *
+ * @throws std::runtime_error When the file can not be written.
+ */
+void write_synthetic_wav(const std::filesystem::path &file,
+                         const SyntheticFormat &      format);
+
+/**
+ * @brief Write the whole corpus into directory, skipping files that already
+ * exist with the expected size.
+ *
+ * @return The written files, in the order of the formats.
+ */
+std::vector<std::filesystem::path>
+write_corpus(const std::filesystem::path &       directory,
+             const std::vector<SyntheticFormat> &formats);
+
+/**
+ * @brief Write a folder of short files like sound effects or voice prompts,
+ * a thousand files of two seconds of mono 16 bit at 22.05 kHz, skipping files
+ * that already exist with the expected size.
+ *
+ * @param scale Factor applied to the number of files, at least 50 are written.
+ * @return The written files.
+ */
+std::vector<std::filesystem::path>
+write_small_file_corpus(const std::filesystem::path &directory,
+                        double                       scale = 1.0);
+
+} // namespace mp3_converter::bench
+#endif /* MP3_CONVERTER_BENCH_SYNTHETICWAV_H */
@@ -0,0 +1,603 @@
+#include "ByteSink.h"
+#include "Deinterleave.h"
+#include "FileConversion.h"
+#include "LameEncodingTask.h"
+#include "SampleConvert.h"
+#include "SyntheticWav.h"
+#include "ThreadPool.h"
+#include "WavefileConversionTask.h"
+#include "WavefileReader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Benchmark suite of the converter, run on a generated corpus of wav files
+ * covering every sample type the converter dispatches on.
+ *
+ * Measures header parsing, stereo deinterleaving, 24 bit unpacking and
+ * downmixing, encoding from memory and
+ * whole conversions from file to file, single and as a batch on the pool, and
+ * the files per second through a folder of short files.
+ * Prints a table, or with --json one object per run that can be stored and
+ * compared between releases. Each result is the best of a few runs.
+ */
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+namespace bench  = mp3_converter::bench;
+
+constexpr const char *default_corpus = "mp3_converter_bench_corpus";
+
+// sub folder of the corpus holding the short files.
+constexpr const char *small_files_folder = "small_files";
+
+// header parses timed per run, a single parse is too short to time.
+constexpr int header_repetitions = 200;
+
+// deinterleave calls timed per run, on blocks as large as the converter's.
+constexpr int    deinterleave_repetitions = 200;
+constexpr size_t deinterleave_frames      = 1152 * 64;
+
+// 5.1, the common case of the downmix.
+constexpr int surround_channels = 6;
+
+void print_usage()
+{
+    std::cout
+        << "Benchmarks mp3_converter on a generated corpus of wav files.\n\n"
+        << "Usage: mp3_converter_bench [options]\n\n"
+        << "Options:\n"
+        << "  --json            Print results as json.\n"
+        << "  --quick           Use a corpus a tenth as long, one run each.\n"
+        << "  --runs N          Report the best of N runs, default 3.\n"
+        << "  --corpus DIR      Where to keep the corpus, default in the "
+           "temp folder.\n"
+        << "  --generate DIR    Only write the corpus into DIR and exit.\n"
+        << "  -h, --help        Print this message.\n"
+        << std::endl;
+}
+
+struct Options
+{
+    bool                  json {false};
+    double                scale {1.0};
+    int                   runs {3};
+    std::filesystem::path corpus {std::filesystem::temp_directory_path()
+                                  / default_corpus};
+    bool                  generate_only {false};
+};
+
+/**
+ * @struct Result
+ *
+ * @brief One measurement. Throughput and realtime factor are left out where
+ * they do not apply.
+ */
+struct Result
+{
+    std::string           bench;
+    std::string           name;
+    double                seconds {};
+    std::optional<double> mb_per_s {};
+    std::optional<double> realtime {};
+    std::optional<double> files_per_s {};
+};
+
+/**
+ * @class NullBuffer
+ *
+ * @brief Swallows the progress lines the conversion task prints, so they do
+ * not end up in the json.
+ */
+class NullBuffer : public std::streambuf
+{
+  protected:
+    int overflow(int c) override
+    {
+        return c;
+    }
+};
+
+/**
+ * @class CountingSink
+ *
+ * @brief Drops the encoded bytes, so encoding is timed without file io.
+ */
+class CountingSink : public mp3_converter::ByteSink
+{
+  public:
+    void write(const unsigned char *, size_t size) override
+    {
+        m_bytes += size;
+    }
+
+  private:
+    size_t m_bytes {};
+};
+
+/**
+ * @brief Best wall time of job over the given number of runs, in seconds.
+ */
+double best_of(int runs, const std::function<void()> &job)
+{
+    double best = 1e300;
+    for (int run = 0; run < runs; ++run)
+    {
+        const auto                          start = clock_type::now();
+        job();
+        const std::chrono::duration<double> elapsed = clock_type::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+double audio_seconds(const bench::SyntheticFormat &format)
+{
+    return static_cast<double>(static_cast<uint64_t>(format.seconds
+                                                     * format.sample_rate))
+           / format.sample_rate;
+}
+
+void bench_headers(const Options &                          options,
+                   const std::vector<bench::SyntheticFormat> &formats,
+                   const std::vector<std::filesystem::path> &  files,
+                   std::vector<Result> &                       results)
+{
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const double seconds = best_of(options.runs, [&] {
+            for (int r = 0; r < header_repetitions; ++r)
+                mp3_converter::open_wavefile(files[i]);
+        });
+        results.push_back(
+            {"header", formats[i].name, seconds / header_repetitions});
+    }
+}
+
+template<typename T>
+void bench_deinterleave_type(const Options &      options,
+                             const char *         name,
+                             std::vector<Result> &results)
+{
+    std::vector<T> interleaved(deinterleave_frames * 2);
+    for (size_t i = 0; i < interleaved.size(); ++i)
+        interleaved[i] = static_cast<T>((i * 2654435761u) % 30000) - T(15000);
+    std::vector<T> left(deinterleave_frames);
+    std::vector<T> right(deinterleave_frames);
+
+    const double mb = interleaved.size() * sizeof(T) / 1e6;
+
+    const double scalar = best_of(options.runs, [&] {
+        for (int r = 0; r < deinterleave_repetitions; ++r)
+            mp3_converter::deinterleave_stereo_scalar(interleaved.data(),
+                                                      left.data(),
+                                                      right.data(),
+                                                      deinterleave_frames,
+                                                      sizeof(T));
+    });
+    const double kernel = best_of(options.runs, [&] {
+        for (int r = 0; r < deinterleave_repetitions; ++r)
+            mp3_converter::deinterleave_stereo(interleaved.data(),
+                                               left.data(),
+                                               right.data(),
+                                               deinterleave_frames);
+    });
+
+    results.push_back({"deinterleave",
+                       std::string(name) + "_scalar",
+                       scalar / deinterleave_repetitions,
+                       mb * deinterleave_repetitions / scalar});
+    results.push_back({"deinterleave",
+                       std::string(name) + "_"
+                           + mp3_converter::deinterleave_kernel_name(),
+                       kernel / deinterleave_repetitions,
+                       mb * deinterleave_repetitions / kernel});
+}
+
+void bench_sample_convert(const Options &options, std::vector<Result> &results)
+{
+    const size_t               num_samples = deinterleave_frames * 2;
+    std::vector<unsigned char> packed(num_samples * 3);
+    for (size_t i = 0; i < packed.size(); ++i)
+        packed[i] = static_cast<unsigned char>((i * 2654435761u) >> 13);
+    std::vector<int32_t> unpacked(num_samples);
+
+    const double packed_mb = packed.size() / 1e6;
+
+    const double scalar = best_of(options.runs, [&] {
+        for (int r = 0; r < deinterleave_repetitions; ++r)
+            mp3_converter::unpack_pcm24_scalar(
+                packed.data(), unpacked.data(), num_samples);
+    });
+    const double kernel = best_of(options.runs, [&] {
+        for (int r = 0; r < deinterleave_repetitions; ++r)
+            mp3_converter::unpack_pcm24(
+                packed.data(), unpacked.data(), num_samples);
+    });
+
+    const std::string kernel_name = mp3_converter::sample_convert_kernel_name();
+    results.push_back({"unpack24",
+                       "int24_scalar",
+                       scalar / deinterleave_repetitions,
+                       packed_mb * deinterleave_repetitions / scalar});
+    results.push_back({"unpack24",
+                       "int24_" + kernel_name,
+                       kernel / deinterleave_repetitions,
+                       packed_mb * deinterleave_repetitions / kernel});
+
+    // the same bytes as 5.1 frames of packed 24 bit and of float.
+    const auto   gains = *mp3_converter::StereoDownmix::for_layout(
+        surround_channels, 0);
+    const size_t num_frames = num_samples / surround_channels;
+    std::vector<float> floats(num_samples);
+    for (size_t i = 0; i < floats.size(); ++i)
+        floats[i] = static_cast<float>(unpacked[i]) / 2147483648.0f;
+    std::vector<float> scratch(num_samples);
+    std::vector<float> left(num_frames);
+    std::vector<float> right(num_frames);
+
+    auto bench_downmix = [&](mp3_converter::SampleEncoding encoding,
+                             const void *                  samples,
+                             const char *                  name,
+                             double                        mb) {
+        const double seconds = best_of(options.runs, [&] {
+            for (int r = 0; r < deinterleave_repetitions; ++r)
+                mp3_converter::downmix_to_stereo(samples,
+                                                 encoding,
+                                                 gains,
+                                                 num_frames,
+                                                 scratch.data(),
+                                                 left.data(),
+                                                 right.data());
+        });
+        results.push_back({"downmix",
+                           std::string(name) + "_" + kernel_name,
+                           seconds / deinterleave_repetitions,
+                           mb * deinterleave_repetitions / seconds});
+    };
+    bench_downmix(mp3_converter::SampleEncoding::int24,
+                  packed.data(),
+                  "surround51_int24",
+                  packed_mb);
+    bench_downmix(mp3_converter::SampleEncoding::float32,
+                  floats.data(),
+                  "surround51_float",
+                  floats.size() * sizeof(float) / 1e6);
+}
+
+/**
+ * @brief Encode samples already in memory the way the converter hands them to
+ * lame, block by block.
+ */
+template<typename T>
+void encode_from_memory(const std::vector<char> &     data,
+                        const bench::SyntheticFormat &format)
+{
+    CountingSink                      sink;
+    mp3_converter::LameEncodingTask<T> task(sink);
+
+    const unsigned long num_frames = static_cast<unsigned long>(
+        data.size() / (sizeof(T) * format.num_channels));
+    task.Begin(num_frames, format.sample_rate, format.num_channels);
+
+    constexpr auto block_frames = mp3_converter::LameEncodingTask<T>::block_frames;
+    const T *      samples      = reinterpret_cast<const T *>(data.data());
+    for (unsigned long offset = 0; offset < num_frames; offset += block_frames)
+    {
+        const auto block = std::min(block_frames, num_frames - offset);
+        const T *  p     = samples + offset * format.num_channels;
+        if (format.num_channels == 1)
+            task.EncodeBlock(block, p, p);
+        else
+            task.EncodeInterleavedBlock(block, p);
+    }
+    task.Finish();
+}
+
+void bench_encode(const Options &                          options,
+                  const std::vector<bench::SyntheticFormat> &formats,
+                  const std::vector<std::filesystem::path> &  files,
+                  std::vector<Result> &                       results)
+{
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const auto &format = formats[i];
+
+        // unpacked or downmixed before lame sees them, covered end to end and
+        // by bench_sample_convert.
+        if (format.num_channels > 2 || format.bits_per_sample == 24)
+            continue;
+
+        // copied out once, so only lame and the block loop are timed.
+        auto              reader = mp3_converter::open_wavefile(files[i]);
+        const auto        size   = static_cast<size_t>(reader->layout().data_size);
+        std::vector<char> data(size);
+        std::memcpy(data.data(), reader->next_block(size, 1), size);
+
+        std::function<void()> job;
+        if (format.audio_format == 1 && format.bits_per_sample == 16)
+            job = [&] { encode_from_memory<int16_t>(data, format); };
+        else if (format.audio_format == 1 && format.bits_per_sample == 32)
+            job = [&] { encode_from_memory<int32_t>(data, format); };
+        else if (format.audio_format == 3 && format.bits_per_sample == 32)
+            job = [&] { encode_from_memory<float>(data, format); };
+        else
+            job = [&] { encode_from_memory<double>(data, format); };
+
+        const double seconds = best_of(options.runs, job);
+        results.push_back({"encode",
+                           format.name,
+                           seconds,
+                           size / 1e6 / seconds,
+                           audio_seconds(format) / seconds});
+    }
+}
+
+void bench_end_to_end(const Options &                          options,
+                      const std::vector<bench::SyntheticFormat> &formats,
+                      const std::vector<std::filesystem::path> &  files,
+                      std::vector<Result> &                       results)
+{
+    double total_mb    = 0;
+    double total_audio = 0;
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const double seconds = best_of(options.runs, [&] {
+            mp3_converter::WavefileConversionTask(files[i]).run();
+        });
+        const double mb = std::filesystem::file_size(files[i]) / 1e6;
+        results.push_back({"end_to_end",
+                           formats[i].name,
+                           seconds,
+                           mb / seconds,
+                           audio_seconds(formats[i]) / seconds});
+
+        total_mb += mb;
+        total_audio += audio_seconds(formats[i]);
+    }
+
+    // the whole corpus at once on a pool as large as the machine, largest
+    // file first like the converter does.
+    std::vector<size_t> order(files.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        return formats[lhs].data_bytes() > formats[rhs].data_bytes();
+    });
+
+    const double seconds = best_of(options.runs, [&] {
+        mp3_converter::ThreadPool pool(
+            std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::future<bool>> done;
+        for (const auto i : order)
+            done.push_back(pool.submit([&files, i] {
+                return mp3_converter::WavefileConversionTask(files[i]).run();
+            }));
+        for (auto &result : done)
+            result.get();
+    });
+    results.push_back({"end_to_end",
+                       "corpus_on_pool",
+                       seconds,
+                       total_mb / seconds,
+                       total_audio / seconds});
+}
+
+/**
+ * @brief A folder of short files through the pool, one job per file against
+ * the batches of convert_batch the converter submits them in.
+ */
+void bench_small_files(const Options &                          options,
+                       const std::vector<std::filesystem::path> &files,
+                       std::vector<Result> &                    results)
+{
+    double mb = 0;
+    for (const auto &file : files)
+        mb += std::filesystem::file_size(file) / 1e6;
+    // two seconds each, see write_small_file_corpus.
+    const double audio   = 2.0 * files.size();
+    const auto   workers = std::max(1u, std::thread::hardware_concurrency());
+
+    const double per_file = best_of(options.runs, [&] {
+        mp3_converter::ThreadPool      pool(workers);
+        std::vector<std::future<bool>> done;
+        for (const auto &file : files)
+            done.push_back(pool.submit(
+                [&file] { return mp3_converter::convert_file(file); }));
+        for (auto &result : done)
+            result.get();
+    });
+
+    const double batched = best_of(options.runs, [&] {
+        mp3_converter::ThreadPool        pool(workers);
+        std::vector<std::future<size_t>> done;
+        for (size_t i = 0; i < files.size();
+             i += mp3_converter::max_batch_files)
+        {
+            const auto end =
+                std::min(i + mp3_converter::max_batch_files, files.size());
+            std::vector<std::function<bool()>> batch;
+            for (size_t j = i; j < end; ++j)
+                batch.push_back([&file = files[j]] {
+                    return mp3_converter::convert_file(file);
+                });
+            done.push_back(pool.submit([batch = std::move(batch)] {
+                return mp3_converter::convert_batch(batch);
+            }));
+        }
+        for (auto &result : done)
+            result.get();
+    });
+
+    for (const auto &[name, seconds] :
+         {std::pair<const char *, double> {"per_file", per_file},
+          std::pair<const char *, double> {"batched", batched}})
+        results.push_back({"small_files",
+                           name,
+                           seconds,
+                           mb / seconds,
+                           audio / seconds,
+                           files.size() / seconds});
+}
+
+std::string json_number(const std::optional<double> &value)
+{
+    if (!value)
+        return "null";
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", *value);
+    return buffer;
+}
+
+void print_json(const Options &options, const std::vector<Result> &results)
+{
+    std::printf("{\n  \"format\": \"mp3_converter_bench 1\",\n");
+    std::printf("  \"machine\": {\"hardware_threads\": %u, "
+                "\"deinterleave_kernel\": \"%s\", \"lame\": \"%s\"},\n",
+                std::thread::hardware_concurrency(),
+                mp3_converter::deinterleave_kernel_name(),
+                get_lame_version());
+    std::printf("  \"corpus_scale\": %s,\n  \"runs\": %d,\n",
+                json_number(options.scale).c_str(),
+                options.runs);
+    std::printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto &result = results[i];
+        std::printf("    {\"bench\": \"%s\", \"case\": \"%s\", \"seconds\": "
+                    "%s, \"mb_per_s\": %s, \"realtime\": %s, "
+                    "\"files_per_s\": %s}%s\n",
+                    result.bench.c_str(),
+                    result.name.c_str(),
+                    json_number(result.seconds).c_str(),
+                    json_number(result.mb_per_s).c_str(),
+                    json_number(result.realtime).c_str(),
+                    json_number(result.files_per_s).c_str(),
+                    i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+void print_table(const std::vector<Result> &results)
+{
+    std::printf("lame %s, deinterleave kernel %s, %u hardware threads\n\n",
+                get_lame_version(),
+                mp3_converter::deinterleave_kernel_name(),
+                std::thread::hardware_concurrency());
+    std::printf("%-13s %-26s %12s %10s %10s %10s\n",
+                "bench",
+                "case",
+                "seconds",
+                "MB/s",
+                "realtime",
+                "files/s");
+
+    for (const auto &result : results)
+    {
+        const auto realtime =
+            result.realtime ? json_number(result.realtime) + "x" : "-";
+        std::printf("%-13s %-26s %12.6f %10s %10s %10s\n",
+                    result.bench.c_str(),
+                    result.name.c_str(),
+                    result.seconds,
+                    result.mb_per_s ? json_number(result.mb_per_s).c_str()
+                                    : "-",
+                    realtime.c_str(),
+                    result.files_per_s
+                        ? json_number(result.files_per_s).c_str()
+                        : "-");
+    }
+}
+
+bool parse_options(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument(argv[i]);
+        const bool        has_value = i + 1 < argc;
+
+        if (argument == "-h" || argument == "--help")
+            return false;
+        else if (argument == "--json")
+            options.json = true;
+        else if (argument == "--quick")
+        {
+            options.scale = 0.1;
+            options.runs  = 1;
+        }
+        else if (argument == "--runs" && has_value)
+            options.runs = std::max(1, std::atoi(argv[++i]));
+        else if (argument == "--corpus" && has_value)
+            options.corpus = argv[++i];
+        else if (argument == "--generate" && has_value)
+        {
+            options.corpus        = argv[++i];
+            options.generate_only = true;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        print_usage();
+        return -1;
+    }
+
+    const auto formats     = bench::corpus_formats(options.scale);
+    const auto files       = bench::write_corpus(options.corpus, formats);
+    const auto small_files = bench::write_small_file_corpus(
+        options.corpus / small_files_folder, options.scale);
+    if (options.generate_only)
+        return 0;
+
+    NullBuffer null_buffer;
+    auto *     console = std::cout.rdbuf(&null_buffer);
+
+    std::vector<Result> results;
+    try
+    {
+        bench_headers(options, formats, files, results);
+        bench_deinterleave_type<int16_t>(options, "int16", results);
+        bench_deinterleave_type<int32_t>(options, "int32", results);
+        bench_deinterleave_type<float>(options, "float", results);
+        bench_deinterleave_type<double>(options, "double", results);
+        bench_sample_convert(options, results);
+        bench_encode(options, formats, files, results);
+        bench_end_to_end(options, formats, files, results);
+        bench_small_files(options, small_files, results);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout.rdbuf(console);
+        std::cerr << "Benchmark failed: " << e.what() << "\n";
+        return -1;
+    }
+    std::cout.rdbuf(console);
+
+    if (options.json)
+        print_json(options, results);
+    else
+        print_table(results);
+
+    return 0;
+}
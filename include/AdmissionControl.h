@@ -0,0 +1,89 @@
+#ifndef MP3_CONVERTER_ADMISSIONCONTROL_H
+#define MP3_CONVERTER_ADMISSIONCONTROL_H
+
+#include "ThreadPool.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace mp3_converter {
+
+/**
+ * @class AdmissionControl
+ *
+ * @brief Hands jobs to a thread pool only while the memory they are expected
+ * to need at their peak fits into a budget.
+ *
+ * Jobs are admitted in submission order as long as they fit. A job that does
+ * not fit waits, and later, smaller jobs that do fit are admitted past it, so
+ * the workers stay busy. After a waiting job has been passed over a few times,
+ * nothing else is admitted until it fits. A job larger than the whole budget
+ * is admitted once nothing else runs, so it still completes.
+ */
+class AdmissionControl
+{
+  public:
+    /**
+     * @param pool The pool admitted jobs run on.
+     * @param budget_bytes The memory all admitted jobs may need together, 0
+     * for no limit.
+     * @param max_in_flight The most jobs admitted at once, bounds how far
+     * ahead of the workers jobs are queued in the pool.
+     */
+    AdmissionControl(ThreadPool &pool,
+                     uint64_t    budget_bytes,
+                     size_t      max_in_flight);
+
+    /**
+     * @brief Wait until every submitted job ran.
+     */
+    ~AdmissionControl();
+
+    AdmissionControl(const AdmissionControl &) = delete;
+    AdmissionControl &operator=(const AdmissionControl &) = delete;
+
+    /**
+     * @brief Queue a job that needs about peak_bytes while it runs. Does not
+     * block.
+     *
+     * @return A future for the result of job, holding its exception if it
+     * throws.
+     */
+    std::future<bool> submit(uint64_t peak_bytes, std::function<bool()> job);
+
+    /**
+     * @brief The memory the admitted jobs are expected to need right now.
+     */
+    uint64_t reserved_bytes() const;
+
+  private:
+    struct Pending
+    {
+        uint64_t                                    peak_bytes;
+        std::shared_ptr<std::packaged_task<bool()>> task;
+        size_t                                      passed_over {};
+    };
+
+    /// Hand every pending job that fits to the pool. Locked by the caller.
+    void admit_locked();
+    void release(uint64_t peak_bytes);
+
+    ThreadPool &   m_pool;
+    const uint64_t m_budget;
+    const size_t   m_max_in_flight;
+
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_idle;
+    std::deque<Pending>     m_pending;
+    uint64_t                m_reserved {};
+    size_t                  m_in_flight {};
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_ADMISSIONCONTROL_H */
@@ -0,0 +1,96 @@
+#ifndef MP3_CONVERTER_BOUNDEDQUEUE_H
+#define MP3_CONVERTER_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace mp3_converter {
+
+/**
+ * @class BoundedQueue
+ *
+ * @brief A blocking FIFO queue of limited capacity between producer and
+ * consumer threads.
+ *
+ * Producers block while the queue is full, so a fast producer can not run
+ * arbitrarily far ahead of its consumers. Closing the queue wakes everybody:
+ * consumers drain what is left and then get nullopt.
+ *
+ * @tparam T The type of the queued items.
+ */
+template<typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue(size_t capacity)
+        : m_capacity(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    /**
+     * @brief Append an item, blocking while the queue is full.
+     *
+     * @return False if the queue was closed and the item dropped.
+     */
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(
+            lock, [this] { return m_items.size() < m_capacity || m_closed; });
+        if (m_closed)
+            return false;
+
+        m_items.push_back(std::move(item));
+        lock.unlock();
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest item, blocking while the queue is empty.
+     *
+     * @return The item, nullopt once the queue is closed and drained.
+     */
+    std::optional<T> pop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this] { return !m_items.empty() || m_closed; });
+        if (m_items.empty())
+            return std::nullopt;
+
+        T item = std::move(m_items.front());
+        m_items.pop_front();
+        lock.unlock();
+        m_not_full.notify_one();
+        return item;
+    }
+
+    /**
+     * @brief Stop accepting items and wake all waiting threads.
+     */
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_not_full.notify_all();
+        m_not_empty.notify_all();
+    }
+
+  private:
+    const size_t m_capacity;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::deque<T>           m_items;
+    bool                    m_closed {false};
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_BOUNDEDQUEUE_H */
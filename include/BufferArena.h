@@ -0,0 +1,112 @@
+#ifndef MP3_CONVERTER_BUFFERARENA_H
+#define MP3_CONVERTER_BUFFERARENA_H
+
+#include <cstddef>
+#include <vector>
+
+namespace mp3_converter {
+
+class BufferArena;
+
+/**
+ * @class PooledBuffer
+ *
+ * @brief A byte buffer borrowed from a BufferArena, handed back to it on
+ * destruction. Move-only.
+ *
+ * The memory comes from operator new and is aligned for every fundamental
+ * type, so it can hold samples of any type.
+ */
+class PooledBuffer
+{
+  public:
+    PooledBuffer() = default;
+    ~PooledBuffer();
+
+    PooledBuffer(PooledBuffer &&other) noexcept;
+    PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    /**
+     * @brief Make room for at least size bytes. Keeps the contents only up to
+     * the old size, and never gives memory back.
+     */
+    void resize(size_t size);
+
+    unsigned char *data()
+    {
+        return m_bytes.data();
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    template<typename T>
+    T *as()
+    {
+        return reinterpret_cast<T *>(m_bytes.data());
+    }
+
+  private:
+    friend class BufferArena;
+
+    PooledBuffer(BufferArena *arena, std::vector<unsigned char> bytes);
+
+    void release() noexcept;
+
+    BufferArena *m_arena {nullptr};
+
+    // may be larger than m_size, so growing within what the arena handed out
+    // does not touch the memory again.
+    std::vector<unsigned char> m_bytes {};
+    size_t                     m_size {};
+};
+
+/**
+ * @class BufferArena
+ *
+ * @brief A per-thread pool of byte buffers that are reused from file to file.
+ *
+ * Buffers grow on demand and keep their memory when handed back, up to a
+ * watermark per buffer; anything beyond the watermark is freed again, so one
+ * unusual file does not pin its memory in the worker forever. Not thread
+ * safe, buffers have to be handed back on the thread that borrowed them.
+ */
+class BufferArena
+{
+  public:
+    /// Buffers are never shrunk below this many bytes when handed back.
+    static constexpr size_t watermark = 4 * 1024 * 1024;
+
+    /// At most this many buffers are kept for reuse.
+    static constexpr size_t max_pooled = 8;
+
+    /**
+     * @brief The arena of the calling thread, living as long as the thread.
+     */
+    static BufferArena &for_this_thread();
+
+    /**
+     * @brief Borrow a buffer of at least size bytes.
+     */
+    PooledBuffer acquire(size_t size);
+
+    /**
+     * @brief The number of bytes currently held for reuse.
+     */
+    size_t pooled_bytes() const;
+
+  private:
+    friend class PooledBuffer;
+
+    void give_back(std::vector<unsigned char> bytes) noexcept;
+
+    std::vector<std::vector<unsigned char>> m_free {};
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_BUFFERARENA_H */
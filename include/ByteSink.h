@@ -0,0 +1,228 @@
+#ifndef MP3_CONVERTER_BYTESINK_H
+#define MP3_CONVERTER_BYTESINK_H
+
+#include "BufferArena.h"
+#include "StageTimers.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+namespace mp3_converter {
+
+/**
+ * @class ByteSink
+ *
+ * @brief Destination for encoded mp3 bytes, written to in order as they are
+ * produced.
+ */
+class ByteSink
+{
+  public:
+    virtual ~ByteSink() = default;
+
+    /**
+     * @brief Append size bytes to the sink.
+     */
+    virtual void write(const unsigned char *data, size_t size) = 0;
+
+    /**
+     * @brief Hint that about size bytes are going to be written in total, so
+     * the sink can allocate room for them up front.
+     */
+    virtual void reserve(uint64_t /*size*/)
+    {
+    }
+
+    /**
+     * @brief Finish writing.
+     *
+     * @return True if everything written so far has arrived, else false.
+     */
+    virtual bool close()
+    {
+        return true;
+    }
+};
+
+/**
+ * @class FileSink
+ *
+ * @brief Writes to a file, which only appears under its name once it was
+ * written completely.
+ *
+ * The bytes go into a temporary file next to the target, in large blocks
+ * collected in a buffer. close() renames the temporary file over the target,
+ * which replaces it atomically. If the sink is destroyed before a successful
+ * close, for instance while an exception unwinds, the temporary file is
+ * removed and an existing target stays untouched.
+ *
+ * The buffer is borrowed from the arena of the constructing thread, so a sink
+ * has to be destroyed there. Writes may come from any thread, one at a time.
+ */
+class FileSink : public ByteSink
+{
+  public:
+    /// Bytes collected before they are written, every write but the last is
+    /// exactly this large.
+    static constexpr size_t write_block = 1024 * 1024;
+
+    /**
+     * @brief Create the temporary file for file.
+     *
+     * @throws std::filesystem::filesystem_error When it can not be created,
+     * for instance in a read-only folder.
+     */
+    explicit FileSink(const std::filesystem::path &file);
+    ~FileSink() override;
+
+    FileSink(const FileSink &) = delete;
+    FileSink &operator=(const FileSink &) = delete;
+
+    void write(const unsigned char *data, size_t size) override;
+
+    /**
+     * @brief Preallocate the temporary file, so it is laid out in one piece
+     * instead of growing block by block. Unused room is cut off on close.
+     */
+    void reserve(uint64_t size) override;
+
+    /**
+     * @brief Write what is left in the buffer and publish the file under its
+     * name.
+     *
+     * @return True if the file was written completely and renamed, else false.
+     * The temporary file is removed then.
+     */
+    bool close() override;
+
+  private:
+    bool flush_buffer();
+    void discard() noexcept;
+
+    std::filesystem::path m_file;
+    std::filesystem::path m_temporary;
+
+    int          m_fd {-1};
+    bool         m_failed {false};
+    uint64_t     m_written {};
+    PooledBuffer m_buffer {};
+};
+
+/**
+ * @brief How share_file made its copy.
+ */
+enum class FileCopy
+{
+    /// A copy on write clone, sharing the data blocks until either changes.
+    reflink,
+    /// A second name of the same file.
+    hard_link,
+    /// The bytes were copied.
+    copy
+};
+
+/**
+ * @brief Make target a copy of the finished file source, sharing its storage
+ * where the file system can: a reflink, else a hard link, else a plain copy.
+ *
+ * Like FileSink, the copy is made under a hidden temporary name and renamed
+ * over the target, so an existing target is either replaced atomically or
+ * stays untouched.
+ *
+ * @throws std::filesystem::filesystem_error When no copy could be made.
+ */
+FileCopy share_file(const std::filesystem::path &source,
+                    const std::filesystem::path &target);
+
+/**
+ * @class DescriptorSink
+ *
+ * @brief Writes to an open file descriptor, such as stdout, as the bytes come.
+ *
+ * Nothing is buffered, so a consumer on the other end of a pipe gets every
+ * block of frames as soon as lame produced it. The descriptor is not closed.
+ */
+class DescriptorSink : public ByteSink
+{
+  public:
+    explicit DescriptorSink(int fd)
+        : m_fd(fd)
+    {
+    }
+
+    void write(const unsigned char *data, size_t size) override;
+
+    /**
+     * @return True if every write arrived completely, else false.
+     */
+    bool close() override
+    {
+        return !m_failed;
+    }
+
+  private:
+    int  m_fd;
+    bool m_failed {false};
+};
+
+/**
+ * @class CallbackSink
+ *
+ * @brief Hands every run of bytes to a callback as soon as it is written, for
+ * embedders that stream the mp3 on themselves. Nothing is buffered.
+ */
+class CallbackSink : public ByteSink
+{
+  public:
+    using Callback = std::function<void(const unsigned char *, size_t)>;
+
+    explicit CallbackSink(Callback callback)
+        : m_callback(std::move(callback))
+    {
+    }
+
+    void write(const unsigned char *data, size_t size) override
+    {
+        if (size == 0)
+            return;
+
+        stages::ScopedStage timer(stages::Stage::write, size);
+        m_callback(data, size);
+    }
+
+  private:
+    Callback m_callback;
+};
+
+/**
+ * @class MemorySink
+ *
+ * @brief Collects everything written in memory.
+ */
+class MemorySink : public ByteSink
+{
+  public:
+    void write(const unsigned char *data, size_t size) override
+    {
+        m_bytes.insert(m_bytes.end(), data, data + size);
+    }
+
+    void reserve(uint64_t size) override
+    {
+        m_bytes.reserve(static_cast<size_t>(size));
+    }
+
+    std::vector<unsigned char> &bytes()
+    {
+        return m_bytes;
+    }
+
+  private:
+    std::vector<unsigned char> m_bytes {};
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_BYTESINK_H */
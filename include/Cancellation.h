@@ -0,0 +1,101 @@
+#ifndef MP3_CONVERTER_CANCELLATION_H
+#define MP3_CONVERTER_CANCELLATION_H
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+
+namespace mp3_converter {
+
+/**
+ * @struct cancelled_error
+ *
+ * @brief An error class indicating that a conversion was cancelled or ran
+ * past its deadline. Outputs begun by it are removed while it unwinds.
+ */
+struct cancelled_error : std::runtime_error
+{
+    // inherit c'tors
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @class CancellationToken
+ *
+ * @brief Asks a conversion to stop, checked cooperatively between blocks.
+ *
+ * A token is cancelled explicitly, once its deadline passed, or once its
+ * parent is, so a batch-wide token can stop every file, while each file has
+ * its own deadline. Checking is two relaxed atomic loads and a clock read.
+ */
+class CancellationToken
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param parent A token this one follows, must outlive it. nullptr for
+     * none.
+     * @param timeout Time from now after which the token counts as
+     * cancelled, none if zero.
+     */
+    explicit CancellationToken(const CancellationToken * parent  = nullptr,
+                               std::chrono::milliseconds timeout = {});
+
+    CancellationToken(const CancellationToken &) = delete;
+    CancellationToken &operator=(const CancellationToken &) = delete;
+
+    /// Cancel, safe to call from any thread.
+    void cancel();
+
+    bool cancelled() const;
+
+    /**
+     * @throws cancelled_error When cancelled, saying whether the deadline
+     * passed.
+     */
+    void throw_if_cancelled() const;
+
+    /// The token of the calling thread, nullptr outside a CancellationScope.
+    static const CancellationToken *current();
+
+  private:
+    bool deadline_passed() const;
+
+    const CancellationToken *              m_parent;
+    const std::chrono::milliseconds        m_timeout;
+    const std::optional<clock::time_point> m_deadline;
+    std::atomic<bool>                      m_cancelled {false};
+};
+
+/**
+ * @class CancellationScope
+ *
+ * @brief Makes a token the one of the calling thread for the scope's lifetime,
+ * so the conversion running on it checks the token without it being handed
+ * down. Jobs a conversion spreads to other threads take it along.
+ */
+class CancellationScope
+{
+  public:
+    explicit CancellationScope(const CancellationToken *token);
+    ~CancellationScope();
+
+    CancellationScope(const CancellationScope &) = delete;
+    CancellationScope &operator=(const CancellationScope &) = delete;
+
+  private:
+    const CancellationToken *m_previous;
+};
+
+/**
+ * @brief Throw if the token of the calling thread is cancelled. Does nothing
+ * outside a CancellationScope.
+ *
+ * @throws cancelled_error When the token is cancelled.
+ */
+void throw_if_cancelled();
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_CANCELLATION_H */
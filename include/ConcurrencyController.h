@@ -0,0 +1,82 @@
+#ifndef MP3_CONVERTER_CONCURRENCYCONTROLLER_H
+#define MP3_CONVERTER_CONCURRENCYCONTROLLER_H
+
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace mp3_converter {
+
+/**
+ * @class ConcurrencyController
+ *
+ * @brief Tunes the number of active workers of a pool while it converts, from
+ * the measured throughput and how much of their time the workers spend on
+ * the CPU rather than waiting for the disk.
+ *
+ * Twice a second the controller compares the CPU time the process used with
+ * the wall time of the active workers. Workers that are busy less than most of
+ * the time wait for I/O, so another one is activated; oversubscribed workers
+ * that are all busy only compete for the cores, so one is parked. A change
+ * that lowers the throughput is taken back, and the level is held for a while.
+ * Periods without queued jobs are not measured, idle workers tell nothing.
+ *
+ * Every change of the level is logged through ProgressReporter::log.
+ * The throughput is the input counted by ProgressReporter::count_input.
+ */
+class ConcurrencyController
+{
+  public:
+    /**
+     * @brief Start tuning pool, from initial active workers up to all of the
+     * pool's workers.
+     */
+    ConcurrencyController(ThreadPool &pool, unsigned int initial);
+
+    /// Stops tuning, the pool keeps the last level.
+    ~ConcurrencyController();
+
+    ConcurrencyController(const ConcurrencyController &) = delete;
+    ConcurrencyController &operator=(const ConcurrencyController &) = delete;
+
+  private:
+    struct Sample
+    {
+        std::chrono::steady_clock::time_point wall;
+        std::chrono::nanoseconds              cpu;
+        uint64_t                              bytes;
+    };
+
+    static Sample take_sample();
+
+    void run();
+
+    /// Decide on the level for the next period, given the last one.
+    void adjust(double bytes_per_second, double busy);
+
+    void set_level(unsigned int level, double bytes_per_second, double busy);
+
+    ThreadPool &       m_pool;
+    const unsigned int m_cores;
+
+    // the level before the last change and the throughput measured with it,
+    // while the change is on trial.
+    unsigned int m_previous_level {};
+    double       m_previous_throughput {};
+    bool         m_on_trial {false};
+
+    // periods left before the level may change again.
+    unsigned int m_hold {};
+
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    bool                    m_stopping {false};
+    std::thread             m_thread;
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_CONCURRENCYCONTROLLER_H */
@@ -0,0 +1,51 @@
+#ifndef MP3_CONVERTER_CONTENTHASH_H
+#define MP3_CONVERTER_CONTENTHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace mp3_converter {
+
+/**
+ * @class ContentHash
+ *
+ * @brief A streaming 64 bit hash of a byte sequence, following the XXH64
+ * algorithm.
+ *
+ * Not cryptographic, but fast enough to hash whole data chunks at memory speed
+ * and sensitive to every changed bit. The digest does not depend on how the
+ * input is split into update calls.
+ */
+class ContentHash
+{
+  public:
+    explicit ContentHash(uint64_t seed = 0);
+
+    /**
+     * @brief Feed the next size bytes into the hash.
+     */
+    void update(const void *data, size_t size);
+
+    /**
+     * @brief The hash of all bytes fed so far. Further updates are allowed.
+     */
+    uint64_t digest() const;
+
+    /**
+     * @brief Format a digest as 16 lower case hex digits.
+     */
+    static std::string to_hex(uint64_t digest);
+
+  private:
+    uint64_t m_lanes[4];
+    uint64_t m_seed;
+    uint64_t m_total {};
+
+    // input that did not fill a whole stripe yet.
+    unsigned char m_stripe[32] {};
+    size_t        m_stripe_size {};
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_CONTENTHASH_H */
@@ -0,0 +1,142 @@
+#ifndef MP3_CONVERTER_CONVERSIONDAEMON_H
+#define MP3_CONVERTER_CONVERSIONDAEMON_H
+
+#include "AdmissionControl.h"
+#include "Cancellation.h"
+#include "EncodeManifest.h"
+#include "EncodingProfile.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace mp3_converter {
+
+/**
+ * @class ConversionDaemon
+ *
+ * @brief Serves conversion jobs submitted over a local Unix socket on a
+ * long-lived thread pool, so a small batch does not pay for process and
+ * thread startup, and incremental manifests stay loaded between batches.
+ *
+ * The protocol is line based, fields are separated by tabs. Requests:
+ *
+ *     convert <TAB> path [<TAB> recursive] [<TAB> incremental]
+ *     ping
+ *     shutdown
+ *
+ * A path is a wav file or a folder of them. Each convert is answered with
+ * "queued <id> <files>" right away, then one line per file as it completes,
+ * "file <id> ok <path>" or "file <id> failed <path> <message>", and finally
+ * "done <id> <converted> <failed> <skipped>". Lines of different jobs on one
+ * connection interleave in completion order. Malformed requests are answered
+ * with "error <message>", ping with "pong". shutdown stops accepting
+ * connections; jobs already queued still complete and are reported.
+ *
+ * A connection is closed once the client closed its sending side and all its
+ * jobs are reported.
+ */
+class ConversionDaemon
+{
+  public:
+    /**
+     * @brief Listen on a socket at the given path. A stale socket file left
+     * behind by a crashed daemon is replaced.
+     *
+     * @param profiles The mp3 files written per wav.
+     * @param max_memory The memory the files converted at once may need
+     * together by their estimates, 0 for no limit. Applies over all jobs.
+     * @param timeout Fail a file whose conversion takes longer, 0 for no
+     * limit.
+     * @param shutdown Cancels every file in flight once cancelled, nullptr
+     * for none. Must outlive the daemon.
+     *
+     * @throws std::system_error When the socket can not be created, or Unix
+     * sockets are not supported on this platform.
+     */
+    ConversionDaemon(const std::filesystem::path &       socket_path,
+                     ThreadPool &                        pool,
+                     const std::vector<EncodingProfile> &profiles =
+                         default_profiles(),
+                     uint64_t                  max_memory = 0,
+                     std::chrono::milliseconds timeout    = {},
+                     const CancellationToken * shutdown   = nullptr);
+
+    /// Closes the socket and removes its file.
+    ~ConversionDaemon();
+
+    ConversionDaemon(const ConversionDaemon &) = delete;
+    ConversionDaemon &operator=(const ConversionDaemon &) = delete;
+
+    /**
+     * @brief Accept and serve clients until one sends shutdown, then wait for
+     * every accepted job to be reported.
+     */
+    void serve();
+
+    /**
+     * @brief Stop accepting connections, as if a client sent shutdown. Safe to
+     * call from any thread.
+     */
+    void stop();
+
+  private:
+    struct Connection;
+    struct Job;
+
+    void serve_connection(std::shared_ptr<Connection> connection);
+    void handle_request(const std::shared_ptr<Connection> &connection,
+                        const std::string &                line);
+    void submit_job(const std::shared_ptr<Connection> &connection,
+                    const std::vector<std::string> &   fields);
+    void finish_file(const std::shared_ptr<Job> &job,
+                     const std::filesystem::path &file,
+                     bool                         success,
+                     const std::string &          message);
+
+    /// The manifest of a root folder, loaded once and kept for later jobs.
+    /// root is spelled canonically, files are looked up relative to it.
+    std::shared_ptr<EncodeManifest>
+    manifest_of(const std::filesystem::path &root);
+
+    std::filesystem::path m_socket_path;
+    ThreadPool &          m_pool;
+
+    // set with a memory budget, files go through it instead of to the pool.
+    std::optional<AdmissionControl> m_admission;
+
+    int m_listen_fd {-1};
+
+    // written to by stop(), wakes the accept loop.
+    int m_wake_fds[2] {-1, -1};
+
+    std::atomic<bool>     m_stopping {false};
+    std::atomic<uint64_t>              m_next_job_id {1};
+    const std::vector<EncodingProfile> m_profiles;
+    const std::string                  m_settings;
+    const std::chrono::milliseconds    m_timeout;
+    const CancellationToken *          m_shutdown;
+
+    // guards the map and serializes saves, which share one temporary file.
+    std::mutex m_manifest_mutex;
+    std::map<std::filesystem::path, std::shared_ptr<EncodeManifest>>
+        m_manifests;
+
+    // connections still served, each on its own detached thread.
+    std::mutex              m_connections_mutex;
+    std::condition_variable m_connections_done;
+    std::set<Connection *>  m_connections;
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_CONVERSIONDAEMON_H */
@@ -0,0 +1,61 @@
+#ifndef MP3_CONVERTER_DEINTERLEAVE_H
+#define MP3_CONVERTER_DEINTERLEAVE_H
+
+#include <cstddef>
+
+namespace mp3_converter {
+
+/**
+ * @brief Split interleaved stereo samples into a left and a right buffer.
+ *
+ * Samples are moved as raw bit patterns, so the kernel for a sample size
+ * serves every type of that size (int and float, long and double). Uses the
+ * widest vector extension available at runtime: AVX2 or SSE2 on x86, NEON on
+ * ARM, plain scalar code elsewhere.
+ *
+ * @param interleaved Ptr to num_frames frames of L R pairs.
+ * @param left Ptr to room for num_frames samples.
+ * @param right Ptr to room for num_frames samples.
+ * @param num_frames The number of frames, that is samples per channel.
+ * @param sample_size The size of one sample in bytes, 2, 4 or 8.
+ */
+void deinterleave_stereo(const void *interleaved,
+                         void *      left,
+                         void *      right,
+                         size_t      num_frames,
+                         size_t      sample_size);
+
+/**
+ * @brief The plain scalar version of deinterleave_stereo, as reference for
+ * benchmarks.
+ */
+void deinterleave_stereo_scalar(const void *interleaved,
+                                void *      left,
+                                void *      right,
+                                size_t      num_frames,
+                                size_t      sample_size);
+
+/**
+ * @brief The name of the vector extension deinterleave_stereo uses on this
+ * machine.
+ */
+const char *deinterleave_kernel_name();
+
+/**
+ * @brief Typed convenience wrapper around deinterleave_stereo.
+ */
+template<typename T>
+void deinterleave_stereo(const T *interleaved,
+                         T *      left,
+                         T *      right,
+                         size_t   num_frames)
+{
+    deinterleave_stereo(static_cast<const void *>(interleaved),
+                        static_cast<void *>(left),
+                        static_cast<void *>(right),
+                        num_frames,
+                        sizeof(T));
+}
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_DEINTERLEAVE_H */
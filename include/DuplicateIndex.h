@@ -0,0 +1,134 @@
+#ifndef MP3_CONVERTER_DUPLICATEINDEX_H
+#define MP3_CONVERTER_DUPLICATEINDEX_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace mp3_converter {
+
+/**
+ * @class DuplicateIndex
+ *
+ * @brief Remembers which file encodes each distinct audio payload of a run,
+ * so files with the same payload are encoded once and get copies of its mp3s.
+ *
+ * The first file to claim a payload encodes it. Files claiming it while that
+ * runs wait for it, and if it fails, the next of them encodes it instead.
+ * Shared by all workers.
+ */
+class DuplicateIndex
+{
+  public:
+    /**
+     * @struct PayloadKey
+     *
+     * @brief The audio of a wav file: every format field the encoder looks
+     * at, the size of the data chunk payload and a hash of its bytes.
+     *
+     * All fields but the hash are compared exactly. The samples themselves
+     * are not compared, so files with equal keys getting byte identical mp3s
+     * rests on the 64 bit hash: two payloads of the same size and format
+     * collide with a chance of 2^-64.
+     */
+    struct PayloadKey
+    {
+        uint64_t data_hash {};
+        uint64_t data_size {};
+        uint16_t sample_format {};
+        uint16_t num_channels {};
+        uint32_t sample_rate {};
+        uint16_t block_align {};
+        uint16_t bits_per_sample {};
+        uint32_t channel_mask {};
+
+        bool operator==(const PayloadKey &other) const;
+    };
+
+    /**
+     * @brief Read the key of a wav file.
+     *
+     * @param data_hash The hash_wave_data of the file if already known, saves
+     * reading the payload again.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the headers are
+     * invalid.
+     */
+    static PayloadKey payload_key(const std::filesystem::path &wav_file,
+                                  std::optional<uint64_t>      data_hash = {});
+
+    /**
+     * @brief Ask who encodes the payload, waiting while another file does.
+     *
+     * The wait lasts no longer than the rest of that one encode, which is
+     * already running. On a pool worker it runs sub-jobs of the pool
+     * meanwhile, such as the encoders and segments of that very file, and
+     * only blocks the worker while there are none. Converting a folder, the
+     * command line starts files of a size seen before last, so few wait.
+     *
+     * @return The file whose mp3s hold the payload, nullopt if the caller is
+     * to encode it and report that with finished.
+     *
+     * @throws cancelled_error When the current cancellation token is cancelled
+     * while waiting.
+     */
+    std::optional<std::filesystem::path> claim(const PayloadKey &key);
+
+    /**
+     * @brief End a claim that returned nullopt, converted telling whether the
+     * mp3s of file were written.
+     */
+    void finished(const PayloadKey &           key,
+                  const std::filesystem::path &file,
+                  bool                         converted);
+
+    /**
+     * @brief Count a file whose mp3s were copied instead of encoded.
+     *
+     * @param wav_bytes The size of the wav file not encoded.
+     * @param mp3_bytes The size of the copies that share their storage with
+     * the original.
+     */
+    void count_duplicate(uint64_t wav_bytes, uint64_t mp3_bytes);
+
+    /// The number of files whose mp3s were copied.
+    size_t duplicates() const;
+
+    /// The bytes of the wav files not encoded.
+    uint64_t wav_bytes_saved() const;
+
+    /// The bytes of mp3 reflinked or hard linked instead of written.
+    uint64_t mp3_bytes_shared() const;
+
+  private:
+    struct Payload
+    {
+        /// The file whose mp3s hold the payload, empty until one succeeded.
+        std::filesystem::path encoded {};
+        bool                  encoding {false};
+    };
+
+    /// The data hash is uniformly distributed already.
+    struct KeyHash
+    {
+        size_t operator()(const PayloadKey &key) const
+        {
+            return static_cast<size_t>(key.data_hash);
+        }
+    };
+
+    mutable std::mutex                               m_mutex;
+    std::condition_variable                          m_finished;
+    std::unordered_map<PayloadKey, Payload, KeyHash> m_payloads;
+
+    size_t   m_duplicates {};
+    uint64_t m_wav_bytes {};
+    uint64_t m_mp3_bytes {};
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_DUPLICATEINDEX_H */
@@ -0,0 +1,144 @@
+#ifndef MP3_CONVERTER_ENCODEMANIFEST_H
+#define MP3_CONVERTER_ENCODEMANIFEST_H
+
+#include "EncodingProfile.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mp3_converter {
+
+class WavefileReader;
+
+/**
+ * @struct FileStamp
+ *
+ * @brief What a single stat tells about a file: its size and modification
+ * time.
+ */
+struct FileStamp
+{
+    uint64_t size {};
+
+    /// The last write time in ticks of std::filesystem::file_time_type.
+    int64_t mtime {};
+
+    bool operator==(const FileStamp &other) const
+    {
+        return size == other.size && mtime == other.mtime;
+    }
+};
+
+/**
+ * @brief Stat the given file.
+ *
+ * @return The stamp, nullopt if the file can not be stat'ed.
+ */
+std::optional<FileStamp> stamp_of(const std::filesystem::path &file);
+
+/**
+ * @brief Hash the data chunk payload of a wav file with ContentHash.
+ *
+ * Only the samples are hashed, so rewriting metadata chunks does not count
+ * as a change.
+ *
+ * @throws WavefileConversionTask::wave_format_error When the headers are
+ * invalid.
+ */
+uint64_t hash_wave_data(const std::filesystem::path &wav_file);
+
+/**
+ * @brief Hash the data chunk payload left in an open reader, as above.
+ *
+ * @throws WavefileConversionTask::wave_format_error When the file ends early.
+ */
+uint64_t hash_wave_data(WavefileReader &reader);
+
+/**
+ * @struct ManifestEntry
+ *
+ * @brief The state of a source file when its mp3 was last written.
+ */
+struct ManifestEntry
+{
+    FileStamp   stamp {};
+    uint64_t    data_hash {};
+    std::string settings {};
+};
+
+/**
+ * @class EncodeManifest
+ *
+ * @brief The record of successfully encoded files inside one folder tree,
+ * kept on disk between runs to skip files whose mp3 is still up to date.
+ *
+ * Entries are keyed by the path relative to the root folder. The manifest is
+ * a small text file in the root folder, one entry per line, rewritten
+ * atomically by save(). Lookups and updates are thread safe.
+ */
+class EncodeManifest
+{
+  public:
+    /// The name of the manifest file inside the root folder.
+    static constexpr const char *file_name = ".mp3_converter_manifest";
+
+    /**
+     * @brief Load the manifest of the given root folder.
+     *
+     * A missing manifest is empty. Malformed lines are dropped, their files
+     * are simply encoded again.
+     */
+    explicit EncodeManifest(const std::filesystem::path &root);
+
+    /**
+     * @brief The entry recorded for the given source file, if any.
+     */
+    std::optional<ManifestEntry> find(const std::filesystem::path &file) const;
+
+    /**
+     * @brief Record or replace the entry for the given source file.
+     */
+    void record(const std::filesystem::path &file, ManifestEntry entry);
+
+    /**
+     * @brief Drop the entry for the given source file, so the next run
+     * encodes it again.
+     */
+    void forget(const std::filesystem::path &file);
+
+    /**
+     * @brief Decide from a stat alone whether the mp3 of file is current.
+     *
+     * True if the file has the recorded size and modification time, was
+     * encoded with the given settings and the mp3 of every profile still
+     * exists.
+     */
+    bool is_up_to_date(const std::filesystem::path &       file,
+                       const std::string &                 settings,
+                       const std::vector<EncodingProfile> &profiles =
+                           default_profiles()) const;
+
+    /**
+     * @brief Write the manifest to a temporary file and rename it over the
+     * old one, so an interrupted run never leaves a torn manifest.
+     *
+     * @throws std::runtime_error When the manifest can not be written.
+     */
+    void save() const;
+
+  private:
+    std::string key_of(const std::filesystem::path &file) const;
+
+    std::filesystem::path m_root;
+
+    mutable std::mutex                             m_mutex;
+    std::unordered_map<std::string, ManifestEntry> m_entries;
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_ENCODEMANIFEST_H */
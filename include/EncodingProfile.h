@@ -0,0 +1,59 @@
+#ifndef MP3_CONVERTER_ENCODINGPROFILE_H
+#define MP3_CONVERTER_ENCODINGPROFILE_H
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mp3_converter {
+
+/**
+ * @struct EncodingProfile
+ *
+ * @brief The lame settings of one mp3 written per wav file.
+ *
+ * A default constructed profile keeps lame's defaults and writes the plain
+ * .mp3 next to the wav. Named profiles write name.<profile>.mp3, so several of
+ * them can be encoded from one read of the source.
+ */
+struct EncodingProfile
+{
+    /// The canonical name, such as "V2", "128k" or "64k-mono", empty for
+    /// lame's defaults.
+    std::string name {};
+
+    /// Variable bitrate quality from 0 (best) to 9, if not constant bitrate.
+    std::optional<int> vbr_quality {};
+
+    /// Constant bitrate in kbps, 0 for lame's default.
+    int bitrate_kbps {0};
+
+    /// Mix the channels down to a single one.
+    bool mono {false};
+
+    /// Split files of a minute and more into segments of a fixed length that
+    /// are encoded concurrently. Faster for a few long files on many cores,
+    /// but the segments are encoded without lame's bit reservoir, which costs
+    /// some quality at the same bitrate. Not part of the name, the same for
+    /// all profiles of a run, and only used for single-profile conversions.
+    bool segmented {false};
+
+    /**
+     * @brief Parse a profile as given on the command line: "V0" to "V9" for
+     * variable bitrate or the constant bitrate as "<kbps>k", either optionally
+     * followed by "-mono". Case does not matter.
+     *
+     * @throws std::invalid_argument When the text is no profile.
+     */
+    static EncodingProfile parse(const std::string &text);
+};
+
+/**
+ * @brief The single profile with lame's defaults, what a conversion writes
+ * when no profiles are asked for.
+ */
+const std::vector<EncodingProfile> &default_profiles();
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_ENCODINGPROFILE_H */
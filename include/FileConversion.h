@@ -0,0 +1,120 @@
+#ifndef MP3_CONVERTER_FILECONVERSION_H
+#define MP3_CONVERTER_FILECONVERSION_H
+
+#include "DuplicateIndex.h"
+#include "EncodeManifest.h"
+#include "EncodingProfile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace mp3_converter {
+
+/**
+ * @brief Files up to this size are converted in batches, see convert_batch.
+ * About six seconds of 16 bit stereo at 44.1 kHz.
+ */
+inline constexpr uintmax_t small_file_bytes = 1024 * 1024;
+
+/**
+ * @brief The most small files converted back to back as one job. Enough to
+ * amortize the handoff to a worker, few enough that a batch does not keep a
+ * worker busy for much longer than a mid-sized file.
+ */
+inline constexpr size_t max_batch_files = 64;
+
+/**
+ * @brief Whether the file has a .wav extension, in any case.
+ */
+bool has_wav_extension(const std::filesystem::path &file);
+
+/**
+ * @brief Walk a folder, and all its sub folders if asked to, and hand every
+ * regular file with a .wav extension to found as soon as it is seen.
+ * Unreadable sub folders are skipped, links to folders are not followed.
+ *
+ * The one walk behind the command line and the daemon, so both find the same
+ * files.
+ *
+ * @param found Gets the directory entry, which usually has the file type and
+ * size cached. Returns false to end the walk.
+ * @return The error that ended the walk early, empty if it went through.
+ */
+std::error_code for_each_wav_file(
+    const std::filesystem::path &                                      directory,
+    bool                                                               recursive,
+    const std::function<bool(const std::filesystem::directory_entry &)> &found);
+
+/**
+ * @brief List the wav files for_each_wav_file finds.
+ *
+ * @throws std::filesystem::filesystem_error When the walk ended early before
+ * finding any, for instance because the folder itself can not be read.
+ */
+std::vector<std::filesystem::path>
+find_wav_files(const std::filesystem::path &directory, bool recursive);
+
+/**
+ * @brief Convert a single file next to itself, to one mp3 per profile.
+ *
+ * @throws Whatever WavefileConversionTask::run throws.
+ */
+bool convert_file(
+    const std::filesystem::path &       file,
+    const std::vector<EncodingProfile> &profiles = default_profiles());
+
+/**
+ * @brief Convert a file, unless another file of the run has the same audio:
+ * then its mp3s are copied with share_file instead, as reflinks or hard links
+ * where the file system allows.
+ *
+ * @param data_hash The hash_wave_data of the file if already known.
+ *
+ * @throws Whatever convert_file throws, or cancelled_error while waiting for
+ * the file encoding the same audio.
+ */
+bool convert_deduplicated(
+    const std::filesystem::path &       file,
+    DuplicateIndex &                    duplicates,
+    const std::vector<EncodingProfile> &profiles  = default_profiles(),
+    std::optional<uint64_t>             data_hash = {});
+
+/**
+ * @brief Convert a file that failed the stat check of the manifest, and record
+ * it afterwards.
+ *
+ * A file that was only touched, or had its metadata chunks rewritten, still
+ * hashes to the recorded samples and is not encoded again.
+ *
+ * @param duplicates If given, the file is converted with convert_deduplicated.
+ */
+bool convert_incrementally(
+    const std::filesystem::path &       file,
+    EncodeManifest &                    manifest,
+    const std::string &                 settings,
+    const std::vector<EncodingProfile> &profiles   = default_profiles(),
+    DuplicateIndex *                    duplicates = nullptr);
+
+/**
+ * @brief Run the conversions of a batch of small files back to back on the
+ * calling thread, as one job instead of one per file.
+ *
+ * For files of a few seconds the handoff to a worker, its future and the
+ * admission of every single file are a share of the work worth saving. A
+ * batch pays them once. Each file still gets its own lame instances and
+ * outputs, lame can not be reset for an unrelated stream.
+ *
+ * @param conversions One per file, in the order they run. One that throws
+ * does not stop the ones after it, it counts as failed.
+ * @return The number of files converted successfully.
+ */
+size_t convert_batch(const std::vector<std::function<bool()>> &conversions);
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_FILECONVERSION_H */
@@ -1,12 +1,20 @@
 #ifndef LAME_ENCODING_LAMEENCODINGTASK_H
 #define LAME_ENCODING_LAMEENCODINGTASK_H
 
+#include "BufferArena.h"
+#include "ByteSink.h"
+#include "Deinterleave.h"
+#include "EncodingProfile.h"
+#include "StageTimers.h"
 #include "lame.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <filesystem>
-#include <fstream>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <vector>
 
@@ -60,40 +68,72 @@ class LameEncodingTask
      * @brief Construct a LameEncodingTask that outputs to the given out_file.
      *
      * @param out_file The file to output to.
+     * @param profile The lame settings to encode with.
      */
-    LameEncodingTask(const std::filesystem::path &out_file)
+    LameEncodingTask(const std::filesystem::path &out_file,
+                     const EncodingProfile &      profile = {})
+        : profile(profile)
+        , owned_sink(std::make_unique<FileSink>(out_file))
+        , sink(owned_sink.get())
     {
-        out_stream.open(out_file.string(), std::ios_base::binary);
     }
 
     /**
-     * @brief Encode the given raw data passed in buffers according to the
-     * parameters listed.
+     * @brief Construct a LameEncodingTask that outputs to the given sink.
      *
-     * In case of mono data (num_channels ==1), it is expected that buffer_l and
-     * buffer_r point to the same data.
+     * @param out_sink The sink to output to, must outlive this task.
+     * @param profile The lame settings to encode with.
+     */
+    LameEncodingTask(ByteSink &out_sink, const EncodingProfile &profile = {})
+        : profile(profile)
+        , sink(&out_sink)
+    {
+    }
+
+    /**
+     * @brief The number of frames (samples per channel) handed to lame per
+     * call when streaming. A multiple of the mp3 frame size of 1152 samples,
+     * big enough to amortize the per-call overhead of lame, small enough to
+     * keep the memory per task constant.
+     */
+    static constexpr unsigned long block_frames = 1152 * 64;
+
+    /**
+     * @brief Number of samples to Begin a stream of unknown length with, lame's
+     * own marker for it.
+     */
+    static constexpr unsigned long unknown_num_samples = 0xFFFFFFFFul;
+
+    /**
+     * @brief Initialize the lame encoder for a stream with the given
+     * parameters. Must be called once before EncodeBlock.
      *
-     * @param num_sample The number of samples, that is the length of the passed
-     * buffers.
+     * Every stream gets a fresh lame instance. Lame can only continue a stream
+     * gaplessly (lame_encode_flush_nogap), which carries the tail of one file
+     * into the next, it has no way to reset an instance for an unrelated
+     * stream. The buffers around it are reused from the worker's arena.
+     *
+     * @param num_samples The total number of samples per channel in the
+     * stream, unknown_num_samples if it is only known at its end.
      * @param sample_rate The sample rate of the raw wav data.
      * @param num_channels The number of channels, limited to 1 and 2 by lame.
-     * @param buffer_l Ptr to buffer of raw data on left channel.
-     * @param buffer_r Ptr to buffer of raw data on right channel.
+     * @param independent_frames Disable the bit reservoir and the info tag
+     * frame, so the produced frames can be cut apart and concatenated with the
+     * frames of other encoders.
      */
-    bool Encode(unsigned long num_samples,
-                int           sample_rate,
-                int           num_channels,
-                const T *     buffer_l,
-                const T *     buffer_r)
+    void Begin(unsigned long num_samples,
+               int           sample_rate,
+               int           num_channels,
+               bool          independent_frames = false)
     {
-        auto *lame_flags = lame_init();
+        lame_flags.reset(lame_init());
         if (lame_flags == nullptr)
             throw lame_encoding_error(
                 "Error creating lame flags struct, malloc failed!");
 
-        lame_set_num_samples(lame_flags, num_samples);
-        lame_set_in_samplerate(lame_flags, sample_rate);
-        lame_set_num_channels(lame_flags, num_channels);
+        lame_set_num_samples(lame_flags.get(), num_samples);
+        lame_set_in_samplerate(lame_flags.get(), sample_rate);
+        lame_set_num_channels(lame_flags.get(), num_channels);
 
         // redirect C callbacks that signal lame errors into an error we can
         // forward to callers.
@@ -106,17 +146,246 @@ class LameEncodingTask
             throw lame_encoding_error(err.data());
         };
 
-        lame_set_errorf(lame_flags, lame_error_forwarder);
+        lame_set_errorf(lame_flags.get(), lame_error_forwarder);
+
+        if (profile.vbr_quality)
+        {
+            lame_set_VBR(lame_flags.get(), vbr_default);
+            lame_set_VBR_q(lame_flags.get(), *profile.vbr_quality);
+        }
+        else if (profile.bitrate_kbps > 0)
+        {
+            lame_set_VBR(lame_flags.get(), vbr_off);
+            lame_set_brate(lame_flags.get(), profile.bitrate_kbps);
+        }
+        if (profile.mono)
+            lame_set_mode(lame_flags.get(), MONO);
+
+        if (independent_frames)
+        {
+            lame_set_disable_reservoir(lame_flags.get(), 1);
+            lame_set_bWriteVbrTag(lame_flags.get(), 0);
+        }
+
+        // the info tag frame describes the whole stream, an open-ended one
+        // would carry it empty.
+        const bool length_known = num_samples != unknown_num_samples;
+        if (!length_known)
+            lame_set_bWriteVbrTag(lame_flags.get(), 0);
+
+        lame_init_params(lame_flags.get());
+
+        // lets a file sink lay out the whole file at once.
+        if (length_known)
+            sink->reserve(EstimatedBytes(num_samples));
+
+        // upper bound for buffer size taken from description in lame.h, for
+        // the largest block we will ever hand to lame at once. Borrowed from
+        // the worker's arena, so it is only allocated once per worker.
+        out_mp3_buf = BufferArena::for_this_thread().acquire(
+            static_cast<size_t>((1.25 * block_frames) + 7200));
+    }
+
+    /**
+     * @brief Estimate the size of the mp3 stream for num_samples input samples
+     * per channel from the bitrate, valid after Begin. Rather too large than
+     * too small.
+     */
+    uint64_t EstimatedBytes(unsigned long num_samples) const
+    {
+        // lame's defaults are constant bitrate, fall back to the highest
+        // bitrate if it does not tell or varies the bitrate.
+        int kbps = lame_get_brate(lame_flags.get());
+        if (kbps <= 0 || lame_get_VBR(lame_flags.get()) != vbr_off)
+            kbps = 320;
+
+        const int sample_rate = lame_get_in_samplerate(lame_flags.get());
+        const uint64_t stream_bytes =
+            sample_rate > 0 ? uint64_t {num_samples} * kbps * 125 / sample_rate
+                            : 0;
+
+        // the info tag frame and the frames completed by the flush.
+        return stream_bytes + 16 * 1024;
+    }
+
+    /**
+     * @brief The number of samples per channel in one mp3 frame, valid after
+     * Begin.
+     */
+    int FrameSize() const
+    {
+        return lame_get_framesize(lame_flags.get());
+    }
+
+    /**
+     * @brief The sample rate of the mp3 stream, valid after Begin. Differs from
+     * the input sample rate if lame resamples.
+     */
+    int OutSampleRate() const
+    {
+        return lame_get_out_samplerate(lame_flags.get());
+    }
+
+    /**
+     * @brief Encode one block of raw data and write the resulting mp3 frames
+     * to the output right away.
+     *
+     * In case of mono data (num_channels ==1), it is expected that buffer_l and
+     * buffer_r point to the same data.
+     *
+     * @param num_samples The number of samples in the passed buffers, at most
+     * block_frames.
+     * @param buffer_l Ptr to buffer of raw data on left channel.
+     * @param buffer_r Ptr to buffer of raw data on right channel.
+     */
+    void EncodeBlock(unsigned long num_samples,
+                     const T *     buffer_l,
+                     const T *     buffer_r)
+    {
+        int bytes_encoded {};
+        {
+            stages::ScopedStage timer(stages::Stage::encode, 0, num_samples);
+            bytes_encoded = encode_buffer(num_samples, buffer_l, buffer_r);
+        }
+        if (bytes_encoded < 0)
+            throw lame_encoding_error("lame failed to encode block, code "
+                                      + std::to_string(bytes_encoded));
+
+        write_out(bytes_encoded);
+    }
+
+    /**
+     * @brief Whether lame has an entry point taking interleaved stereo samples
+     * of type T, so EncodeInterleavedBlock does not need to deinterleave.
+     */
+    static constexpr bool has_interleaved_entry_point =
+        std::is_integral_v<T>
+            ? (sizeof(T) == sizeof(short) || sizeof(T) == sizeof(int))
+            : (sizeof(T) == sizeof(float) || sizeof(T) == sizeof(double));
+
+    /**
+     * @brief Encode one block of interleaved stereo data and write the
+     * resulting mp3 frames to the output right away.
+     *
+     * Uses lame's interleaved entry points where they exist for T, else splits
+     * the block into per channel buffers with the vectorized deinterleave
+     * kernel first.
+     *
+     * @param num_samples The number of samples per channel in the passed
+     * buffer, at most block_frames.
+     * @param interleaved Ptr to num_samples L R pairs.
+     */
+    void EncodeInterleavedBlock(unsigned long num_samples, const T *interleaved)
+    {
+        int bytes_encoded {};
+
+        if constexpr (has_interleaved_entry_point)
+        {
+            stages::ScopedStage timer(stages::Stage::encode, 0, num_samples);
+            bytes_encoded = encode_interleaved(num_samples, interleaved);
+        }
+        else
+        {
+            if (l_buffer.size() == 0)
+            {
+                auto &arena = BufferArena::for_this_thread();
+                l_buffer    = arena.acquire(block_frames * sizeof(T));
+                r_buffer    = arena.acquire(block_frames * sizeof(T));
+            }
+            {
+                stages::ScopedStage timer(stages::Stage::deinterleave,
+                                          2 * num_samples * sizeof(T),
+                                          num_samples);
+                deinterleave_stereo(interleaved,
+                                    l_buffer.template as<T>(),
+                                    r_buffer.template as<T>(),
+                                    num_samples);
+            }
+            stages::ScopedStage timer(stages::Stage::encode, 0, num_samples);
+            bytes_encoded = encode_buffer(num_samples,
+                                          l_buffer.template as<T>(),
+                                          r_buffer.template as<T>());
+        }
+
+        if (bytes_encoded < 0)
+            throw lame_encoding_error("lame failed to encode block, code "
+                                      + std::to_string(bytes_encoded));
 
-        lame_init_params(lame_flags);
+        write_out(bytes_encoded);
+    }
 
-        // create an output array.
-        std::vector<unsigned char> out_mp3_buf;
-        // upper bound for buffer size taken from description in lame.h
-        const auto out_buf_size =
-            static_cast<unsigned long>((1.25 * num_samples) + 7200);
-        out_mp3_buf.resize(out_buf_size);
+    /**
+     * @brief Flush the remaining frames out of lame, write them and close the
+     * output.
+     *
+     * @return True if the output could be written completely, else false.
+     */
+    bool Finish()
+    {
         int bytes_encoded {};
+        {
+            stages::ScopedStage timer(stages::Stage::flush);
+            bytes_encoded =
+                lame_encode_flush(lame_flags.get(),
+                                  out_mp3_buf.data(),
+                                  static_cast<int>(out_mp3_buf.size()));
+        }
+        if (bytes_encoded < 0)
+            throw lame_encoding_error("lame failed to flush, code "
+                                      + std::to_string(bytes_encoded));
+
+        write_out(bytes_encoded);
+        lame_flags.reset();
+
+        return sink->close();
+    }
+
+    /**
+     * @brief Encode the given raw data passed in buffers according to the
+     * parameters listed.
+     *
+     * In case of mono data (num_channels ==1), it is expected that buffer_l and
+     * buffer_r point to the same data. The data is handed to lame in blocks of
+     * block_frames, so the output buffer stays the same size no matter how
+     * long the input is.
+     *
+     * @param num_sample The number of samples, that is the length of the passed
+     * buffers.
+     * @param sample_rate The sample rate of the raw wav data.
+     * @param num_channels The number of channels, limited to 1 and 2 by lame.
+     * @param buffer_l Ptr to buffer of raw data on left channel.
+     * @param buffer_r Ptr to buffer of raw data on right channel.
+     */
+    bool Encode(unsigned long num_samples,
+                int           sample_rate,
+                int           num_channels,
+                const T *     buffer_l,
+                const T *     buffer_r)
+    {
+        Begin(num_samples, sample_rate, num_channels);
+
+        for (unsigned long offset = 0; offset < num_samples;
+             offset += block_frames)
+        {
+            const auto block = std::min(block_frames, num_samples - offset);
+            EncodeBlock(block, buffer_l + offset, buffer_r + offset);
+        }
+
+        return Finish();
+    }
+
+  private:
+    /**
+     * @brief Hand one block to the lame_encode_buffer function matching T.
+     *
+     * @return The number of bytes written to out_mp3_buf, negative on error.
+     */
+    int encode_buffer(unsigned long num_samples,
+                      const T *     buffer_l,
+                      const T *     buffer_r)
+    {
+        const int out_buf_size = static_cast<int>(out_mp3_buf.size());
+        const int nsamples     = static_cast<int>(num_samples);
 
         // use constexpr to decide which lame_encode_buffer function is used at
         // compile time depending on the type T.
@@ -129,31 +398,31 @@ class LameEncodingTask
             // == sizeof(long))
             if constexpr (sizeof(T) == sizeof(short))
             {
-                bytes_encoded = lame_encode_buffer(
-                    lame_flags,
+                return lame_encode_buffer(
+                    lame_flags.get(),
                     reinterpret_cast<const short *>(buffer_l),
                     reinterpret_cast<const short *>(buffer_r),
-                    num_samples,
+                    nsamples,
                     out_mp3_buf.data(),
                     out_buf_size);
             }
             else if constexpr (sizeof(T) == sizeof(int))
             {
-                bytes_encoded = lame_encode_buffer_int(
-                    lame_flags,
+                return lame_encode_buffer_int(
+                    lame_flags.get(),
                     reinterpret_cast<const int *>(buffer_l),
                     reinterpret_cast<const int *>(buffer_r),
-                    num_samples,
+                    nsamples,
                     out_mp3_buf.data(),
                     out_buf_size);
             }
             else if constexpr (sizeof(T) == sizeof(long))
             {
-                bytes_encoded = lame_encode_buffer_long2(
-                    lame_flags,
+                return lame_encode_buffer_long2(
+                    lame_flags.get(),
                     reinterpret_cast<const long *>(buffer_l),
                     reinterpret_cast<const long *>(buffer_r),
-                    num_samples,
+                    nsamples,
                     out_mp3_buf.data(),
                     out_buf_size);
             }
@@ -170,23 +439,21 @@ class LameEncodingTask
         {
             if constexpr (sizeof(T) == sizeof(float))
             {
-                bytes_encoded =
-                    lame_encode_buffer_ieee_float(lame_flags,
-                                                  buffer_l,
-                                                  buffer_r,
-                                                  num_samples,
-                                                  out_mp3_buf.data(),
-                                                  out_buf_size);
+                return lame_encode_buffer_ieee_float(lame_flags.get(),
+                                                     buffer_l,
+                                                     buffer_r,
+                                                     nsamples,
+                                                     out_mp3_buf.data(),
+                                                     out_buf_size);
             }
             else if constexpr (sizeof(T) == sizeof(double))
             {
-                bytes_encoded =
-                    lame_encode_buffer_ieee_double(lame_flags,
-                                                   buffer_l,
-                                                   buffer_r,
-                                                   num_samples,
-                                                   out_mp3_buf.data(),
-                                                   out_buf_size);
+                return lame_encode_buffer_ieee_double(lame_flags.get(),
+                                                      buffer_l,
+                                                      buffer_r,
+                                                      nsamples,
+                                                      out_mp3_buf.data(),
+                                                      out_buf_size);
             }
             else
             {
@@ -198,21 +465,85 @@ class LameEncodingTask
                     "supports float, double.");
             }
         }
-        bytes_encoded += lame_encode_flush(
-            lame_flags, out_mp3_buf.data(), out_buf_size - bytes_encoded);
-
-        lame_close(lame_flags);
+    }
 
-        out_stream.write(reinterpret_cast<const char *>(out_mp3_buf.data()),
-                         bytes_encoded);
+    /**
+     * @brief Hand one block of interleaved stereo samples to the interleaved
+     * lame_encode_buffer function matching T.
+     *
+     * @return The number of bytes written to out_mp3_buf, negative on error.
+     */
+    int encode_interleaved(unsigned long num_samples, const T *interleaved)
+    {
+        const int out_buf_size = static_cast<int>(out_mp3_buf.size());
+        const int nsamples     = static_cast<int>(num_samples);
 
-        out_stream.close();
+        if constexpr (std::is_integral_v<T> && sizeof(T) == sizeof(short))
+        {
+            // lame only reads the samples, its prototype just lacks the const.
+            return lame_encode_buffer_interleaved(
+                lame_flags.get(),
+                const_cast<short *>(
+                    reinterpret_cast<const short *>(interleaved)),
+                nsamples,
+                out_mp3_buf.data(),
+                out_buf_size);
+        }
+        else if constexpr (std::is_integral_v<T> && sizeof(T) == sizeof(int))
+        {
+            return lame_encode_buffer_interleaved_int(
+                lame_flags.get(),
+                reinterpret_cast<const int *>(interleaved),
+                nsamples,
+                out_mp3_buf.data(),
+                out_buf_size);
+        }
+        else if constexpr (sizeof(T) == sizeof(float))
+        {
+            return lame_encode_buffer_interleaved_ieee_float(
+                lame_flags.get(),
+                interleaved,
+                nsamples,
+                out_mp3_buf.data(),
+                out_buf_size);
+        }
+        else
+        {
+            return lame_encode_buffer_interleaved_ieee_double(
+                lame_flags.get(),
+                interleaved,
+                nsamples,
+                out_mp3_buf.data(),
+                out_buf_size);
+        }
+    }
 
-        return true;
+    void write_out(int num_bytes)
+    {
+        sink->write(out_mp3_buf.data(), static_cast<size_t>(num_bytes));
     }
 
-  private:
-    std::ofstream out_stream {};
+    struct lame_closer
+    {
+        void operator()(lame_global_flags *flags) const
+        {
+            lame_close(flags);
+        }
+    };
+
+    EncodingProfile profile {};
+
+    std::unique_ptr<lame_global_flags, lame_closer> lame_flags {};
+
+    PooledBuffer out_mp3_buf {};
+
+    // per channel buffers, only used for types that lame can not take
+    // interleaved.
+    PooledBuffer l_buffer {};
+    PooledBuffer r_buffer {};
+
+    std::unique_ptr<ByteSink> owned_sink {};
+    ByteSink *                sink {nullptr};
 };
 
 } // namespace mp3_converter
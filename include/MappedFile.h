@@ -0,0 +1,83 @@
+#ifndef MP3_CONVERTER_MAPPEDFILE_H
+#define MP3_CONVERTER_MAPPEDFILE_H
+
+#include <cstddef>
+#include <filesystem>
+
+namespace mp3_converter {
+
+/**
+ * @class MappedFile
+ *
+ * @brief A read-only memory mapping of a whole file.
+ *
+ * The contents are served straight out of the page cache, without copying them
+ * into a buffer of our own first. Move-only, the mapping is released on
+ * destruction.
+ */
+class MappedFile
+{
+  public:
+    /**
+     * @brief Map the given file read-only.
+     *
+     * @param file The file to map.
+     *
+     * @throws std::system_error When the file can not be opened or mapped, for
+     * instance because it is empty or not a regular file.
+     */
+    explicit MappedFile(const std::filesystem::path &file);
+
+    ~MappedFile();
+
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /**
+     * @brief Tell the OS that the mapping will be read front to back, so it
+     * reads ahead aggressively and may drop pages behind us early.
+     */
+    void advise_sequential() const;
+
+    /**
+     * @brief Ask the OS to start reading the given range from disk in the
+     * background, so touching it later does not block on the disk. Returns
+     * right away.
+     */
+    void prefetch(size_t offset, size_t length) const;
+
+    const char *data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+  private:
+    void release() noexcept;
+
+    const char *m_data {nullptr};
+    size_t      m_size {0};
+
+#ifdef _WIN32
+    void *m_file_handle {nullptr};
+    void *m_mapping_handle {nullptr};
+#endif
+};
+
+/**
+ * @brief Ask the OS to start reading the first length bytes of file into the
+ * page cache in the background, for a file that is going to be opened soon.
+ *
+ * Only a hint, errors are ignored.
+ */
+void prefetch_file_head(const std::filesystem::path &file, size_t length);
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_MAPPEDFILE_H */
@@ -0,0 +1,70 @@
+#ifndef MP3_CONVERTER_MP3ENCODER_H
+#define MP3_CONVERTER_MP3ENCODER_H
+
+#include "EncodingProfile.h"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+ * @file Mp3Encoder.h
+ *
+ * @brief The entry points of the mp3_converter library for programs that
+ * encode wav data they hold themselves, without files in between.
+ *
+ * All of them read the same wav formats as the command line, split long
+ * inputs into segments encoded concurrently if the profile is segmented and
+ * they are called on a worker of a ThreadPool, and throw WavefileConversionTask::wave_format_error for data
+ * that is no readable wav and lame_encoding_error when lame fails. Within a
+ * CancellationScope they stop with cancelled_error once its token is
+ * cancelled.
+ */
+namespace mp3_converter {
+
+/// Receives the encoded mp3 bytes in order, as lame produces them.
+using Mp3Callback = std::function<void(const unsigned char *data, size_t size)>;
+
+/**
+ * @brief Reads up to num_bytes of wav data into buffer and returns how many
+ * were read. Fewer than asked for only at the end of the stream.
+ */
+using WavPull = std::function<size_t(void *buffer, size_t num_bytes)>;
+
+/**
+ * @brief Encode a complete wav file held in memory, handing the mp3 to
+ * on_mp3 as it is produced.
+ *
+ * The buffer is read in place and has to stay unchanged until the call
+ * returns.
+ *
+ * @return True if successfull, else false.
+ */
+bool encode_wav(const void *           wav,
+                size_t                 size,
+                const Mp3Callback &    on_mp3,
+                const EncodingProfile &profile = {});
+
+/**
+ * @brief Encode a complete wav file held in memory to an mp3 in memory.
+ *
+ * @throws lame_encoding_error Also when the encoding was not successfull.
+ */
+std::vector<unsigned char> encode_wav(const void *           wav,
+                                      size_t                 size,
+                                      const EncodingProfile &profile = {});
+
+/**
+ * @brief Encode a wav stream read front to back through pull, such as a
+ * socket or a decoder's output, handing the mp3 to on_mp3 as it is produced.
+ *
+ * Streams without data size in their header are pulled until they end.
+ *
+ * @return True if successfull, else false.
+ */
+bool encode_wav_stream(const WavPull &        pull,
+                       const Mp3Callback &    on_mp3,
+                       const EncodingProfile &profile = {});
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_MP3ENCODER_H */
@@ -0,0 +1,81 @@
+#ifndef MP3_CONVERTER_MP3FRAMES_H
+#define MP3_CONVERTER_MP3FRAMES_H
+
+#include <array>
+#include <cstddef>
+#include <optional>
+
+namespace mp3_converter {
+
+/**
+ * @brief Get the length of the MPEG audio layer III frame whose header starts
+ * at data.
+ *
+ * @param data Ptr to the first byte of the frame.
+ * @param available The number of bytes readable at data.
+ *
+ * @return The length of the whole frame including its header in bytes, 0 if
+ * data does not start with a valid layer III frame header.
+ */
+inline size_t mp3_frame_length(const unsigned char *data, size_t available)
+{
+    if (available < 4 || data[0] != 0xFF || (data[1] & 0xE0) != 0xE0)
+        return 0;
+
+    // 3 = MPEG 1, 2 = MPEG 2, 0 = MPEG 2.5, 1 reserved.
+    const unsigned version       = (data[1] >> 3) & 0x3;
+    const unsigned layer         = (data[1] >> 1) & 0x3;
+    const unsigned bitrate_index = data[2] >> 4;
+    const unsigned rate_index    = (data[2] >> 2) & 0x3;
+    const unsigned padding       = (data[2] >> 1) & 0x1;
+
+    // layer III is encoded as 1. Free format (index 0) is never written by
+    // lame, so it is treated as invalid as well.
+    if (version == 1 || layer != 1 || bitrate_index == 0
+        || bitrate_index == 15 || rate_index == 3)
+        return 0;
+
+    constexpr std::array<unsigned, 15> kbps_mpeg1 {
+        0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+    constexpr std::array<unsigned, 15> kbps_mpeg2 {
+        0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160};
+    constexpr std::array<unsigned, 3> rates_mpeg1 {44100, 48000, 32000};
+
+    const bool     mpeg1 = version == 3;
+    const unsigned sample_rate =
+        rates_mpeg1[rate_index] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+    const unsigned bitrate =
+        (mpeg1 ? kbps_mpeg1 : kbps_mpeg2)[bitrate_index] * 1000;
+
+    // 1152 samples per frame for MPEG 1, 576 for MPEG 2 and 2.5, / 8 bits.
+    return (mpeg1 ? 144 : 72) * bitrate / sample_rate + padding;
+}
+
+/**
+ * @brief Find where the given number of frames ends in a buffer of
+ * consecutive layer III frames.
+ *
+ * @param data The buffer, starting with a frame header.
+ * @param size The size of the buffer.
+ * @param num_frames The number of frames to skip.
+ *
+ * @return The offset of the byte after the last skipped frame, nullopt if the
+ * buffer holds fewer than num_frames valid frames.
+ */
+inline std::optional<size_t> skip_mp3_frames(const unsigned char *data,
+                                             size_t               size,
+                                             size_t               num_frames)
+{
+    size_t offset = 0;
+    for (size_t frame = 0; frame < num_frames; ++frame)
+    {
+        const size_t length = mp3_frame_length(data + offset, size - offset);
+        if (length == 0 || length > size - offset)
+            return std::nullopt;
+        offset += length;
+    }
+    return offset;
+}
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_MP3FRAMES_H */
@@ -0,0 +1,93 @@
+#ifndef MP3_CONVERTER_MPSCQUEUE_H
+#define MP3_CONVERTER_MPSCQUEUE_H
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace mp3_converter {
+
+/**
+ * @class MpscQueue
+ *
+ * @brief An unbounded lock-free FIFO queue for many producer threads and a
+ * single consumer thread.
+ *
+ * A push is one allocation and one atomic exchange, producers never wait for
+ * each other or for the consumer. Items of one producer keep their order. An
+ * item whose push has not completed yet may briefly hide the ones pushed
+ * after it, pop then reports an empty queue and the consumer polls again.
+ *
+ * @tparam T The type of the queued items.
+ */
+template<typename T>
+class MpscQueue
+{
+  public:
+    MpscQueue()
+        : m_head(&m_stub)
+        , m_tail(&m_stub)
+    {
+    }
+
+    /// Frees the items never popped.
+    ~MpscQueue()
+    {
+        while (pop())
+            ;
+        if (m_tail != &m_stub)
+            delete m_tail;
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    /**
+     * @brief Append an item. Safe to call from any number of threads.
+     */
+    void push(T item)
+    {
+        auto *node = new Node {std::move(item)};
+
+        // the exchange orders the producers, linking the predecessor
+        // publishes the node to the consumer.
+        Node *previous = m_head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief Take the oldest item. Only ever called by the one consumer.
+     *
+     * @return The item, nullopt if there is none right now.
+     */
+    std::optional<T> pop()
+    {
+        Node *next = m_tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return std::nullopt;
+
+        // the popped node stays behind as the new sentinel, its item moved out.
+        std::optional<T> item = std::move(next->item);
+        next->item.reset();
+        if (m_tail != &m_stub)
+            delete m_tail;
+        m_tail = next;
+        return item;
+    }
+
+  private:
+    struct Node
+    {
+        std::optional<T>    item {};
+        std::atomic<Node *> next {nullptr};
+    };
+
+    Node                m_stub {};
+    std::atomic<Node *> m_head;
+
+    // only touched by the consumer.
+    Node *m_tail;
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_MPSCQUEUE_H */
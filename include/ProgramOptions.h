@@ -0,0 +1,104 @@
+#ifndef MP3_CONVERTER_PROGRAMOPTIONS_H
+#define MP3_CONVERTER_PROGRAMOPTIONS_H
+
+#include "EncodingProfile.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mp3_converter {
+
+/**
+ * @struct ProgramOptions
+ *
+ * @brief The command line of mp3_converter, parsed.
+ */
+struct ProgramOptions
+{
+    /// Print the usage and exit.
+    bool show_help {false};
+
+    /// The folder to convert.
+    std::filesystem::path directory {};
+
+    /// Convert a wav stream from stdin to mp3 on stdout instead of a folder,
+    /// asked for with "-" in place of the folder.
+    bool streaming {false};
+
+    /// Descend into sub folders, converting while the tree is still scanned.
+    bool recursive {false};
+
+    /// Skip files whose mp3 is still current according to the manifest.
+    bool incremental {false};
+
+    /// Serve conversion jobs on a Unix socket at this path instead of
+    /// converting a folder, if not empty.
+    std::filesystem::path daemon_socket {};
+
+    /// Encode files with the same audio once and copy the mp3s for the
+    /// others.
+    bool deduplicate {false};
+
+    /// Tune the number of active workers to the measured throughput instead
+    /// of a fixed oversubscription of the cores.
+    bool adaptive {false};
+
+    /// The mp3 files written per wav, each read and decoded once for all of
+    /// them. lame's defaults into the plain .mp3 unless asked for others.
+    /// All segmented if asked to with --segment.
+    std::vector<EncodingProfile> profiles {};
+
+    /// Admit files for conversion only while their estimated peak memory
+    /// fits into this many bytes together, 0 for no limit.
+    uint64_t max_memory {0};
+
+    /// Fail a file whose conversion takes longer than this, 0 for no limit.
+    std::chrono::milliseconds timeout {0};
+
+    /// Write the per-stage timing totals as json to this file, if not empty.
+    std::filesystem::path stats_file {};
+
+    /// Write a Chrome trace of all timed stages to this file, if not empty.
+    std::filesystem::path trace_file {};
+};
+
+/**
+ * @struct usage_error
+ *
+ * @brief An error class indicating that the command line is invalid.
+ */
+struct usage_error : std::runtime_error
+{
+    // inherit c'tors
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Parse the command line.
+ *
+ * @throws usage_error When an option is unknown or malformed.
+ */
+ProgramOptions parse_program_options(int argc, char *argv[]);
+
+/**
+ * @brief Parse a byte count such as 512M, 2GiB or 1500000, with binary
+ * suffixes K, M, G, T in any case, optionally followed by B or iB.
+ *
+ * @throws usage_error When the text is no byte count.
+ */
+uint64_t parse_byte_size(const std::string &text);
+
+/**
+ * @brief Parse a duration such as 90, 90s, 500ms, 5m or 2h, seconds when
+ * the suffix is left out.
+ *
+ * @throws usage_error When the text is no duration.
+ */
+std::chrono::milliseconds parse_duration(const std::string &text);
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_PROGRAMOPTIONS_H */
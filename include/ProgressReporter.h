@@ -0,0 +1,117 @@
+#ifndef MP3_CONVERTER_PROGRESSREPORTER_H
+#define MP3_CONVERTER_PROGRESSREPORTER_H
+
+#include "MpscQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace mp3_converter {
+
+/**
+ * @class ProgressReporter
+ *
+ * @brief The single writer of a batch's console output: workers hand it log
+ * lines and finished files through a lock-free queue, one reporter thread
+ * prints them in the order they arrive.
+ *
+ * With a live line, the reporter also keeps a progress line at the bottom,
+ * redrawn a few times a second: files done, input MB/s, realtime factor of
+ * the audio encoded and the estimated time left. Log lines scroll above it.
+ *
+ * While a reporter exists, log() goes through it, else straight to stdout.
+ */
+class ProgressReporter
+{
+  public:
+    /**
+     * @brief Start the reporter thread, writing to out.
+     *
+     * @param live_line Whether to draw the progress line, only sensible on a
+     * terminal.
+     */
+    ProgressReporter(std::ostream &out, bool live_line);
+
+    /// Prints everything still queued, ends the progress line and stops.
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter &) = delete;
+    ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+    /**
+     * @brief Add files and their bytes to the ones the batch converts, for
+     * the progress line. May be called while they are converted.
+     */
+    void expect(size_t files, uint64_t bytes);
+
+    /**
+     * @brief Report a file as finished, successfully or not, with the line
+     * describing it.
+     */
+    void file_done(std::string line, bool success);
+
+    /**
+     * @brief Print a line, from any thread. Goes through the reporter while
+     * one exists, else to stdout.
+     */
+    static void log(std::string line);
+
+    /**
+     * @brief Count input read by a conversion and the audio it holds. Always
+     * on, two relaxed atomic adds.
+     */
+    static void count_input(uint64_t bytes,
+                            uint64_t frames,
+                            uint32_t sample_rate);
+
+    /// The input bytes all conversions of the process read so far.
+    static uint64_t input_bytes();
+
+  private:
+    struct Event
+    {
+        std::string line;
+        bool        file_done;
+        bool        success;
+    };
+
+    void run();
+
+    /// Print the queued events.
+    void drain();
+
+    void draw_progress();
+    void clear_progress();
+
+    std::ostream &m_out;
+    const bool    m_live_line;
+
+    MpscQueue<Event> m_events;
+
+    std::atomic<size_t>   m_expected_files {};
+    std::atomic<uint64_t> m_expected_bytes {};
+
+    // only touched by the reporter thread.
+    size_t m_done {};
+    size_t m_failed {};
+    size_t m_drawn_width {};
+
+    const std::chrono::steady_clock::time_point m_start;
+    const uint64_t                              m_start_bytes;
+    const uint64_t                              m_start_audio_us;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    bool                    m_stopping {false};
+    std::thread             m_thread;
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_PROGRESSREPORTER_H */
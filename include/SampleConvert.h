@@ -0,0 +1,111 @@
+#ifndef MP3_CONVERTER_SAMPLECONVERT_H
+#define MP3_CONVERTER_SAMPLECONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace mp3_converter {
+
+/**
+ * @brief Unpack packed little endian 24 bit samples into 32 bit ones.
+ *
+ * The samples end up in the upper 24 bits, so they have the same full scale
+ * as 32 bit PCM and lame's int entry points take them as they are. Uses
+ * SSSE3 or AVX2 shuffles on x86 and table lookups on ARM64 where available.
+ *
+ * @param packed Ptr to num_samples samples of 3 bytes each, any alignment.
+ * @param out Ptr to room for num_samples samples.
+ * @param num_samples The number of samples, over all channels.
+ */
+void unpack_pcm24(const void *packed, int32_t *out, size_t num_samples);
+
+/**
+ * @brief The plain scalar version of unpack_pcm24, as reference for
+ * benchmarks.
+ */
+void unpack_pcm24_scalar(const void *packed, int32_t *out, size_t num_samples);
+
+/**
+ * @enum SampleEncoding
+ *
+ * @brief The sample encodings a stream with more than two channels can be
+ * downmixed from.
+ */
+enum class SampleEncoding
+{
+    int16,
+    int24,
+    int32,
+    float32,
+    float64
+};
+
+/**
+ * @brief The encoding of samples with the given wav format code (1 for PCM, 3
+ * for IEEE float) and size in bytes, nullopt if unsupported.
+ */
+std::optional<SampleEncoding> sample_encoding(uint16_t audio_format,
+                                              size_t   sample_size);
+
+/**
+ * @struct StereoDownmix
+ *
+ * @brief The gains of every input channel into the left and the right output
+ * channel.
+ */
+struct StereoDownmix
+{
+    std::vector<float> left;
+    std::vector<float> right;
+
+    /**
+     * @brief The downmix for the given speaker layout.
+     *
+     * Follows ITU-R BS.775: centers go into both sides at -3 dB, surrounds
+     * into their side at -3 dB, LFE is dropped. The gains are scaled down so a
+     * full scale signal on every channel can not clip.
+     *
+     * @param num_channels The number of interleaved channels.
+     * @param channel_mask The speaker positions as given by
+     * WAVE_FORMAT_EXTENSIBLE, in channel order. 0 picks the usual layout for
+     * the channel count: 3.0, quad, 5.0, 5.1, 6.1 or 7.1.
+     *
+     * @return The downmix, nullopt if the layout is unknown.
+     */
+    static std::optional<StereoDownmix> for_layout(int      num_channels,
+                                                   uint32_t channel_mask);
+};
+
+/**
+ * @brief Mix interleaved frames of more than two channels down to planar
+ * stereo floats in [-1, 1], the range lame's float entry points take.
+ *
+ * The samples are converted to float first, then mixed eight or four frames
+ * at a time with AVX2, SSE2 or NEON.
+ *
+ * @param interleaved Ptr to num_frames frames, aligned for the sample type.
+ * @param encoding The encoding of the samples.
+ * @param downmix The gains, one per channel of a frame.
+ * @param num_frames The number of frames.
+ * @param scratch Ptr to room for num_frames * channels floats.
+ * @param left Ptr to room for num_frames floats.
+ * @param right Ptr to room for num_frames floats.
+ */
+void downmix_to_stereo(const void *         interleaved,
+                       SampleEncoding       encoding,
+                       const StereoDownmix &downmix,
+                       size_t               num_frames,
+                       float *              scratch,
+                       float *              left,
+                       float *              right);
+
+/**
+ * @brief The name of the vector extension the sample conversions use on this
+ * machine.
+ */
+const char *sample_convert_kernel_name();
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_SAMPLECONVERT_H */
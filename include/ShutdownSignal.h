@@ -0,0 +1,68 @@
+#ifndef MP3_CONVERTER_SHUTDOWNSIGNAL_H
+#define MP3_CONVERTER_SHUTDOWNSIGNAL_H
+
+#include "Cancellation.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace mp3_converter {
+
+/**
+ * @class ShutdownSignal
+ *
+ * @brief Turns SIGINT and SIGTERM into a graceful shutdown: the first signal
+ * asks to start no more conversions and lets the ones in flight finish within
+ * a grace period, then cancels them. A second signal cancels them right away.
+ *
+ * Cancelled conversions remove their partial outputs while they unwind. The
+ * signal handler only counts, a watcher thread acts on it. Only one instance
+ * may exist at a time, the previous handlers are restored when it ends.
+ */
+class ShutdownSignal
+{
+  public:
+    /**
+     * @param to_cancel The token cancelled when the grace period ran out,
+     * the parent of every conversion's token. Must outlive this.
+     * @param grace How long conversions in flight may take after the first
+     * signal.
+     * @param on_request Called once on the watcher thread at the first signal,
+     * may be empty.
+     */
+    ShutdownSignal(CancellationToken &       to_cancel,
+                   std::chrono::milliseconds grace,
+                   std::function<void()>     on_request = {});
+
+    ~ShutdownSignal();
+
+    ShutdownSignal(const ShutdownSignal &) = delete;
+    ShutdownSignal &operator=(const ShutdownSignal &) = delete;
+
+    /// Whether a signal arrived, so no new conversion should start.
+    bool requested() const;
+
+  private:
+    void run();
+
+    CancellationToken &             m_to_cancel;
+    const std::chrono::milliseconds m_grace;
+    std::function<void()>           m_on_request;
+
+    std::atomic<bool> m_requested {false};
+
+    void (*m_previous_interrupt)(int);
+    void (*m_previous_terminate)(int);
+
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    bool                    m_stopping {false};
+    std::thread             m_thread;
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_SHUTDOWNSIGNAL_H */
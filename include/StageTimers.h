@@ -0,0 +1,234 @@
+#ifndef MP3_CONVERTER_STAGETIMERS_H
+#define MP3_CONVERTER_STAGETIMERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+
+#ifdef MP3_CONVERTER_STAGE_TIMERS
+#include <atomic>
+#include <chrono>
+#endif
+
+/**
+ * @namespace mp3_converter::stages
+ *
+ * @brief Per-file, per-stage timers of the conversion pipeline.
+ *
+ * Compiled in when MP3_CONVERTER_STAGE_TIMERS is defined (cmake option
+ * ENABLE_STAGE_TIMERS), and even then only recording after enable() was
+ * called. Without the define ScopedStage and FileScope are empty and the
+ * compiler drops them entirely.
+ *
+ * Every thread records into its own log without locking; the logs are only
+ * read by write_summary and write_trace, after the work is done.
+ */
+namespace mp3_converter::stages {
+
+/**
+ * @enum Stage
+ *
+ * @brief The timed stages of a conversion.
+ */
+enum class Stage : uint8_t
+{
+    file,         ///< A whole conversion, from opening to closing.
+    read,         ///< Fetching a block of the data chunk.
+    deinterleave, ///< Splitting, unpacking or downmixing blocks for lame.
+    encode,       ///< lame_encode_buffer*.
+    flush,        ///< lame_encode_flush.
+    write         ///< Writing and closing the mp3 file.
+};
+
+constexpr size_t num_stages = 6;
+
+const char *stage_name(Stage stage);
+
+/**
+ * @brief Whether the timers were compiled in.
+ */
+constexpr bool compiled_in()
+{
+#ifdef MP3_CONVERTER_STAGE_TIMERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef MP3_CONVERTER_STAGE_TIMERS
+
+/**
+ * @brief Start recording. Call before any work is started.
+ *
+ * @param keep_events Also keep every single timed interval for write_trace,
+ * not just the totals.
+ */
+void enable(bool keep_events);
+
+namespace detail {
+extern std::atomic<bool> recording;
+} // namespace detail
+
+inline bool enabled()
+{
+    return detail::recording.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Write the totals per stage, over all files and per file, as json.
+ */
+void write_summary(std::ostream &out);
+
+/**
+ * @brief Write every timed interval as a Chrome trace event file, to be
+ * opened in chrome://tracing or Perfetto.
+ */
+void write_trace(std::ostream &out);
+
+/// Id of the file the calling thread works on, 0 for none.
+uint32_t current_file();
+
+namespace detail {
+uint32_t register_file(const std::filesystem::path &file);
+uint32_t exchange_current_file(uint32_t file);
+void     record(Stage                                 stage,
+                std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end,
+                uint64_t                              bytes,
+                uint64_t                              samples);
+} // namespace detail
+
+/**
+ * @class FileScope
+ *
+ * @brief Attributes everything the calling thread times to a file, until the
+ * scope ends.
+ */
+class FileScope
+{
+  public:
+    /// Start working on a new file.
+    explicit FileScope(const std::filesystem::path &file)
+        : m_previous(detail::exchange_current_file(
+            enabled() ? detail::register_file(file) : 0))
+    {
+    }
+
+    /// Continue work on a file started elsewhere, by its current_file() id.
+    explicit FileScope(uint32_t file)
+        : m_previous(detail::exchange_current_file(file))
+    {
+    }
+
+    ~FileScope()
+    {
+        detail::exchange_current_file(m_previous);
+    }
+
+    FileScope(const FileScope &) = delete;
+    FileScope &operator=(const FileScope &) = delete;
+
+  private:
+    uint32_t m_previous;
+};
+
+/**
+ * @class ScopedStage
+ *
+ * @brief Times one stage from construction to destruction.
+ */
+class ScopedStage
+{
+  public:
+    explicit ScopedStage(Stage stage, uint64_t bytes = 0, uint64_t samples = 0)
+        : m_stage(stage)
+        , m_active(enabled())
+        , m_bytes(bytes)
+        , m_samples(samples)
+    {
+        if (m_active)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedStage()
+    {
+        if (m_active)
+            detail::record(m_stage,
+                           m_start,
+                           std::chrono::steady_clock::now(),
+                           m_bytes,
+                           m_samples);
+    }
+
+    ScopedStage(const ScopedStage &) = delete;
+    ScopedStage &operator=(const ScopedStage &) = delete;
+
+    /// Count bytes and samples only known after the stage started.
+    void add(uint64_t bytes, uint64_t samples = 0)
+    {
+        m_bytes += bytes;
+        m_samples += samples;
+    }
+
+  private:
+    Stage                                 m_stage;
+    bool                                  m_active;
+    uint64_t                              m_bytes;
+    uint64_t                              m_samples;
+    std::chrono::steady_clock::time_point m_start {};
+};
+
+#else
+
+inline void enable(bool)
+{
+}
+
+inline bool enabled()
+{
+    return false;
+}
+
+inline void write_summary(std::ostream &)
+{
+}
+
+inline void write_trace(std::ostream &)
+{
+}
+
+inline uint32_t current_file()
+{
+    return 0;
+}
+
+class FileScope
+{
+  public:
+    explicit FileScope(const std::filesystem::path &)
+    {
+    }
+
+    explicit FileScope(uint32_t)
+    {
+    }
+};
+
+class ScopedStage
+{
+  public:
+    explicit ScopedStage(Stage, uint64_t = 0, uint64_t = 0)
+    {
+    }
+
+    void add(uint64_t, uint64_t = 0)
+    {
+    }
+};
+
+#endif
+
+} // namespace mp3_converter::stages
+#endif /* MP3_CONVERTER_STAGETIMERS_H */
@@ -0,0 +1,223 @@
+#ifndef MP3_CONVERTER_THREADPOOL_H
+#define MP3_CONVERTER_THREADPOOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace mp3_converter {
+
+/**
+ * @class ThreadPool
+ *
+ * @brief A fixed number of worker threads, each with its own deque of jobs,
+ * that steal from each other when they run dry.
+ *
+ * Jobs submitted from outside the pool are spread round robin over the
+ * deques in submission order, and every worker takes jobs from the front of
+ * the deques, so a batch submitted largest-first is also started
+ * largest-first. Jobs submitted from inside a worker go to the front of that
+ * worker's deque, so work that belongs to an already running job is finished
+ * before new jobs are started. submit_top_level queues a job of its own from
+ * anywhere, like one from outside.
+ *
+ * Only the first active_limit() workers take jobs, the others sleep until the
+ * limit is raised, so the concurrency can be tuned while jobs run.
+ */
+class ThreadPool
+{
+  public:
+    /**
+     * @brief Start the given number of workers, at least one.
+     */
+    explicit ThreadPool(unsigned int num_workers);
+
+    /**
+     * @brief Run all jobs still queued, then stop and join the workers.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief The number of workers.
+     */
+    unsigned int size() const
+    {
+        return static_cast<unsigned int>(m_workers.size());
+    }
+
+    /**
+     * @brief The number of workers that take jobs.
+     */
+    unsigned int active_limit() const
+    {
+        return m_active_limit.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Let only the first limit workers take jobs, clamped to [1,
+     * size()]. Workers above the limit finish the job they run, then sleep.
+     */
+    void set_active_limit(unsigned int limit);
+
+    /**
+     * @brief The number of jobs waiting for a worker.
+     */
+    size_t queued();
+
+    /**
+     * @brief Queue a callable to be run on one of the workers.
+     *
+     * @return A future for the result of job, holding its exception if it
+     * throws.
+     */
+    template<typename F>
+    auto submit(F &&job) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+        return enqueue(std::forward<F>(job), current() == this);
+    }
+
+    /**
+     * @brief Queue a callable as a job of its own, even when called from a
+     * worker: it goes to the back of a deque like a job from outside, so
+     * wait() never runs it in place of a sub-job.
+     *
+     * For jobs that do not belong to the one that happens to submit them,
+     * such as the next ones a finishing job lets in.
+     *
+     * @return A future for the result of job, holding its exception if it
+     * throws.
+     */
+    template<typename F>
+    auto submit_top_level(F &&job)
+        -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+        return enqueue(std::forward<F>(job), false);
+    }
+
+    /**
+     * @brief Wait for a future of a job submitted from the calling worker.
+     *
+     * While waiting, the calling worker runs the jobs it submitted itself that
+     * nobody has stolen yet, so waiting on sub-jobs from inside a job can not
+     * dead-lock the pool. With none left it sleeps until a job of the pool
+     * finishes. Also usable from outside the pool, then it simply blocks.
+     */
+    template<typename T>
+    T wait(std::future<T> &future)
+    {
+        if (current() != this)
+            return future.get();
+
+        for (;;)
+        {
+            // counted before the future is checked, so a job finishing right
+            // after the check still wakes the worker.
+            const uint64_t finished = jobs_finished();
+            if (future.wait_for(std::chrono::seconds(0))
+                == std::future_status::ready)
+                return future.get();
+
+            if (!try_run_nested())
+                wait_for_jobs_finished(finished);
+        }
+    }
+
+    /**
+     * @brief Run one sub-job queued by any worker, for a worker waiting on
+     * something else than a future of its own, such as another job's result.
+     * Helps the running jobs along instead of idling, but never starts a top
+     * level job, see wait().
+     *
+     * @return False if there was none, or the caller is no worker of the pool.
+     */
+    bool help_nested();
+
+    /**
+     * @brief The pool the calling thread is a worker of, nullptr if it is not a
+     * worker thread.
+     */
+    static ThreadPool *current();
+
+  private:
+    struct QueuedJob
+    {
+        std::function<void()> run;
+
+        // submitted from inside a worker of this pool.
+        bool nested;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex            mutex;
+        std::deque<QueuedJob> jobs;
+    };
+
+    template<typename F>
+    auto enqueue(F &&job, bool nested)
+        -> std::future<std::invoke_result_t<std::decay_t<F>>>
+    {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+
+        // std::function needs a copyable callable, packaged_task is move only.
+        auto task =
+            std::make_shared<std::packaged_task<R()>>(std::forward<F>(job));
+        auto future = task->get_future();
+        push([task] { (*task)(); }, nested);
+        return future;
+    }
+
+    /// nested jobs go to the front of the calling worker's deque.
+    void push(std::function<void()> job, bool nested);
+
+    std::optional<QueuedJob> pop(size_t home);
+
+    bool try_run_nested();
+
+    /// The number of jobs finished so far.
+    uint64_t jobs_finished();
+
+    /// Sleep until more than the given number of jobs finished.
+    void wait_for_jobs_finished(uint64_t finished);
+
+    /// Run a job taken from a deque and count it as finished.
+    void run_job(QueuedJob &job);
+
+    /// Run the sub-job at the front of the given worker's deque, if any.
+    bool run_nested_from(size_t index);
+
+    void worker_loop(size_t index);
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread>                m_workers;
+
+    std::atomic<size_t> m_next_queue {};
+
+    // guards m_queued and m_stopping for sleeping workers.
+    std::mutex              m_sleep_mutex;
+    std::condition_variable m_wake;
+    size_t                  m_queued {};
+    bool                    m_stopping {false};
+
+    // guarded by m_sleep_mutex as well, wakes workers waiting for sub-jobs.
+    std::condition_variable m_job_finished;
+    uint64_t                m_jobs_finished {};
+
+    // written under m_sleep_mutex, read without it for the hot paths.
+    std::atomic<unsigned int> m_active_limit {};
+};
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_THREADPOOL_H */
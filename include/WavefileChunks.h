@@ -2,8 +2,9 @@
 #define WAVEFILE_WAVEFILECHUNKS_H
 
 #include <array>
+#include <cstdint>
 #include <cstring>
-#include <vector>
+#include <string>
 
 // for reference to these headers see
 // https://stackoverflow.com/questions/13660777/c-reading-the-data-part-of-a-wav-file
@@ -92,18 +93,75 @@ struct FormatHeader
 };
 static_assert(sizeof(FormatHeader) == 24, "Format header does not fit spec.");
 
+/// AudioFormat of a format chunk that carries a FormatExtension.
+constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
 /**
- * @struct DataChunk
+ * @struct FormatExtension
+ *
+ * @brief A POD struct that represents the fields WAVE_FORMAT_EXTENSIBLE
+ * appends to the format chunk.
  *
- * @brief A struct that represents a data chunk, with the Data field in
- * uninterpreted, binary format.
+ * The first two bytes of SubFormat hold the actual format code, the rest is a
+ * fixed GUID suffix.
  */
-struct DataChunk
+struct FormatExtension
+{
+    uint16_t                cbSize;
+    uint16_t                ValidBitsPerSample;
+    uint32_t                ChannelMask;
+    std::array<uint8_t, 16> SubFormat;
+};
+static_assert(sizeof(FormatExtension) == 24,
+              "Format extension does not fit spec.");
+
+/**
+ * @struct DataSize64
+ *
+ * @brief A POD struct that represents the fixed fields of the ds64 chunk,
+ * which RF64 and BW64 files carry right after their RIFF header.
+ *
+ * Files of more than 4 GiB set the 32 bit sizes of the RIFF header and the
+ * data chunk to 0xFFFFFFFF and keep the real ones here, split into low and
+ * high halves. The table of other oversized chunks follows.
+ */
+struct DataSize64
 {
     CommonHeader Chunk_header;
+    uint32_t     RiffSizeLow;
+    uint32_t     RiffSizeHigh;
+    uint32_t     DataSizeLow;
+    uint32_t     DataSizeHigh;
+    uint32_t     SampleCountLow;
+    uint32_t     SampleCountHigh;
+    uint32_t     TableLength;
+
+    uint64_t DataSize() const
+    {
+        return uint64_t {DataSizeHigh} << 32 | DataSizeLow;
+    }
+};
+static_assert(sizeof(DataSize64) == 36, "ds64 chunk does not fit spec.");
 
-    std::vector<char> Data;
+/**
+ * @struct ChunkSize64
+ *
+ * @brief A POD struct that represents an entry of the ds64 table: the 64 bit
+ * size of another chunk with 0xFFFFFFFF as its 32 bit size.
+ */
+struct ChunkSize64
+{
+    FourUnterminatedChars ChunkID;
+    uint32_t              ChunkSizeLow;
+    uint32_t              ChunkSizeHigh;
+
+    uint64_t ChunkSize() const
+    {
+        return uint64_t {ChunkSizeHigh} << 32 | ChunkSizeLow;
+    }
 };
+static_assert(sizeof(ChunkSize64) == 12, "ds64 table entry does not fit spec.");
+
 } // namespace chunks
 } // namespace wavefile
 #endif /* WAVEFILE_WAVEFILECHUNKS_H */
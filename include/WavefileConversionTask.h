@@ -1,7 +1,13 @@
 #ifndef WAVEFILE_WAVEFILE_H
 #define WAVEFILE_WAVEFILE_H
 
+#include "EncodingProfile.h"
+
+#include <cstdint>
 #include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 /**
  * @namespace mp3_converter
@@ -9,13 +15,18 @@
  * @brief Namespace containing the classes used in mp3_converter.
  */
 namespace mp3_converter {
+class ByteSink;
+class PipeWavefileReader;
+class WavefileReader;
+
 /**
  * @class WavefileConversionTask
  *
  * @brief A task to convert a given wav file to an mp3 file using lame encoder.
  *
  * Output will always be in the same dir where the project is running, with the
- * extension exchanged from wav to mp3 to match the file contents.
+ * extension exchanged from wav to mp3 to match the file contents. With several
+ * encoding profiles, the source is read once and one mp3 per profile written.
  */
 class WavefileConversionTask
 {
@@ -24,19 +35,102 @@ class WavefileConversionTask
      * @brief Create a conversion task from the given in_file.
      *
      * @param in_file The file to convert in this task.
+     * @param profiles The mp3 files to write, lame's defaults if empty.
      */
-    WavefileConversionTask(const std::filesystem::path &in_file);
+    WavefileConversionTask(
+        const std::filesystem::path &       in_file,
+        const std::vector<EncodingProfile> &profiles = default_profiles());
 
     /**
      * @brief Run the conversion.
      *
      * @throws wave_format_error When the wave file could not be read correctly.
      * @throws lame_encoding_error When lame encoding fails.
+     * @throws cancelled_error When the calling thread's CancellationToken is
+     * cancelled, see CancellationScope.
      *
      * @return True if successfull, else false.
      */
     bool run();
 
+    /**
+     * @brief Convert a wav stream that can only be read front to back, such as
+     * stdin, writing the mp3 frames to out as they are produced.
+     *
+     * Streams without data size in their header are read until they end.
+     * Nothing is printed, out may well be stdout. Only a single profile fits
+     * into one output.
+     *
+     * @throws wave_format_error When the wave stream could not be read
+     * correctly.
+     * @throws lame_encoding_error When lame encoding fails.
+     * @throws cancelled_error When the calling thread's CancellationToken is
+     * cancelled, see CancellationScope.
+     *
+     * @return True if successfull, else false.
+     */
+    static bool convert_stream(PipeWavefileReader &   reader,
+                               ByteSink &             out,
+                               const EncodingProfile &profile = {});
+
+    /**
+     * @brief Convert the wav data behind a seekable reader, such as a mapped
+     * file or a buffer in memory, to one mp3 per profile.
+     *
+     * Long inputs of a segmented profile are split into segments encoded
+     * concurrently, several profiles share one read. Every sink in outs is
+     * closed at the end. Pipes can not be read this way, use convert_stream
+     * for them.
+     *
+     * @param outs One sink per profile, in the same order.
+     *
+     * @throws wave_format_error When the wave data could not be read
+     * correctly.
+     * @throws lame_encoding_error When lame encoding fails.
+     * @throws cancelled_error When the calling thread's CancellationToken is
+     * cancelled, see CancellationScope.
+     *
+     * @return True if successfull, else false.
+     */
+    static bool convert(WavefileReader &                    reader,
+                        const std::vector<ByteSink *> &     outs,
+                        const std::vector<EncodingProfile> &profiles);
+
+    /**
+     * @brief Estimate the memory converting in_file takes at its peak, from
+     * the format and data chunk headers only.
+     *
+     * Long files count the segments encoded concurrently if the profile is
+     * segmented, several profiles their encoders. Files whose headers can not
+     * be read get the small estimate of a conversion that fails early.
+     */
+    static uint64_t estimated_peak_memory(
+        const std::filesystem::path &       in_file,
+        const std::vector<EncodingProfile> &profiles = default_profiles());
+
+    /**
+     * @brief The mp3 file a conversion of in_file writes for the profile:
+     * name.mp3 for lame's defaults, else name.<profile>.mp3.
+     */
+    static std::filesystem::path
+    output_file(const std::filesystem::path &in_file,
+                const EncodingProfile &      profile = {});
+
+    /**
+     * @brief Whether the mp3 of every profile for in_file exists.
+     */
+    static bool outputs_exist(const std::filesystem::path &       in_file,
+                              const std::vector<EncodingProfile> &profiles);
+
+    /**
+     * @brief Describe everything besides the input that determines the
+     * produced mp3 bytes: the lame version and the settings used with it.
+     *
+     * Outputs recorded with different settings are stale.
+     */
+    static std::string encoder_settings(
+        const std::vector<EncodingProfile> &profiles = default_profiles());
+
     /**
      * @struct wave_format_error
      *
@@ -52,6 +146,8 @@ class WavefileConversionTask
     size_t m_task_num;
 
     std::filesystem::path m_wav_file_in;
+
+    std::vector<EncodingProfile> m_profiles;
 };
 
 } // namespace mp3_converter
@@ -0,0 +1,332 @@
+#ifndef MP3_CONVERTER_WAVEFILEREADER_H
+#define MP3_CONVERTER_WAVEFILEREADER_H
+
+#include "BufferArena.h"
+#include "MappedFile.h"
+#include "WavefileChunks.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace mp3_converter {
+
+/**
+ * @struct WaveLayout
+ *
+ * @brief The parsed format of a wav file and where its sample data lives.
+ */
+struct WaveLayout
+{
+    wavefile::chunks::FormatHeader format {};
+
+    /// The sample format, 1 for PCM or 3 for IEEE float, taken from the
+    /// SubFormat of WAVE_FORMAT_EXTENSIBLE files.
+    uint16_t sample_format {};
+
+    /// The speaker positions of the channels, 0 if the file gives none.
+    uint32_t channel_mask {};
+
+    /// Offset of the data chunk payload from the start of the file.
+    uint64_t data_offset {};
+
+    /// Size of the data chunk payload in bytes, as given by its header.
+    /// unknown_size for streams whose header leaves it open, they are read
+    /// until they end.
+    uint64_t data_size {};
+
+    static constexpr uint64_t unknown_size = ~uint64_t {0};
+};
+
+/**
+ * @class WavefileReader
+ *
+ * @brief Interface to a parsed wav file, handing out its data chunk payload
+ * front to back in blocks.
+ */
+class WavefileReader
+{
+  public:
+    virtual ~WavefileReader() = default;
+
+    /**
+     * @brief The layout parsed from the headers when the reader was opened.
+     */
+    const WaveLayout &layout() const
+    {
+        return m_layout;
+    }
+
+    /**
+     * @brief Get the next num_bytes of the data chunk payload.
+     *
+     * @param num_bytes The number of bytes to get.
+     * @param alignment The alignment the returned pointer has to satisfy, so it
+     * can be reinterpreted as an array of samples.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the file ends
+     * before num_bytes could be provided.
+     *
+     * @return Pointer to the bytes, valid until the next call.
+     */
+    virtual const char *next_block(size_t num_bytes, size_t alignment) = 0;
+
+    /**
+     * @brief Open an independent reader over the same file, positioned
+     * data_position bytes into the data chunk payload.
+     *
+     * Lets several threads read different parts of one file at once.
+     */
+    virtual std::unique_ptr<WavefileReader>
+    open_at(uint64_t data_position) const = 0;
+
+  protected:
+    WaveLayout m_layout {};
+};
+
+/**
+ * @class MappedWavefileReader
+ *
+ * @brief Reads a wav file through a memory mapping.
+ *
+ * Headers are parsed straight out of the mapping and blocks are handed out as
+ * pointers into it, so the payload is never copied unless it is misaligned for
+ * the requested sample type. The blocks after the one handed out are
+ * prefetched, so the disk reads them while the current block is encoded.
+ */
+class MappedWavefileReader : public WavefileReader
+{
+  public:
+    /**
+     * @brief Parse the headers of the mapped file.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the headers are
+     * invalid.
+     */
+    explicit MappedWavefileReader(MappedFile file);
+
+    const char *next_block(size_t num_bytes, size_t alignment) override;
+
+    std::unique_ptr<WavefileReader>
+    open_at(uint64_t data_position) const override;
+
+  private:
+    MappedWavefileReader(std::shared_ptr<const MappedFile> file,
+                         const WaveLayout &                layout,
+                         uint64_t                          position);
+
+    // readers opened with open_at share one mapping.
+    std::shared_ptr<const MappedFile> m_file;
+    uint64_t                          m_position {};
+
+    // file offset up to which the mapping was prefetched.
+    uint64_t m_prefetched_until {};
+
+    // only used for blocks that are misaligned inside the mapping.
+    PooledBuffer m_aligned_copy {};
+};
+
+/**
+ * @class MemoryWavefileReader
+ *
+ * @brief Reads a wav file that is already in memory, such as a request body.
+ *
+ * Blocks are handed out as pointers into the memory, which has to stay valid
+ * and unchanged as long as the reader and every reader opened from it live.
+ */
+class MemoryWavefileReader : public WavefileReader
+{
+  public:
+    /**
+     * @brief Parse the headers of the wav file in the given bytes.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the headers are
+     * invalid.
+     */
+    MemoryWavefileReader(const void *data, size_t size);
+
+    const char *next_block(size_t num_bytes, size_t alignment) override;
+
+    std::unique_ptr<WavefileReader>
+    open_at(uint64_t data_position) const override;
+
+  private:
+    MemoryWavefileReader(const char *      data,
+                         size_t            size,
+                         const WaveLayout &layout,
+                         uint64_t          position);
+
+    const char *m_data;
+    size_t      m_size;
+    uint64_t    m_position {};
+
+    // only used for blocks that are misaligned inside the memory.
+    PooledBuffer m_aligned_copy {};
+};
+
+/**
+ * @class StreamWavefileReader
+ *
+ * @brief Reads a wav file through an ifstream, copying each block into a
+ * buffer. Fallback for files that can not be mapped.
+ *
+ * Double buffered: while the caller works on one block, the next block of the
+ * same size is read ahead. The reads ahead run on one thread per reader,
+ * started with the first block and joined when the reader goes away.
+ */
+class StreamWavefileReader : public WavefileReader
+{
+  public:
+    /**
+     * @brief Open the file and parse its headers.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the headers are
+     * invalid.
+     */
+    explicit StreamWavefileReader(const std::filesystem::path &file);
+
+    /**
+     * @brief Stop the read ahead thread, after the read it runs.
+     */
+    ~StreamWavefileReader() override;
+
+    const char *next_block(size_t num_bytes, size_t alignment) override;
+
+    std::unique_ptr<WavefileReader>
+    open_at(uint64_t data_position) const override;
+
+  private:
+    enum class ReadAhead
+    {
+        idle,
+        requested,
+        done
+    };
+
+    /**
+     * @brief Read num_bytes at data_position of the payload into to.
+     *
+     * @return The number of bytes actually read.
+     */
+    size_t read_at(unsigned char *to, uint64_t data_position, size_t num_bytes);
+
+    /**
+     * @brief Wait for the read ahead requested last, if any.
+     *
+     * @return Whether it read m_ahead_size bytes at m_ahead_position.
+     */
+    bool finish_read_ahead();
+
+    void read_ahead_loop();
+
+    std::filesystem::path m_file;
+    std::ifstream         m_stream;
+
+    // payload offset of the next block handed out.
+    uint64_t m_position {};
+
+    PooledBuffer m_block {};
+    PooledBuffer m_ahead {};
+
+    // the stream and m_ahead belong to the read ahead thread from a request
+    // until it is done, to the caller otherwise.
+    std::mutex              m_ahead_mutex;
+    std::condition_variable m_ahead_changed;
+    ReadAhead               m_ahead_state {ReadAhead::idle};
+    uint64_t                m_ahead_position {};
+    size_t                  m_ahead_size {};
+    size_t                  m_ahead_read {};
+    bool                    m_stopping {false};
+
+    std::thread m_ahead_thread;
+};
+
+/**
+ * @class PipeWavefileReader
+ *
+ * @brief Reads a wav stream front to back from a file descriptor that can not
+ * seek, such as stdin, or from any source that hands out its bytes in order.
+ *
+ * Chunks before the data chunk are skipped by reading over them. Streams
+ * written to a pipe often leave the data size open (0 or 0xFFFFFFFF), those
+ * are read until the descriptor ends.
+ */
+class PipeWavefileReader : public WavefileReader
+{
+  public:
+    /**
+     * @brief Pulls up to num_bytes of the stream into buffer and returns how
+     * many it got, 0 once the stream ended. May return fewer bytes at any
+     * time, it is called again for the rest.
+     */
+    using Pull = std::function<size_t(void *buffer, size_t num_bytes)>;
+
+    /**
+     * @brief Parse the headers, reading no further than the start of the data
+     * chunk payload.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the headers are
+     * invalid.
+     * @throws std::system_error When reading fd fails.
+     */
+    explicit PipeWavefileReader(int fd);
+
+    /**
+     * @brief Parse the headers pulled from pull, pulling no further than the
+     * start of the data chunk payload.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the headers are
+     * invalid.
+     */
+    explicit PipeWavefileReader(Pull pull);
+
+    const char *next_block(size_t num_bytes, size_t alignment) override;
+
+    /**
+     * @brief Get up to num_bytes of the data chunk payload, fewer only where it
+     * ends.
+     *
+     * @throws WavefileConversionTask::wave_format_error When the stream ends
+     * before the data size its header gives.
+     *
+     * @return Pointer to the bytes, valid until the next call, and their
+     * number, which is 0 once the payload is used up.
+     */
+    std::pair<const char *, size_t> next_block_up_to(size_t num_bytes);
+
+    /**
+     * @brief Not supported, a pipe can only be read once.
+     *
+     * @throws std::logic_error Always.
+     */
+    std::unique_ptr<WavefileReader>
+    open_at(uint64_t data_position) const override;
+
+  private:
+    Pull m_pull;
+
+    // payload offset of the next block handed out.
+    uint64_t m_position {};
+
+    PooledBuffer m_block {};
+};
+
+/**
+ * @brief Open a reader for the given file, memory mapped if possible.
+ *
+ * @param file The wav file to read.
+ *
+ * @throws WavefileConversionTask::wave_format_error When the headers are
+ * invalid.
+ */
+std::unique_ptr<WavefileReader>
+open_wavefile(const std::filesystem::path &file);
+
+} // namespace mp3_converter
+#endif /* MP3_CONVERTER_WAVEFILEREADER_H */
@@ -0,0 +1,92 @@
+#include "AdmissionControl.h"
+
+#include <algorithm>
+
+namespace {
+// times a waiting job may be passed over by smaller ones before it gets the
+// next free memory, per job that may be in flight.
+constexpr size_t max_passed_over_per_slot = 4;
+} // namespace
+
+namespace mp3_converter {
+
+AdmissionControl::AdmissionControl(ThreadPool &pool,
+                                   uint64_t    budget_bytes,
+                                   size_t      max_in_flight)
+    : m_pool(pool)
+    , m_budget(budget_bytes)
+    , m_max_in_flight(std::max<size_t>(max_in_flight, 1))
+{
+}
+
+AdmissionControl::~AdmissionControl()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_pending.empty() && m_in_flight == 0; });
+}
+
+std::future<bool> AdmissionControl::submit(uint64_t              peak_bytes,
+                                           std::function<bool()> job)
+{
+    auto task   = std::make_shared<std::packaged_task<bool()>>(std::move(job));
+    auto result = task->get_future();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.push_back({peak_bytes, std::move(task)});
+    admit_locked();
+    return result;
+}
+
+uint64_t AdmissionControl::reserved_bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_reserved;
+}
+
+void AdmissionControl::admit_locked()
+{
+    const size_t max_passed_over = max_passed_over_per_slot * m_max_in_flight;
+
+    for (auto it = m_pending.begin();
+         it != m_pending.end() && m_in_flight < m_max_in_flight;)
+    {
+        const bool fits = m_budget == 0 || m_in_flight == 0
+                          || m_reserved + it->peak_bytes <= m_budget;
+        if (!fits)
+        {
+            // the oldest waiting job blocks everybody behind it once it was
+            // passed over often enough, else large files could starve.
+            if (it == m_pending.begin() && it->passed_over >= max_passed_over)
+                return;
+            ++it;
+            continue;
+        }
+
+        if (it != m_pending.begin())
+            ++m_pending.front().passed_over;
+
+        m_reserved += it->peak_bytes;
+        ++m_in_flight;
+        // release() runs on a worker, the jobs it admits are not its
+        // sub-jobs.
+        m_pool.submit_top_level(
+            [this, task = it->task, peak = it->peak_bytes] {
+                (*task)();
+                release(peak);
+            });
+        it = m_pending.erase(it);
+    }
+}
+
+void AdmissionControl::release(uint64_t peak_bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reserved -= peak_bytes;
+    --m_in_flight;
+    admit_locked();
+
+    if (m_pending.empty() && m_in_flight == 0)
+        m_idle.notify_all();
+}
+
+} // namespace mp3_converter
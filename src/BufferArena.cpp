@@ -0,0 +1,119 @@
+#include "BufferArena.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace mp3_converter {
+
+PooledBuffer::PooledBuffer(BufferArena *arena, std::vector<unsigned char> bytes)
+    : m_arena(arena)
+    , m_bytes(std::move(bytes))
+{
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    release();
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_arena = std::exchange(other.m_arena, nullptr);
+        m_bytes = std::move(other.m_bytes);
+        m_size  = std::exchange(other.m_size, 0);
+        other.m_bytes.clear();
+    }
+    return *this;
+}
+
+void PooledBuffer::resize(size_t size)
+{
+    if (size > m_bytes.size())
+        m_bytes.resize(size);
+    m_size = size;
+}
+
+void PooledBuffer::release() noexcept
+{
+    if (m_arena != nullptr)
+        m_arena->give_back(std::move(m_bytes));
+
+    m_arena = nullptr;
+    m_size  = 0;
+}
+
+BufferArena &BufferArena::for_this_thread()
+{
+    thread_local BufferArena arena;
+    return arena;
+}
+
+PooledBuffer BufferArena::acquire(size_t size)
+{
+    // the smallest buffer that already fits, else the largest one to grow.
+    auto best = m_free.end();
+    for (auto it = m_free.begin(); it != m_free.end(); ++it)
+    {
+        if (best == m_free.end())
+        {
+            best = it;
+            continue;
+        }
+
+        const bool fits      = it->size() >= size;
+        const bool best_fits = best->size() >= size;
+        if ((fits && (!best_fits || it->size() < best->size()))
+            || (!fits && !best_fits && it->size() > best->size()))
+            best = it;
+    }
+
+    std::vector<unsigned char> bytes;
+    if (best != m_free.end())
+    {
+        bytes = std::move(*best);
+        m_free.erase(best);
+    }
+
+    PooledBuffer buffer(this, std::move(bytes));
+    buffer.resize(size);
+    return buffer;
+}
+
+size_t BufferArena::pooled_bytes() const
+{
+    size_t bytes = 0;
+    for (const auto &buffer : m_free)
+        bytes += buffer.capacity();
+    return bytes;
+}
+
+void BufferArena::give_back(std::vector<unsigned char> bytes) noexcept
+{
+    if (bytes.capacity() == 0 || m_free.size() >= max_pooled)
+        return;
+
+    if (bytes.size() > watermark)
+    {
+        bytes.resize(watermark);
+        bytes.shrink_to_fit();
+    }
+
+    try
+    {
+        m_free.push_back(std::move(bytes));
+    }
+    catch (...)
+    {
+        // out of memory while growing the free list, just let it go.
+    }
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,335 @@
+#include "ByteSink.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#    include <fcntl.h>
+#    include <io.h>
+#    include <process.h>
+#    include <sys/stat.h>
+#else
+#    include <fcntl.h>
+#    include <sys/ioctl.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#    include <linux/fs.h>
+#elif defined(__APPLE__)
+#    include <sys/clonefile.h>
+#endif
+
+namespace mp3_converter {
+
+namespace {
+// tells temporary files of one process apart.
+std::atomic<unsigned> temporary_counter {};
+
+#ifdef _WIN32
+int open_exclusive(const std::filesystem::path &file)
+{
+    return _wopen(file.c_str(),
+                  _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY | _O_NOINHERIT,
+                  _S_IREAD | _S_IWRITE);
+}
+
+long write_some(int fd, const unsigned char *data, size_t size)
+{
+    const auto chunk = std::min<size_t>(size, 1u << 30);
+    return _write(fd, data, static_cast<unsigned>(chunk));
+}
+
+bool truncate_to(int fd, uint64_t size)
+{
+    return _chsize_s(fd, static_cast<__int64>(size)) == 0;
+}
+
+bool close_file(int fd)
+{
+    return _close(fd) == 0;
+}
+
+unsigned process_id()
+{
+    return static_cast<unsigned>(_getpid());
+}
+
+void preallocate(int, uint64_t)
+{
+    // the CRT has no way to reserve room without growing the file.
+}
+#else
+int open_exclusive(const std::filesystem::path &file)
+{
+    return open(file.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+}
+
+long write_some(int fd, const unsigned char *data, size_t size)
+{
+    return static_cast<long>(::write(fd, data, size));
+}
+
+bool truncate_to(int fd, uint64_t size)
+{
+    return ftruncate(fd, static_cast<off_t>(size)) == 0;
+}
+
+bool close_file(int fd)
+{
+    return ::close(fd) == 0;
+}
+
+unsigned process_id()
+{
+    return static_cast<unsigned>(getpid());
+}
+
+void preallocate(int fd, uint64_t size)
+{
+#    ifdef __linux__
+    // keep the size at zero, so a crash does not leave a file padded with
+    // zeros behind. Only a hint, not all file systems support it.
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size));
+#    else
+    (void)fd;
+    (void)size;
+#    endif
+}
+#endif
+
+/**
+ * @brief A hidden name next to file for writing it, a rename within a folder
+ * never copies.
+ */
+std::filesystem::path temporary_name(const std::filesystem::path &file)
+{
+    auto temporary = file;
+    temporary.replace_filename("." + file.filename().string() + "."
+                               + std::to_string(process_id()) + "-"
+                               + std::to_string(temporary_counter++)
+                               + ".part");
+    return temporary;
+}
+
+/**
+ * @brief Create target as a copy on write clone of source.
+ *
+ * @return False if the file system or platform can not clone, target does
+ * not exist then.
+ */
+bool clone_file(const std::filesystem::path &source,
+                const std::filesystem::path &target)
+{
+#if defined(__linux__) && defined(FICLONE)
+    const int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return false;
+    const int out = open_exclusive(target);
+    if (out < 0)
+    {
+        close_file(in);
+        return false;
+    }
+
+    const bool cloned = ioctl(out, FICLONE, in) == 0;
+    close_file(in);
+    if (close_file(out) && cloned)
+        return true;
+
+    std::error_code error;
+    std::filesystem::remove(target, error);
+    return false;
+#elif defined(__APPLE__)
+    return clonefile(source.c_str(), target.c_str(), 0) == 0;
+#else
+    (void)source;
+    (void)target;
+    return false;
+#endif
+}
+} // namespace
+
+FileSink::FileSink(const std::filesystem::path &file)
+    : m_file(file)
+{
+    for (int attempt = 0; attempt < 16 && m_fd < 0; ++attempt)
+    {
+        m_temporary = temporary_name(file);
+
+        m_fd = open_exclusive(m_temporary);
+        if (m_fd < 0 && errno != EEXIST)
+            break;
+    }
+
+    // before anything is encoded for nothing.
+    if (m_fd < 0)
+        throw std::filesystem::filesystem_error(
+            "Creating the output failed",
+            m_temporary,
+            std::error_code(errno, std::generic_category()));
+
+    // borrowed here, so it goes back to the arena of the thread that owns the
+    // sink even when the writes come from another, see FanOut.
+    m_buffer = BufferArena::for_this_thread().acquire(write_block);
+    m_buffer.resize(0);
+}
+
+FileSink::~FileSink()
+{
+    discard();
+}
+
+void FileSink::write(const unsigned char *data, size_t size)
+{
+    stages::ScopedStage timer(stages::Stage::write, size);
+    if (m_failed)
+        return;
+
+    while (size > 0)
+    {
+        const size_t used = m_buffer.size();
+        const size_t fill = std::min(size, write_block - used);
+        m_buffer.resize(used + fill);
+        std::memcpy(m_buffer.data() + used, data, fill);
+        data += fill;
+        size -= fill;
+
+        if (m_buffer.size() == write_block && !flush_buffer())
+            return;
+    }
+}
+
+void FileSink::reserve(uint64_t size)
+{
+    if (!m_failed)
+        preallocate(m_fd, size);
+}
+
+bool FileSink::close()
+{
+    stages::ScopedStage timer(stages::Stage::write);
+
+    if (!m_failed && flush_buffer() && truncate_to(m_fd, m_written))
+    {
+        const bool closed = close_file(m_fd);
+        m_fd              = -1;
+
+        std::error_code error;
+        if (closed)
+            std::filesystem::rename(m_temporary, m_file, error);
+        if (closed && !error)
+        {
+            m_temporary.clear();
+            return true;
+        }
+    }
+
+    m_failed = true;
+    discard();
+    return false;
+}
+
+bool FileSink::flush_buffer()
+{
+    const unsigned char *data = m_buffer.data();
+    size_t               left = m_buffer.size();
+    while (left > 0)
+    {
+        const long written = write_some(m_fd, data, left);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+        {
+            m_failed = true;
+            return false;
+        }
+
+        data += written;
+        left -= static_cast<size_t>(written);
+        m_written += static_cast<uint64_t>(written);
+    }
+
+    m_buffer.resize(0);
+    return true;
+}
+
+void FileSink::discard() noexcept
+{
+    if (m_fd >= 0)
+        close_file(m_fd);
+    m_fd = -1;
+
+    if (!m_temporary.empty())
+    {
+        std::error_code error;
+        std::filesystem::remove(m_temporary, error);
+        m_temporary.clear();
+    }
+}
+
+void DescriptorSink::write(const unsigned char *data, size_t size)
+{
+    stages::ScopedStage timer(stages::Stage::write, size);
+
+    while (!m_failed && size > 0)
+    {
+        const long written = write_some(m_fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+        {
+            m_failed = true;
+            return;
+        }
+
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+FileCopy share_file(const std::filesystem::path &source,
+                    const std::filesystem::path &target)
+{
+    namespace fs = std::filesystem;
+
+    // already a hard link from an earlier run. Renaming a link over another
+    // name of the same file does nothing, the temporary name would stay.
+    std::error_code error;
+    if (fs::equivalent(source, target, error))
+        return FileCopy::hard_link;
+
+    const auto temporary = temporary_name(target);
+
+    FileCopy kind = FileCopy::reflink;
+    if (!clone_file(source, temporary))
+    {
+        kind = FileCopy::hard_link;
+        fs::create_hard_link(source, temporary, error);
+    }
+    if (error)
+    {
+        kind = FileCopy::copy;
+        error.clear();
+        fs::copy_file(source, temporary, error);
+        if (error)
+            throw fs::filesystem_error(
+                "Copying failed", source, temporary, error);
+    }
+
+    fs::rename(temporary, target, error);
+    if (error)
+    {
+        std::error_code remove_error;
+        fs::remove(temporary, remove_error);
+        throw fs::filesystem_error("Renaming failed", temporary, target, error);
+    }
+    return kind;
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,68 @@
+#include "Cancellation.h"
+
+#include <string>
+
+namespace {
+thread_local const mp3_converter::CancellationToken *current_token {nullptr};
+} // namespace
+
+namespace mp3_converter {
+
+CancellationToken::CancellationToken(const CancellationToken * parent,
+                                     std::chrono::milliseconds timeout)
+    : m_parent(parent)
+    , m_timeout(timeout)
+    , m_deadline(timeout.count() > 0
+                     ? std::optional<clock::time_point>(clock::now() + timeout)
+                     : std::nullopt)
+{
+}
+
+void CancellationToken::cancel()
+{
+    m_cancelled.store(true, std::memory_order_relaxed);
+}
+
+bool CancellationToken::cancelled() const
+{
+    return m_cancelled.load(std::memory_order_relaxed) || deadline_passed()
+           || (m_parent && m_parent->cancelled());
+}
+
+void CancellationToken::throw_if_cancelled() const
+{
+    if (deadline_passed())
+        throw cancelled_error("Conversion exceeded its deadline of "
+                              + std::to_string(m_timeout.count()) + " ms.");
+    if (cancelled())
+        throw cancelled_error("Conversion was cancelled.");
+}
+
+const CancellationToken *CancellationToken::current()
+{
+    return current_token;
+}
+
+bool CancellationToken::deadline_passed() const
+{
+    return m_deadline && clock::now() >= *m_deadline;
+}
+
+CancellationScope::CancellationScope(const CancellationToken *token)
+    : m_previous(current_token)
+{
+    current_token = token;
+}
+
+CancellationScope::~CancellationScope()
+{
+    current_token = m_previous;
+}
+
+void throw_if_cancelled()
+{
+    if (current_token)
+        current_token->throw_if_cancelled();
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,172 @@
+#include "ConcurrencyController.h"
+
+#include "ProgressReporter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#ifdef _WIN32
+#    define NOMINMAX
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <sys/resource.h>
+#endif
+
+namespace {
+constexpr std::chrono::milliseconds period(500);
+
+// below this share of their wall time on the CPU, workers wait for I/O.
+constexpr double io_bound_busy = 0.8;
+
+// above this share, extra workers beyond the cores only compete for them.
+constexpr double cpu_bound_busy = 0.95;
+
+// a change that costs more than this share of throughput is taken back.
+constexpr double tolerated_loss = 0.05;
+
+// periods the level is held after a change was taken back.
+constexpr unsigned int hold_after_revert = 6;
+
+/**
+ * @brief The CPU time all threads of the process used so far.
+ */
+std::chrono::nanoseconds process_cpu_time()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return {};
+
+    const auto ticks = [](const FILETIME &time) {
+        return (uint64_t {time.dwHighDateTime} << 32) | time.dwLowDateTime;
+    };
+    // FILETIME counts 100 ns ticks.
+    return std::chrono::nanoseconds((ticks(kernel) + ticks(user)) * 100);
+#else
+    rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return {};
+
+    const auto to_ns = [](const timeval &time) {
+        return std::chrono::seconds(time.tv_sec)
+               + std::chrono::microseconds(time.tv_usec);
+    };
+    return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+#endif
+}
+} // namespace
+
+namespace mp3_converter {
+
+ConcurrencyController::ConcurrencyController(ThreadPool & pool,
+                                             unsigned int initial)
+    : m_pool(pool)
+    , m_cores(std::max(1u, std::thread::hardware_concurrency()))
+{
+    m_pool.set_active_limit(initial);
+    m_thread = std::thread(&ConcurrencyController::run, this);
+}
+
+ConcurrencyController::~ConcurrencyController()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+ConcurrencyController::Sample ConcurrencyController::take_sample()
+{
+    return {std::chrono::steady_clock::now(),
+            process_cpu_time(),
+            ProgressReporter::input_bytes()};
+}
+
+void ConcurrencyController::run()
+{
+    auto last = take_sample();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_wake.wait_for(lock, period, [this] { return m_stopping; }))
+    {
+        const auto now     = take_sample();
+        const auto elapsed = std::chrono::duration<double>(now.wall - last.wall);
+        const auto cpu     = std::chrono::duration<double>(now.cpu - last.cpu);
+        const auto bytes   = now.bytes - last.bytes;
+        last               = now;
+
+        // workers that run dry are idle, not blocked, measure the next one.
+        if (m_pool.queued() == 0 || elapsed.count() <= 0)
+        {
+            m_on_trial = false;
+            continue;
+        }
+
+        // the share of each active worker's time spent on a core, where at
+        // most all cores can be busy.
+        const unsigned int level = m_pool.active_limit();
+        const double       busy =
+            cpu.count() / (elapsed.count() * std::min(level, m_cores));
+
+        adjust(static_cast<double>(bytes) / elapsed.count(), busy);
+    }
+}
+
+void ConcurrencyController::adjust(double bytes_per_second, double busy)
+{
+    const unsigned int level = m_pool.active_limit();
+
+    if (m_on_trial)
+    {
+        m_on_trial = false;
+        if (bytes_per_second
+            < m_previous_throughput * (1.0 - tolerated_loss))
+        {
+            set_level(m_previous_level, bytes_per_second, busy);
+            m_hold = hold_after_revert;
+            return;
+        }
+    }
+
+    if (m_hold > 0)
+    {
+        --m_hold;
+        return;
+    }
+
+    unsigned int next = level;
+    if (busy < io_bound_busy && level < m_pool.size())
+        next = std::min(m_pool.size(), level + std::max(1u, level / 4));
+    else if (busy > cpu_bound_busy && level > m_cores)
+        next = level - 1;
+
+    if (next == level)
+        return;
+
+    m_previous_level      = level;
+    m_previous_throughput = bytes_per_second;
+    m_on_trial            = true;
+    set_level(next, bytes_per_second, busy);
+}
+
+void ConcurrencyController::set_level(unsigned int level,
+                                      double       bytes_per_second,
+                                      double       busy)
+{
+    m_pool.set_active_limit(level);
+
+    char measured[64];
+    std::snprintf(measured,
+                  sizeof(measured),
+                  "%.1f MB/s at %.0f%% busy",
+                  bytes_per_second / 1e6,
+                  std::min(busy, 1.0) * 100);
+    ProgressReporter::log("Concurrency: " + std::to_string(level)
+                          + " workers, measured " + measured + ".");
+}
+
+} // namespace mp3_converter
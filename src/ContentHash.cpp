@@ -0,0 +1,143 @@
+#include "ContentHash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace mp3_converter {
+
+namespace {
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// little endian loads regardless of the host, so digests stored in a manifest
+// stay valid across machines.
+inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+inline uint32_t read32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+           | (static_cast<uint32_t>(p[2]) << 16)
+           | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t lane)
+{
+    acc ^= round(0, lane);
+    return acc * prime1 + prime4;
+}
+} // namespace
+
+ContentHash::ContentHash(uint64_t seed)
+    : m_lanes {seed + prime1 + prime2, seed + prime2, seed, seed - prime1}
+    , m_seed(seed)
+{
+}
+
+void ContentHash::update(const void *data, size_t size)
+{
+    auto *p = static_cast<const unsigned char *>(data);
+    m_total += size;
+
+    if (m_stripe_size > 0)
+    {
+        const size_t fill = std::min(sizeof(m_stripe) - m_stripe_size, size);
+        std::memcpy(m_stripe + m_stripe_size, p, fill);
+        m_stripe_size += fill;
+        p += fill;
+        size -= fill;
+
+        if (m_stripe_size < sizeof(m_stripe))
+            return;
+
+        for (int i = 0; i < 4; ++i)
+            m_lanes[i] = round(m_lanes[i], read64(m_stripe + 8 * i));
+        m_stripe_size = 0;
+    }
+
+    for (; size >= sizeof(m_stripe); p += sizeof(m_stripe), size -= sizeof(m_stripe))
+    {
+        for (int i = 0; i < 4; ++i)
+            m_lanes[i] = round(m_lanes[i], read64(p + 8 * i));
+    }
+
+    std::memcpy(m_stripe, p, size);
+    m_stripe_size = size;
+}
+
+uint64_t ContentHash::digest() const
+{
+    uint64_t h;
+    if (m_total >= sizeof(m_stripe))
+    {
+        h = rotl(m_lanes[0], 1) + rotl(m_lanes[1], 7) + rotl(m_lanes[2], 12)
+            + rotl(m_lanes[3], 18);
+        for (const auto lane : m_lanes)
+            h = merge_round(h, lane);
+    }
+    else
+    {
+        h = m_seed + prime5;
+    }
+
+    h += m_total;
+
+    const unsigned char *p    = m_stripe;
+    size_t               left = m_stripe_size;
+    for (; left >= 8; p += 8, left -= 8)
+    {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+    if (left >= 4)
+    {
+        h ^= read32(p) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+        left -= 4;
+    }
+    for (; left > 0; ++p, --left)
+    {
+        h ^= *p * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string ContentHash::to_hex(uint64_t digest)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+
+    std::string hex(16, '0');
+    for (int i = 15; i >= 0; --i, digest >>= 4)
+        hex[i] = digits[digest & 0xF];
+    return hex;
+}
+
+} // namespace mp3_converter
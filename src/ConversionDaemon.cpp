@@ -0,0 +1,565 @@
+#include "ConversionDaemon.h"
+
+#include "FileConversion.h"
+#include "WavefileConversionTask.h"
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+namespace {
+// longest request line accepted, anything longer is not a path.
+constexpr size_t max_request_bytes = 64 * 1024;
+
+std::vector<std::string> split_fields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    size_t                   start = 0;
+    for (;;)
+    {
+        const size_t end = line.find('\t', start);
+        fields.push_back(line.substr(start, end - start));
+        if (end == std::string::npos)
+            return fields;
+        start = end + 1;
+    }
+}
+
+/**
+ * @brief Keep a message on one line of the protocol.
+ */
+std::string one_line(std::string text)
+{
+    for (auto &c : text)
+        if (c == '\n' || c == '\r' || c == '\t')
+            c = ' ';
+    return text;
+}
+
+/**
+ * @brief One spelling for every way to name a folder: absolute, without dot
+ * segments, links resolved as far as it exists. Manifests are shared by it
+ * and look their files up relative to it.
+ */
+std::filesystem::path canonical_folder(const std::filesystem::path &folder)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code error;
+    auto            canonical = fs::weakly_canonical(folder, error);
+    if (error)
+        canonical = fs::absolute(folder).lexically_normal();
+    // a trailing separator would leave an empty file name behind.
+    return canonical.has_filename() ? canonical : canonical.parent_path();
+}
+
+std::system_error last_error(const char *what)
+{
+    return std::system_error(errno, std::generic_category(), what);
+}
+} // namespace
+
+namespace mp3_converter {
+
+/**
+ * @struct ConversionDaemon::Connection
+ *
+ * @brief A client, written to by every job it submitted.
+ */
+struct ConversionDaemon::Connection
+{
+    explicit Connection(int socket_fd)
+        : fd(socket_fd)
+    {
+    }
+
+    ~Connection()
+    {
+#ifndef _WIN32
+        ::close(fd);
+#endif
+    }
+
+    /// Send one reply line. A client that went away is not an error.
+    void send(const std::string &line)
+    {
+#ifndef _WIN32
+        const std::string           bytes = line + "\n";
+        std::lock_guard<std::mutex> lock(write_mutex);
+
+#    ifdef MSG_NOSIGNAL
+        // a vanished client must not kill the daemon with SIGPIPE.
+        constexpr int flags = MSG_NOSIGNAL;
+#    else
+        constexpr int flags = 0;
+#    endif
+        size_t sent = 0;
+        while (sent < bytes.size())
+        {
+            const auto n =
+                ::send(fd, bytes.data() + sent, bytes.size() - sent, flags);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return;
+            sent += static_cast<size_t>(n);
+        }
+#else
+        (void)line;
+#endif
+    }
+
+    void job_started()
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        ++open_jobs;
+    }
+
+    void job_done()
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        --open_jobs;
+        jobs_done.notify_all();
+    }
+
+    void wait_for_jobs()
+    {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+        jobs_done.wait(lock, [this] { return open_jobs == 0; });
+    }
+
+    int        fd;
+    std::mutex write_mutex;
+
+    std::mutex              jobs_mutex;
+    std::condition_variable jobs_done;
+    size_t                  open_jobs {};
+};
+
+/**
+ * @struct ConversionDaemon::Job
+ *
+ * @brief One convert request, counted down by its files as they complete.
+ */
+struct ConversionDaemon::Job
+{
+    uint64_t                        id;
+    std::shared_ptr<Connection>     connection;
+    std::shared_ptr<EncodeManifest> manifest;
+    size_t                          skipped;
+    std::atomic<size_t>             remaining;
+    std::atomic<size_t>             converted {};
+    std::atomic<size_t>             failed {};
+};
+
+#ifndef _WIN32
+
+ConversionDaemon::ConversionDaemon(
+    const std::filesystem::path &       socket_path,
+    ThreadPool &                        pool,
+    const std::vector<EncodingProfile> &profiles,
+    uint64_t                            max_memory,
+    std::chrono::milliseconds           timeout,
+    const CancellationToken *           shutdown)
+    : m_socket_path(socket_path)
+    , m_pool(pool)
+    , m_profiles(profiles)
+    , m_settings(WavefileConversionTask::encoder_settings(profiles))
+    , m_timeout(timeout)
+    , m_shutdown(shutdown)
+{
+    if (max_memory > 0)
+        m_admission.emplace(m_pool, max_memory, m_pool.size());
+
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    const auto name    = socket_path.string();
+    if (name.size() >= sizeof(address.sun_path))
+        throw std::system_error(
+            std::make_error_code(std::errc::filename_too_long),
+            "Socket path " + name);
+    std::memcpy(address.sun_path, name.c_str(), name.size() + 1);
+
+    // a socket file nobody accepts on is left over from a crashed daemon.
+    std::error_code error;
+    if (std::filesystem::is_socket(socket_path, error))
+    {
+        const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        const bool in_use =
+            probe >= 0
+            && ::connect(probe,
+                         reinterpret_cast<const sockaddr *>(&address),
+                         sizeof(address))
+                   == 0;
+        if (probe >= 0)
+            ::close(probe);
+        if (in_use)
+            throw std::system_error(
+                std::make_error_code(std::errc::address_in_use),
+                "Another daemon listens on " + name);
+        std::filesystem::remove(socket_path, error);
+    }
+
+    m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listen_fd < 0)
+        throw last_error("Creating the socket failed");
+
+    if (::bind(m_listen_fd,
+               reinterpret_cast<const sockaddr *>(&address),
+               sizeof(address))
+            != 0
+        || ::listen(m_listen_fd, SOMAXCONN) != 0)
+    {
+        const auto bind_error = last_error(("Listening on " + name).c_str());
+        ::close(m_listen_fd);
+        throw bind_error;
+    }
+
+    if (::pipe(m_wake_fds) != 0)
+    {
+        const auto pipe_error = last_error("Creating the wake pipe failed");
+        ::close(m_listen_fd);
+        std::filesystem::remove(socket_path, error);
+        throw pipe_error;
+    }
+}
+
+ConversionDaemon::~ConversionDaemon()
+{
+    ::close(m_listen_fd);
+    ::close(m_wake_fds[0]);
+    ::close(m_wake_fds[1]);
+
+    std::error_code error;
+    std::filesystem::remove(m_socket_path, error);
+}
+
+void ConversionDaemon::serve()
+{
+    while (!m_stopping)
+    {
+        pollfd waiting[2] = {{m_listen_fd, POLLIN, 0},
+                             {m_wake_fds[0], POLLIN, 0}};
+        if (::poll(waiting, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Waiting for clients failed: "
+                             + std::string(std::strerror(errno)) + "\n";
+            break;
+        }
+        if (waiting[1].revents != 0)
+            break;
+
+        const int fd = ::accept(m_listen_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+
+        auto connection = std::make_shared<Connection>(fd);
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            m_connections.insert(connection.get());
+        }
+        std::thread(&ConversionDaemon::serve_connection, this, connection)
+            .detach();
+    }
+
+    // clients may keep their side open, stop() ends their reads.
+    stop();
+
+    std::unique_lock<std::mutex> lock(m_connections_mutex);
+    m_connections_done.wait(lock, [this] { return m_connections.empty(); });
+}
+
+void ConversionDaemon::stop()
+{
+    if (m_stopping.exchange(true))
+        return;
+
+    const char wake = 1;
+    while (::write(m_wake_fds[1], &wake, 1) < 0 && errno == EINTR)
+    {
+    }
+
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    for (auto *connection : m_connections)
+        ::shutdown(connection->fd, SHUT_RD);
+}
+
+void ConversionDaemon::serve_connection(std::shared_ptr<Connection> connection)
+{
+    std::string pending;
+    char        chunk[4096];
+    for (;;)
+    {
+        const auto n = ::recv(connection->fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        pending.append(chunk, static_cast<size_t>(n));
+
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos)
+        {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                handle_request(connection, line);
+        }
+
+        if (pending.size() > max_request_bytes)
+        {
+            connection->send("error\tRequest line too long.");
+            break;
+        }
+    }
+
+    // every job answers on this connection before it is closed.
+    connection->wait_for_jobs();
+
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    m_connections.erase(connection.get());
+    m_connections_done.notify_all();
+}
+
+#else
+
+ConversionDaemon::ConversionDaemon(
+    const std::filesystem::path &       socket_path,
+    ThreadPool &                        pool,
+    const std::vector<EncodingProfile> &profiles,
+    uint64_t,
+    std::chrono::milliseconds timeout,
+    const CancellationToken * shutdown)
+    : m_socket_path(socket_path)
+    , m_pool(pool)
+    , m_profiles(profiles)
+    , m_settings(WavefileConversionTask::encoder_settings(profiles))
+    , m_timeout(timeout)
+    , m_shutdown(shutdown)
+{
+    throw std::system_error(std::make_error_code(std::errc::not_supported),
+                            "The daemon needs Unix sockets");
+}
+
+ConversionDaemon::~ConversionDaemon() = default;
+
+void ConversionDaemon::serve()
+{
+}
+
+void ConversionDaemon::stop()
+{
+}
+
+void ConversionDaemon::serve_connection(std::shared_ptr<Connection>)
+{
+}
+
+#endif
+
+void ConversionDaemon::handle_request(
+    const std::shared_ptr<Connection> &connection,
+    const std::string &                line)
+{
+    const auto fields = split_fields(line);
+
+    if (fields[0] == "ping" && fields.size() == 1)
+    {
+        connection->send("pong");
+    }
+    else if (fields[0] == "shutdown" && fields.size() == 1)
+    {
+        connection->send("stopping");
+        stop();
+    }
+    else if (fields[0] == "convert")
+    {
+        try
+        {
+            submit_job(connection, fields);
+        }
+        catch (const std::exception &e)
+        {
+            connection->send("error\t" + one_line(e.what()));
+        }
+    }
+    else
+    {
+        connection->send("error\tUnknown request " + one_line(fields[0]) + ".");
+    }
+}
+
+void ConversionDaemon::submit_job(const std::shared_ptr<Connection> &connection,
+                                  const std::vector<std::string> &   fields)
+{
+    namespace fs = std::filesystem;
+
+    if (fields.size() < 2 || fields[1].empty())
+        throw std::runtime_error("convert needs a path.");
+
+    bool recursive   = false;
+    bool incremental = false;
+    for (size_t i = 2; i < fields.size(); ++i)
+    {
+        if (fields[i] == "recursive")
+            recursive = true;
+        else if (fields[i] == "incremental")
+            incremental = true;
+        else
+            throw std::runtime_error("Unknown setting " + fields[i] + ".");
+    }
+
+    // the found files start with the root as spelled here, so they are
+    // found in its manifest whichever way the client named the folder. A
+    // linked file keeps its name, its mp3 goes next to the link.
+    const fs::path        path(fields[1]);
+    std::vector<fs::path> files;
+    fs::path              root;
+    if (fs::is_directory(path))
+    {
+        root  = canonical_folder(path);
+        files = find_wav_files(root, recursive);
+    }
+    else if (fs::is_regular_file(path))
+    {
+        const auto folder = path.parent_path();
+        root              = canonical_folder(folder.empty() ? "." : folder);
+        files             = {root / path.filename()};
+    }
+    else
+    {
+        throw std::runtime_error("No such file or folder " + path.string()
+                                 + ".");
+    }
+
+    auto job        = std::make_shared<Job>();
+    job->id         = m_next_job_id++;
+    job->connection = connection;
+    job->skipped    = 0;
+
+    if (incremental)
+    {
+        job->manifest = manifest_of(root);
+        std::vector<fs::path> stale;
+        for (auto &file : files)
+        {
+            if (job->manifest->is_up_to_date(file, m_settings, m_profiles))
+                ++job->skipped;
+            else
+                stale.push_back(std::move(file));
+        }
+        files = std::move(stale);
+    }
+
+    const auto id = std::to_string(job->id);
+    connection->send("queued\t" + id + "\t" + std::to_string(files.size()));
+    if (files.empty())
+    {
+        connection->send("done\t" + id + "\t0\t0\t"
+                         + std::to_string(job->skipped));
+        return;
+    }
+
+    job->remaining = files.size();
+    connection->job_started();
+
+    for (auto &file : files)
+    {
+        const uint64_t peak_bytes =
+            m_admission ? WavefileConversionTask::estimated_peak_memory(
+                file, m_profiles)
+                        : 0;
+        auto convert = [this, job, file = std::move(file)] {
+            // the deadline counts from the start, not from queueing.
+            CancellationToken token(m_shutdown, m_timeout);
+            CancellationScope cancellation(&token);
+            try
+            {
+                const bool success =
+                    job->manifest
+                        ? convert_incrementally(
+                            file, *job->manifest, m_settings, m_profiles)
+                        : convert_file(file, m_profiles);
+                finish_file(job, file, success, "Conversion failed.");
+            }
+            catch (const std::exception &e)
+            {
+                finish_file(job, file, false, e.what());
+            }
+            return true;
+        };
+
+        // the future is not needed, neither kind blocks on destruction.
+        if (m_admission)
+            m_admission->submit(peak_bytes, std::move(convert));
+        else
+            m_pool.submit(std::move(convert));
+    }
+}
+
+void ConversionDaemon::finish_file(const std::shared_ptr<Job> &job,
+                                   const std::filesystem::path &file,
+                                   bool                         success,
+                                   const std::string &          message)
+{
+    const auto id = std::to_string(job->id);
+    if (success)
+    {
+        ++job->converted;
+        job->connection->send("file\t" + id + "\tok\t" + file.string());
+    }
+    else
+    {
+        ++job->failed;
+        job->connection->send("file\t" + id + "\tfailed\t" + file.string()
+                              + "\t" + one_line(message));
+    }
+
+    if (--job->remaining > 0)
+        return;
+
+    if (job->manifest)
+    {
+        try
+        {
+            std::lock_guard<std::mutex> lock(m_manifest_mutex);
+            job->manifest->save();
+        }
+        catch (const std::exception &e)
+        {
+            job->connection->send("error\t" + one_line(e.what()));
+        }
+    }
+
+    job->connection->send("done\t" + id + "\t"
+                          + std::to_string(job->converted.load()) + "\t"
+                          + std::to_string(job->failed.load()) + "\t"
+                          + std::to_string(job->skipped));
+    job->connection->job_done();
+}
+
+std::shared_ptr<EncodeManifest>
+ConversionDaemon::manifest_of(const std::filesystem::path &root)
+{
+    std::lock_guard<std::mutex> lock(m_manifest_mutex);
+    auto &manifest = m_manifests[root];
+    if (!manifest)
+        manifest = std::make_shared<EncodeManifest>(root);
+    return manifest;
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,327 @@
+#include "Deinterleave.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_IX86)               \
+    || defined(__SSE2__)
+#    define MP3_CONVERTER_X86 1
+#    include <emmintrin.h>
+#    if defined(__GNUC__) || defined(__clang__)
+// AVX2 kernels are compiled with a target attribute and only called after a
+// runtime check, so the binary still runs on machines without AVX2.
+#        define MP3_CONVERTER_AVX2 1
+#        include <immintrin.h>
+#    endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#    define MP3_CONVERTER_NEON 1
+#    include <arm_neon.h>
+#endif
+
+namespace {
+
+/**
+ * @brief Scalar tail loop, also the whole kernel where no vector extension is
+ * available. memcpy keeps it free of aliasing UB for any sample type.
+ */
+template<size_t Size>
+void deinterleave_scalar(const char *in, char *l, char *r, size_t num_frames)
+{
+    for (size_t i = 0; i < num_frames; ++i)
+    {
+        std::memcpy(l + i * Size, in + 2 * i * Size, Size);
+        std::memcpy(r + i * Size, in + (2 * i + 1) * Size, Size);
+    }
+}
+
+#ifdef MP3_CONVERTER_X86
+
+void deinterleave_16_sse2(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 8 <= num_frames; i += 8)
+    {
+        const __m128i a = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i * 4));
+        const __m128i b = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i * 4 + 16));
+
+        // sign extend the low (left) and high (right) halves of every 32 bit
+        // frame, then pack them back to 16 bits, which can not saturate.
+        const __m128i left = _mm_packs_epi32(
+            _mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+            _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        const __m128i right =
+            _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(l + i * 2), left);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(r + i * 2), right);
+    }
+    deinterleave_scalar<2>(in + i * 4, l + i * 2, r + i * 2, num_frames - i);
+}
+
+void deinterleave_32_sse2(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 4 <= num_frames; i += 4)
+    {
+        // shuffles move bit patterns untouched, also for NaN floats.
+        const __m128 a = _mm_castsi128_ps(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i * 8)));
+        const __m128 b = _mm_castsi128_ps(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i * 8 + 16)));
+
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(l + i * 4),
+            _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i *>(r + i * 4),
+            _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+    deinterleave_scalar<4>(in + i * 8, l + i * 4, r + i * 4, num_frames - i);
+}
+
+void deinterleave_64_sse2(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 2 <= num_frames; i += 2)
+    {
+        const __m128i a = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i * 16));
+        const __m128i b = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + i * 16 + 16));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(l + i * 8),
+                         _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(r + i * 8),
+                         _mm_unpackhi_epi64(a, b));
+    }
+    deinterleave_scalar<8>(in + i * 16, l + i * 8, r + i * 8, num_frames - i);
+}
+
+#endif // MP3_CONVERTER_X86
+
+#ifdef MP3_CONVERTER_AVX2
+
+// AVX2 shuffles and packs work within 128 bit lanes, the final 64 bit
+// permutation with 0xD8 (0, 2, 1, 3) restores the sample order.
+
+__attribute__((target("avx2"))) void
+deinterleave_16_avx2(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 16 <= num_frames; i += 16)
+    {
+        const __m256i a = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(in + i * 4));
+        const __m256i b = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(in + i * 4 + 32));
+
+        const __m256i left = _mm256_packs_epi32(
+            _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16),
+            _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+        const __m256i right = _mm256_packs_epi32(_mm256_srai_epi32(a, 16),
+                                                 _mm256_srai_epi32(b, 16));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(l + i * 2),
+                            _mm256_permute4x64_epi64(left, 0xD8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(r + i * 2),
+                            _mm256_permute4x64_epi64(right, 0xD8));
+    }
+    deinterleave_16_sse2(in + i * 4, l + i * 2, r + i * 2, num_frames - i);
+}
+
+__attribute__((target("avx2"))) void
+deinterleave_32_avx2(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 8 <= num_frames; i += 8)
+    {
+        const __m256 a = _mm256_castsi256_ps(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(in + i * 8)));
+        const __m256 b = _mm256_castsi256_ps(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(in + i * 8 + 32)));
+
+        const __m256i left = _mm256_castps_si256(
+            _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m256i right = _mm256_castps_si256(
+            _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(l + i * 4),
+                            _mm256_permute4x64_epi64(left, 0xD8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(r + i * 4),
+                            _mm256_permute4x64_epi64(right, 0xD8));
+    }
+    deinterleave_32_sse2(in + i * 8, l + i * 4, r + i * 4, num_frames - i);
+}
+
+__attribute__((target("avx2"))) void
+deinterleave_64_avx2(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 4 <= num_frames; i += 4)
+    {
+        const __m256i a = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(in + i * 16));
+        const __m256i b = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(in + i * 16 + 32));
+
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(l + i * 8),
+            _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8));
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(r + i * 8),
+            _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xD8));
+    }
+    deinterleave_64_sse2(in + i * 16, l + i * 8, r + i * 8, num_frames - i);
+}
+
+#endif // MP3_CONVERTER_AVX2
+
+#ifdef MP3_CONVERTER_NEON
+
+// vld2 loads and deinterleaves in one instruction.
+
+void deinterleave_16_neon(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 8 <= num_frames; i += 8)
+    {
+        const int16x8x2_t v =
+            vld2q_s16(reinterpret_cast<const int16_t *>(in + i * 4));
+        vst1q_s16(reinterpret_cast<int16_t *>(l + i * 2), v.val[0]);
+        vst1q_s16(reinterpret_cast<int16_t *>(r + i * 2), v.val[1]);
+    }
+    deinterleave_scalar<2>(in + i * 4, l + i * 2, r + i * 2, num_frames - i);
+}
+
+void deinterleave_32_neon(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 4 <= num_frames; i += 4)
+    {
+        const int32x4x2_t v =
+            vld2q_s32(reinterpret_cast<const int32_t *>(in + i * 8));
+        vst1q_s32(reinterpret_cast<int32_t *>(l + i * 4), v.val[0]);
+        vst1q_s32(reinterpret_cast<int32_t *>(r + i * 4), v.val[1]);
+    }
+    deinterleave_scalar<4>(in + i * 8, l + i * 4, r + i * 4, num_frames - i);
+}
+
+void deinterleave_64_neon(const char *in, char *l, char *r, size_t num_frames)
+{
+    size_t i = 0;
+    for (; i + 2 <= num_frames; i += 2)
+    {
+        const int64x2_t a =
+            vld1q_s64(reinterpret_cast<const int64_t *>(in + i * 16));
+        const int64x2_t b =
+            vld1q_s64(reinterpret_cast<const int64_t *>(in + i * 16 + 16));
+        vst1q_s64(reinterpret_cast<int64_t *>(l + i * 8),
+                  vcombine_s64(vget_low_s64(a), vget_low_s64(b)));
+        vst1q_s64(reinterpret_cast<int64_t *>(r + i * 8),
+                  vcombine_s64(vget_high_s64(a), vget_high_s64(b)));
+    }
+    deinterleave_scalar<8>(in + i * 16, l + i * 8, r + i * 8, num_frames - i);
+}
+
+#endif // MP3_CONVERTER_NEON
+
+using Kernel = void (*)(const char *, char *, char *, size_t);
+
+/**
+ * @struct KernelSet
+ *
+ * @brief The kernels for 2, 4 and 8 byte samples of one vector extension.
+ */
+struct KernelSet
+{
+    const char *name;
+    Kernel      size_2;
+    Kernel      size_4;
+    Kernel      size_8;
+};
+
+KernelSet select_kernels()
+{
+#if defined(MP3_CONVERTER_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2",
+                deinterleave_16_avx2,
+                deinterleave_32_avx2,
+                deinterleave_64_avx2};
+#endif
+#if defined(MP3_CONVERTER_X86)
+    return {"sse2",
+            deinterleave_16_sse2,
+            deinterleave_32_sse2,
+            deinterleave_64_sse2};
+#elif defined(MP3_CONVERTER_NEON)
+    return {"neon",
+            deinterleave_16_neon,
+            deinterleave_32_neon,
+            deinterleave_64_neon};
+#else
+    return {"scalar",
+            deinterleave_scalar<2>,
+            deinterleave_scalar<4>,
+            deinterleave_scalar<8>};
+#endif
+}
+
+const KernelSet &kernels()
+{
+    // thread safe initialization, the cpu check runs once.
+    static const KernelSet selected = select_kernels();
+    return selected;
+}
+
+Kernel pick(const KernelSet &set, size_t sample_size)
+{
+    switch (sample_size)
+    {
+    case 2: return set.size_2;
+    case 4: return set.size_4;
+    case 8: return set.size_8;
+    default: return nullptr;
+    }
+}
+
+} // namespace
+
+namespace mp3_converter {
+
+void deinterleave_stereo(const void *interleaved,
+                         void *      left,
+                         void *      right,
+                         size_t      num_frames,
+                         size_t      sample_size)
+{
+    pick(kernels(), sample_size)(static_cast<const char *>(interleaved),
+                                 static_cast<char *>(left),
+                                 static_cast<char *>(right),
+                                 num_frames);
+}
+
+void deinterleave_stereo_scalar(const void *interleaved,
+                                void *      left,
+                                void *      right,
+                                size_t      num_frames,
+                                size_t      sample_size)
+{
+    const KernelSet scalar {"scalar",
+                            deinterleave_scalar<2>,
+                            deinterleave_scalar<4>,
+                            deinterleave_scalar<8>};
+    pick(scalar, sample_size)(static_cast<const char *>(interleaved),
+                              static_cast<char *>(left),
+                              static_cast<char *>(right),
+                              num_frames);
+}
+
+const char *deinterleave_kernel_name()
+{
+    return kernels().name;
+}
+
+} // namespace mp3_converter
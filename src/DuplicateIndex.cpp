@@ -0,0 +1,122 @@
+#include "DuplicateIndex.h"
+
+#include "Cancellation.h"
+#include "EncodeManifest.h"
+#include "ThreadPool.h"
+#include "WavefileReader.h"
+
+#include <chrono>
+
+namespace {
+// how often a file waiting for the encode of its payload checks whether it
+// was cancelled.
+constexpr std::chrono::milliseconds cancel_poll_period(100);
+} // namespace
+
+namespace mp3_converter {
+
+bool DuplicateIndex::PayloadKey::operator==(const PayloadKey &other) const
+{
+    return data_hash == other.data_hash && data_size == other.data_size
+           && sample_format == other.sample_format
+           && num_channels == other.num_channels
+           && sample_rate == other.sample_rate
+           && block_align == other.block_align
+           && bits_per_sample == other.bits_per_sample
+           && channel_mask == other.channel_mask;
+}
+
+DuplicateIndex::PayloadKey
+DuplicateIndex::payload_key(const std::filesystem::path &wav_file,
+                            std::optional<uint64_t>      data_hash)
+{
+    auto        reader = open_wavefile(wav_file);
+    const auto &layout = reader->layout();
+
+    PayloadKey key;
+    key.data_hash       = data_hash ? *data_hash : hash_wave_data(*reader);
+    key.data_size       = layout.data_size;
+    key.sample_format   = layout.sample_format;
+    key.num_channels    = layout.format.NumChannels;
+    key.sample_rate     = layout.format.SampleRate;
+    key.block_align     = layout.format.BlockAlign;
+    key.bits_per_sample = layout.format.BitsPerSample;
+    key.channel_mask    = layout.channel_mask;
+    return key;
+}
+
+std::optional<std::filesystem::path>
+DuplicateIndex::claim(const PayloadKey &key)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        auto &payload = m_payloads[key];
+        if (!payload.encoded.empty())
+            return payload.encoded;
+        if (!payload.encoding)
+        {
+            payload.encoding = true;
+            return std::nullopt;
+        }
+
+        // on a worker, help with sub-jobs while waiting, often the fan-out or
+        // segments of the file encoding this payload. They check their own
+        // tokens, not the one of the file waiting here.
+        bool helped = false;
+        if (auto *pool = ThreadPool::current())
+        {
+            lock.unlock();
+            {
+                CancellationScope no_cancellation(nullptr);
+                helped = pool->help_nested();
+            }
+            lock.lock();
+        }
+        if (!helped)
+            m_finished.wait_for(lock, cancel_poll_period);
+        throw_if_cancelled();
+    }
+}
+
+void DuplicateIndex::finished(const PayloadKey &           key,
+                              const std::filesystem::path &file,
+                              bool                         converted)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &                      payload = m_payloads[key];
+        payload.encoding                    = false;
+        if (converted)
+            payload.encoded = file;
+    }
+    m_finished.notify_all();
+}
+
+void DuplicateIndex::count_duplicate(uint64_t wav_bytes, uint64_t mp3_bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_duplicates;
+    m_wav_bytes += wav_bytes;
+    m_mp3_bytes += mp3_bytes;
+}
+
+size_t DuplicateIndex::duplicates() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_duplicates;
+}
+
+uint64_t DuplicateIndex::wav_bytes_saved() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_wav_bytes;
+}
+
+uint64_t DuplicateIndex::mp3_bytes_shared() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_mp3_bytes;
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,211 @@
+#include "EncodeManifest.h"
+
+#include "ContentHash.h"
+#include "WavefileConversionTask.h"
+#include "WavefileReader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace mp3_converter {
+
+namespace {
+// first line of the file, bumped whenever the line format changes.
+constexpr const char *manifest_header = "mp3_converter manifest 1";
+
+// bytes of the data chunk hashed per block.
+constexpr size_t hash_block_size = 1024 * 1024;
+
+/**
+ * @brief Parse one entry line: size, mtime, hash, settings and the key,
+ * separated by tabs. The key comes last, so it may contain anything but a
+ * line break.
+ */
+bool parse_entry(const std::string &line, std::string &key, ManifestEntry &entry)
+{
+    std::vector<std::string> fields;
+    size_t                   start = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        const auto tab = line.find('\t', start);
+        if (tab == std::string::npos)
+            return false;
+        fields.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    key = line.substr(start);
+    if (key.empty())
+        return false;
+
+    try
+    {
+        size_t end = 0;
+        entry.stamp.size = std::stoull(fields[0], &end);
+        if (end != fields[0].size())
+            return false;
+        entry.stamp.mtime = std::stoll(fields[1], &end);
+        if (end != fields[1].size())
+            return false;
+        entry.data_hash = std::stoull(fields[2], &end, 16);
+        if (end != fields[2].size())
+            return false;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+    entry.settings = fields[3];
+    return true;
+}
+} // namespace
+
+std::optional<FileStamp> stamp_of(const std::filesystem::path &file)
+{
+    std::error_code error;
+    const auto      size = std::filesystem::file_size(file, error);
+    if (error)
+        return std::nullopt;
+    const auto mtime = std::filesystem::last_write_time(file, error);
+    if (error)
+        return std::nullopt;
+
+    return FileStamp {static_cast<uint64_t>(size),
+                      static_cast<int64_t>(mtime.time_since_epoch().count())};
+}
+
+uint64_t hash_wave_data(const std::filesystem::path &wav_file)
+{
+    return hash_wave_data(*open_wavefile(wav_file));
+}
+
+uint64_t hash_wave_data(WavefileReader &reader)
+{
+    ContentHash hash;
+    for (uint64_t left = reader.layout().data_size; left > 0;)
+    {
+        const auto block =
+            static_cast<size_t>(std::min<uint64_t>(left, hash_block_size));
+        hash.update(reader.next_block(block, 1), block);
+        left -= block;
+    }
+    return hash.digest();
+}
+
+EncodeManifest::EncodeManifest(const std::filesystem::path &root)
+    : m_root(root)
+{
+    std::ifstream in(m_root / file_name);
+    std::string   line;
+    if (!in || !std::getline(in, line) || line != manifest_header)
+        return;
+
+    while (std::getline(in, line))
+    {
+        std::string   key;
+        ManifestEntry entry;
+        if (parse_entry(line, key, entry))
+            m_entries[key] = std::move(entry);
+    }
+}
+
+std::optional<ManifestEntry>
+EncodeManifest::find(const std::filesystem::path &file) const
+{
+    const auto                  key = key_of(file);
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return std::nullopt;
+    return it->second;
+}
+
+void EncodeManifest::record(const std::filesystem::path &file,
+                            ManifestEntry                entry)
+{
+    auto                        key = key_of(file);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[std::move(key)] = std::move(entry);
+}
+
+void EncodeManifest::forget(const std::filesystem::path &file)
+{
+    const auto                  key = key_of(file);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.erase(key);
+}
+
+bool EncodeManifest::is_up_to_date(
+    const std::filesystem::path &       file,
+    const std::string &                 settings,
+    const std::vector<EncodingProfile> &profiles) const
+{
+    const auto entry = find(file);
+    if (!entry || entry->settings != settings)
+        return false;
+
+    const auto stamp = stamp_of(file);
+    if (!stamp || !(*stamp == entry->stamp))
+        return false;
+
+    return WavefileConversionTask::outputs_exist(file, profiles);
+}
+
+void EncodeManifest::save() const
+{
+    const auto manifest  = m_root / file_name;
+    auto       temporary = manifest;
+    temporary += ".tmp";
+
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        out << manifest_header << '\n';
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // sorted, so manifests of the same tree compare equal.
+        std::vector<const std::pair<const std::string, ManifestEntry> *> sorted;
+        for (const auto &item : m_entries)
+            sorted.push_back(&item);
+        std::sort(sorted.begin(), sorted.end(), [](auto lhs, auto rhs) {
+            return lhs->first < rhs->first;
+        });
+
+        for (const auto *item : sorted)
+        {
+            const auto &[key, entry] = *item;
+
+            // such names could not be read back, encode them every time.
+            if (key.find('\n') != std::string::npos
+                || entry.settings.find('\t') != std::string::npos)
+                continue;
+
+            out << entry.stamp.size << '\t' << entry.stamp.mtime << '\t'
+                << ContentHash::to_hex(entry.data_hash) << '\t'
+                << entry.settings << '\t' << key << '\n';
+        }
+
+        out.flush();
+        if (!out)
+            throw std::runtime_error("Could not write manifest "
+                                     + temporary.string());
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, manifest, error);
+    if (error)
+    {
+        std::filesystem::remove(temporary, error);
+        throw std::runtime_error("Could not replace manifest "
+                                 + manifest.string());
+    }
+}
+
+std::string EncodeManifest::key_of(const std::filesystem::path &file) const
+{
+    return file.lexically_relative(m_root).generic_string();
+}
+
+} // namespace mp3_converter
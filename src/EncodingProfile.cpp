@@ -0,0 +1,78 @@
+#include "EncodingProfile.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+
+namespace {
+// the bitrates MPEG-1, -2 and -2.5 layer III frames can carry.
+constexpr std::array<int, 18> valid_bitrates {
+    8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 192, 224, 256,
+    320};
+
+constexpr char mono_suffix[] = "-mono";
+} // namespace
+
+namespace mp3_converter {
+
+EncodingProfile EncodingProfile::parse(const std::string &text)
+{
+    std::string lower = text;
+    std::transform(lower.begin(),
+                   lower.end(),
+                   lower.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+
+    EncodingProfile profile;
+
+    const std::string suffix(mono_suffix);
+    if (lower.size() > suffix.size()
+        && lower.compare(lower.size() - suffix.size(), suffix.size(), suffix)
+               == 0)
+    {
+        profile.mono = true;
+        lower.erase(lower.size() - suffix.size());
+    }
+
+    const auto all_digits = [](const std::string &digits) {
+        const auto is_digit = [](unsigned char c) { return std::isdigit(c); };
+        return !digits.empty() && digits.size() <= 3
+               && std::all_of(digits.begin(), digits.end(), is_digit);
+    };
+
+    if (lower.size() == 2 && lower[0] == 'v' && all_digits(lower.substr(1)))
+    {
+        profile.vbr_quality = lower[1] - '0';
+        profile.name        = "V" + lower.substr(1);
+    }
+    else if (lower.size() > 1 && lower.back() == 'k'
+             && all_digits(lower.substr(0, lower.size() - 1)))
+    {
+        profile.bitrate_kbps = std::stoi(lower.substr(0, lower.size() - 1));
+        if (std::find(valid_bitrates.begin(),
+                      valid_bitrates.end(),
+                      profile.bitrate_kbps)
+            == valid_bitrates.end())
+            throw std::invalid_argument("No mp3 bitrate: " + text + ".");
+        profile.name = std::to_string(profile.bitrate_kbps) + "k";
+    }
+    else
+    {
+        throw std::invalid_argument(
+            "Invalid profile " + text
+            + ", expected V0 to V9 or a bitrate such as 128k, optionally "
+              "followed by -mono.");
+    }
+
+    if (profile.mono)
+        profile.name += mono_suffix;
+    return profile;
+}
+
+const std::vector<EncodingProfile> &default_profiles()
+{
+    static const std::vector<EncodingProfile> defaults {EncodingProfile {}};
+    return defaults;
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,185 @@
+#include "FileConversion.h"
+
+#include "ByteSink.h"
+#include "WavefileConversionTask.h"
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <system_error>
+
+namespace mp3_converter {
+
+bool has_wav_extension(const std::filesystem::path &file)
+{
+    auto extension = file.extension().string();
+    std::transform(extension.begin(),
+                   extension.end(),
+                   extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return extension == ".wav";
+}
+
+std::error_code for_each_wav_file(
+    const std::filesystem::path &                                      directory,
+    bool                                                               recursive,
+    const std::function<bool(const std::filesystem::directory_entry &)> &found)
+{
+    namespace fs = std::filesystem;
+
+    // the type usually comes with the directory entry, no extra stat.
+    const auto is_wav_file = [](const fs::directory_entry &entry) {
+        std::error_code type_error;
+        return entry.is_regular_file(type_error)
+               && has_wav_extension(entry.path());
+    };
+
+    std::error_code error;
+    if (!recursive)
+    {
+        for (fs::directory_iterator entry(directory, error);
+             !error && entry != fs::directory_iterator();
+             entry.increment(error))
+        {
+            if (is_wav_file(*entry) && !found(*entry))
+                break;
+        }
+        return error;
+    }
+
+    for (fs::recursive_directory_iterator entry(
+             directory, fs::directory_options::skip_permission_denied, error);
+         !error && entry != fs::recursive_directory_iterator();
+         entry.increment(error))
+    {
+        if (is_wav_file(*entry) && !found(*entry))
+            break;
+    }
+    return error;
+}
+
+std::vector<std::filesystem::path>
+find_wav_files(const std::filesystem::path &directory, bool recursive)
+{
+    std::vector<std::filesystem::path> files;
+    const auto                         error = for_each_wav_file(
+        directory, recursive, [&](const std::filesystem::directory_entry &entry) {
+            files.push_back(entry.path());
+            return true;
+        });
+    if (error && files.empty())
+        throw std::filesystem::filesystem_error(
+            "Scanning failed", directory, error);
+
+    return files;
+}
+
+bool convert_file(const std::filesystem::path &       file,
+                  const std::vector<EncodingProfile> &profiles)
+{
+    WavefileConversionTask task(file, profiles);
+    return task.run();
+}
+
+bool convert_deduplicated(const std::filesystem::path &       file,
+                          DuplicateIndex &                    duplicates,
+                          const std::vector<EncodingProfile> &profiles,
+                          std::optional<uint64_t>             data_hash)
+{
+    namespace fs = std::filesystem;
+
+    const auto key = DuplicateIndex::payload_key(file, data_hash);
+    if (const auto original = duplicates.claim(key))
+    {
+        try
+        {
+            uint64_t shared_bytes = 0;
+            for (const auto &profile : profiles)
+            {
+                const auto mp3 =
+                    WavefileConversionTask::output_file(*original, profile);
+                if (share_file(mp3, WavefileConversionTask::output_file(
+                                        file, profile))
+                    != FileCopy::copy)
+                    shared_bytes += fs::file_size(mp3);
+            }
+
+            std::error_code error;
+            const auto      wav_bytes = fs::file_size(file, error);
+            duplicates.count_duplicate(error ? 0 : wav_bytes, shared_bytes);
+            return true;
+        }
+        catch (const fs::filesystem_error &)
+        {
+            // the original's mp3s went away meanwhile, encode it after all.
+            return convert_file(file, profiles);
+        }
+    }
+
+    bool converted = false;
+    try
+    {
+        converted = convert_file(file, profiles);
+    }
+    catch (...)
+    {
+        duplicates.finished(key, file, false);
+        throw;
+    }
+    duplicates.finished(key, file, converted);
+    return converted;
+}
+
+bool convert_incrementally(const std::filesystem::path &       file,
+                           EncodeManifest &                    manifest,
+                           const std::string &                 settings,
+                           const std::vector<EncodingProfile> &profiles,
+                           DuplicateIndex *                    duplicates)
+{
+    // stat before reading, so a write during the conversion leaves an older
+    // stamp behind and the file is checked again next run.
+    const auto stamp     = stamp_of(file);
+    const auto data_hash = hash_wave_data(file);
+    const auto previous  = manifest.find(file);
+
+    if (stamp && previous && previous->settings == settings
+        && previous->data_hash == data_hash
+        && WavefileConversionTask::outputs_exist(file, profiles))
+    {
+        manifest.record(file, {*stamp, data_hash, settings});
+        return true;
+    }
+
+    // a failed conversion must not leave the old entry behind.
+    manifest.forget(file);
+    const bool converted =
+        duplicates
+            ? convert_deduplicated(file, *duplicates, profiles, data_hash)
+            : convert_file(file, profiles);
+    if (!converted)
+        return false;
+
+    if (stamp)
+        manifest.record(file, {*stamp, data_hash, settings});
+    return true;
+}
+
+size_t convert_batch(const std::vector<std::function<bool()>> &conversions)
+{
+    size_t converted = 0;
+    for (const auto &convert : conversions)
+    {
+        try
+        {
+            if (convert())
+                ++converted;
+        }
+        catch (const std::exception &)
+        {
+            // the file failed on its own, the rest of the batch goes on.
+        }
+    }
+    return converted;
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,243 @@
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#    define NOMINMAX
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace mp3_converter {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path &file)
+{
+    auto fail = [this](const char *what) {
+        const auto error = static_cast<int>(GetLastError());
+        release();
+        throw std::system_error(error, std::system_category(), what);
+    };
+
+    m_file_handle = CreateFileW(file.wstring().c_str(),
+                                GENERIC_READ,
+                                FILE_SHARE_READ,
+                                nullptr,
+                                OPEN_EXISTING,
+                                FILE_FLAG_SEQUENTIAL_SCAN,
+                                nullptr);
+    if (m_file_handle == INVALID_HANDLE_VALUE)
+    {
+        m_file_handle = nullptr;
+        fail("CreateFileW");
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(m_file_handle, &file_size))
+        fail("GetFileSizeEx");
+    if (file_size.QuadPart == 0)
+    {
+        release();
+        throw std::system_error(
+            std::make_error_code(std::errc::invalid_argument),
+            "Can not map an empty file");
+    }
+    if constexpr (sizeof(size_t) < sizeof(file_size.QuadPart))
+    {
+        // RF64 files beyond 4 GiB on 32 bit, read them as a stream instead.
+        if (static_cast<uint64_t>(file_size.QuadPart)
+            > std::numeric_limits<size_t>::max())
+        {
+            release();
+            throw std::system_error(
+                std::make_error_code(std::errc::file_too_large),
+                "File does not fit into the address space");
+        }
+    }
+
+    m_mapping_handle = CreateFileMappingW(
+        m_file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping_handle == nullptr)
+        fail("CreateFileMappingW");
+
+    const void *view =
+        MapViewOfFile(m_mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr)
+        fail("MapViewOfFile");
+
+    m_data = static_cast<const char *>(view);
+    m_size = static_cast<size_t>(file_size.QuadPart);
+}
+
+void MappedFile::advise_sequential() const
+{
+    // FILE_FLAG_SEQUENTIAL_SCAN on the handle already covers this.
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+    if (offset >= m_size)
+        return;
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<char *>(m_data) + offset;
+    range.NumberOfBytes  = std::min(length, m_size - offset);
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    // PrefetchVirtualMemory needs Windows 8, before that the sequential scan
+    // read-ahead of the file handle has to do.
+    (void)offset;
+    (void)length;
+#endif
+}
+
+void prefetch_file_head(const std::filesystem::path &, size_t)
+{
+    // no asynchronous hint for files that are not open yet.
+}
+
+void MappedFile::release() noexcept
+{
+    if (m_data != nullptr)
+        UnmapViewOfFile(m_data);
+    if (m_mapping_handle != nullptr)
+        CloseHandle(m_mapping_handle);
+    if (m_file_handle != nullptr)
+        CloseHandle(m_file_handle);
+
+    m_data           = nullptr;
+    m_size           = 0;
+    m_mapping_handle = nullptr;
+    m_file_handle    = nullptr;
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path &file)
+{
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "open");
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        const int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat");
+    }
+    if (!S_ISREG(file_stat.st_mode) || file_stat.st_size == 0)
+    {
+        close(fd);
+        throw std::system_error(
+            std::make_error_code(std::errc::invalid_argument),
+            "Can only map non-empty regular files");
+    }
+
+    if constexpr (sizeof(size_t) < sizeof(file_stat.st_size))
+    {
+        // RF64 files beyond 4 GiB on 32 bit, read them as a stream instead.
+        if (static_cast<uint64_t>(file_stat.st_size)
+            > std::numeric_limits<size_t>::max())
+        {
+            close(fd);
+            throw std::system_error(
+                std::make_error_code(std::errc::file_too_large),
+                "File does not fit into the address space");
+        }
+    }
+
+    const auto size = static_cast<size_t>(file_stat.st_size);
+    void *     map  = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int  error = errno;
+    // the mapping keeps its own reference to the file.
+    close(fd);
+    if (map == MAP_FAILED)
+        throw std::system_error(error, std::generic_category(), "mmap");
+
+    m_data = static_cast<const char *>(map);
+    m_size = size;
+}
+
+void MappedFile::advise_sequential() const
+{
+    // only a hint, a failure here costs performance, not correctness.
+    madvise(const_cast<char *>(m_data), m_size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+    if (offset >= m_size)
+        return;
+
+    // madvise wants a page aligned start, the mapping itself is.
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    const size_t start = offset - offset % page_size;
+    const size_t end   = std::min(m_size, offset + length);
+    madvise(const_cast<char *>(m_data) + start, end - start, MADV_WILLNEED);
+}
+
+void prefetch_file_head(const std::filesystem::path &file, size_t length)
+{
+#ifdef POSIX_FADV_WILLNEED
+    const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    posix_fadvise(fd, 0, static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void)file;
+    (void)length;
+#endif
+}
+
+void MappedFile::release() noexcept
+{
+    if (m_data != nullptr)
+        munmap(const_cast<char *>(m_data), m_size);
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+    release();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+#ifdef _WIN32
+        std::swap(m_file_handle, other.m_file_handle);
+        std::swap(m_mapping_handle, other.m_mapping_handle);
+#endif
+    }
+    return *this;
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,41 @@
+#include "Mp3Encoder.h"
+
+#include "ByteSink.h"
+#include "LameEncodingTask.h"
+#include "WavefileConversionTask.h"
+#include "WavefileReader.h"
+
+namespace mp3_converter {
+
+bool encode_wav(const void *           wav,
+                size_t                 size,
+                const Mp3Callback &    on_mp3,
+                const EncodingProfile &profile)
+{
+    MemoryWavefileReader reader(wav, size);
+    CallbackSink         out(on_mp3);
+    return WavefileConversionTask::convert(reader, {&out}, {profile});
+}
+
+std::vector<unsigned char> encode_wav(const void *           wav,
+                                      size_t                 size,
+                                      const EncodingProfile &profile)
+{
+    MemoryWavefileReader reader(wav, size);
+    MemorySink           out;
+    if (!WavefileConversionTask::convert(reader, {&out}, {profile}))
+        throw lame_encoding_error("Encoding the wav data failed.");
+
+    return std::move(out.bytes());
+}
+
+bool encode_wav_stream(const WavPull &        pull,
+                       const Mp3Callback &    on_mp3,
+                       const EncodingProfile &profile)
+{
+    PipeWavefileReader reader(pull);
+    CallbackSink       out(on_mp3);
+    return WavefileConversionTask::convert_stream(reader, out, profile);
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,223 @@
+#include "ProgramOptions.h"
+
+#include <cctype>
+#include <limits>
+#include <string>
+
+namespace mp3_converter {
+
+ProgramOptions parse_program_options(int argc, char *argv[])
+{
+    ProgramOptions options;
+    bool           have_directory = false;
+    bool           segmented      = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument(argv[i]);
+
+        if (argument == "-h" || argument == "--help")
+        {
+            options.show_help = true;
+        }
+        else if (argument == "-r" || argument == "--recursive")
+        {
+            options.recursive = true;
+        }
+        else if (argument == "-i" || argument == "--incremental")
+        {
+            options.incremental = true;
+        }
+        else if (argument == "--dedup")
+        {
+            options.deduplicate = true;
+        }
+        else if (argument == "--segment")
+        {
+            segmented = true;
+        }
+        else if (argument == "--adaptive")
+        {
+            options.adaptive = true;
+        }
+        else if (argument == "--stats" || argument == "--trace"
+                 || argument == "--daemon")
+        {
+            if (i + 1 >= argc)
+                throw usage_error("Option " + argument + " needs a file.");
+
+            auto &file = argument == "--stats"   ? options.stats_file
+                         : argument == "--trace" ? options.trace_file
+                                                 : options.daemon_socket;
+            file       = argv[++i];
+        }
+        else if (argument == "-p" || argument == "--profile")
+        {
+            if (i + 1 >= argc)
+                throw usage_error("Option " + argument + " needs a profile.");
+
+            try
+            {
+                const auto profile = EncodingProfile::parse(argv[++i]);
+                for (const auto &other : options.profiles)
+                {
+                    if (other.name == profile.name)
+                        throw usage_error("Profile " + profile.name
+                                          + " is given twice.");
+                }
+                options.profiles.push_back(profile);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                throw usage_error(e.what());
+            }
+        }
+        else if (argument == "--max-memory")
+        {
+            if (i + 1 >= argc)
+                throw usage_error("Option " + argument + " needs a size.");
+
+            options.max_memory = parse_byte_size(argv[++i]);
+            if (options.max_memory == 0)
+                throw usage_error("Option --max-memory needs a size above 0.");
+        }
+        else if (argument == "--timeout")
+        {
+            if (i + 1 >= argc)
+                throw usage_error("Option " + argument + " needs a duration.");
+
+            options.timeout = parse_duration(argv[++i]);
+            if (options.timeout.count() == 0)
+                throw usage_error("Option --timeout needs a duration above 0.");
+        }
+        else if (argument == "-" && !have_directory)
+        {
+            options.streaming = true;
+            have_directory    = true;
+        }
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            throw usage_error("Unknown option " + argument + ".");
+        }
+        else if (have_directory)
+        {
+            throw usage_error("Too many parameters!");
+        }
+        else
+        {
+            options.directory = argument;
+            have_directory    = true;
+        }
+    }
+
+    const bool daemon = !options.daemon_socket.empty();
+    if (daemon && have_directory)
+        throw usage_error("Option --daemon takes no folder, jobs name theirs.");
+    if (daemon && (options.recursive || options.incremental))
+        throw usage_error(
+            "Options -r and -i are given per job in daemon mode.");
+    if (daemon && options.deduplicate)
+        throw usage_error("Option --dedup needs a folder.");
+
+    if (!have_directory && !daemon)
+        options.show_help = true;
+
+    if (options.streaming
+        && (options.recursive || options.incremental || options.deduplicate
+            || segmented))
+        throw usage_error(
+            "Options -r, -i, --dedup and --segment need a folder, not a "
+            "stream.");
+    if (options.streaming && options.profiles.size() > 1)
+        throw usage_error("A stream is encoded with a single profile.");
+
+    if (options.profiles.empty())
+        options.profiles = default_profiles();
+    for (auto &profile : options.profiles)
+        profile.segmented = segmented;
+
+    return options;
+}
+
+uint64_t parse_byte_size(const std::string &text)
+{
+    const auto malformed = [&] {
+        return usage_error("Invalid size " + text
+                           + ", expected a number with optional K, M, G, T.");
+    };
+
+    size_t   end   = 0;
+    uint64_t value = 0;
+    for (; end < text.size()
+           && std::isdigit(static_cast<unsigned char>(text[end]));
+         ++end)
+    {
+        const unsigned digit = static_cast<unsigned>(text[end] - '0');
+        if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+            throw malformed();
+        value = value * 10 + digit;
+    }
+    if (end == 0)
+        throw malformed();
+
+    std::string suffix;
+    for (size_t i = end; i < text.size(); ++i)
+        suffix += static_cast<char>(
+            std::toupper(static_cast<unsigned char>(text[i])));
+
+    unsigned shift = 0;
+    if (!suffix.empty() && suffix != "B")
+    {
+        const std::string units = "KMGT";
+        const auto        unit  = units.find(suffix[0]);
+        const std::string rest  = suffix.substr(1);
+        if (unit == std::string::npos
+            || !(rest.empty() || rest == "B" || rest == "IB"))
+            throw malformed();
+        shift = 10 * static_cast<unsigned>(unit + 1);
+    }
+
+    if (shift > 0 && value > (std::numeric_limits<uint64_t>::max() >> shift))
+        throw malformed();
+    return value << shift;
+}
+
+std::chrono::milliseconds parse_duration(const std::string &text)
+{
+    const auto malformed = [&] {
+        return usage_error("Invalid duration " + text
+                           + ", expected a number with optional ms, s, m, h.");
+    };
+
+    size_t   end   = 0;
+    uint64_t value = 0;
+    for (; end < text.size()
+           && std::isdigit(static_cast<unsigned char>(text[end]));
+         ++end)
+    {
+        const unsigned digit = static_cast<unsigned>(text[end] - '0');
+        if (value > (std::numeric_limits<uint32_t>::max() - digit) / 10)
+            throw malformed();
+        value = value * 10 + digit;
+    }
+    if (end == 0)
+        throw malformed();
+
+    const std::string suffix = text.substr(end);
+    uint64_t          scale  = 0;
+    if (suffix == "ms")
+        scale = 1;
+    else if (suffix.empty() || suffix == "s")
+        scale = 1000;
+    else if (suffix == "m")
+        scale = 60 * 1000;
+    else if (suffix == "h")
+        scale = 60 * 60 * 1000;
+    else
+        throw malformed();
+
+    // below 2^32 times an hour, so no overflow.
+    return std::chrono::milliseconds(value * scale);
+}
+
+} // namespace mp3_converter
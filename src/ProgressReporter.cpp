@@ -0,0 +1,184 @@
+#include "ProgressReporter.h"
+
+#include <cstdio>
+#include <iostream>
+
+namespace {
+std::atomic<uint64_t> input_bytes_total {};
+std::atomic<uint64_t> input_audio_us {};
+
+std::atomic<mp3_converter::ProgressReporter *> active {nullptr};
+
+// how often queued lines are printed and the progress line redrawn.
+constexpr std::chrono::milliseconds refresh_period(200);
+
+uint64_t audio_us()
+{
+    return input_audio_us.load(std::memory_order_relaxed);
+}
+} // namespace
+
+namespace mp3_converter {
+
+ProgressReporter::ProgressReporter(std::ostream &out, bool live_line)
+    : m_out(out)
+    , m_live_line(live_line)
+    , m_start(std::chrono::steady_clock::now())
+    , m_start_bytes(input_bytes())
+    , m_start_audio_us(audio_us())
+{
+    active.store(this, std::memory_order_release);
+    m_thread = std::thread(&ProgressReporter::run, this);
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    ProgressReporter *self = this;
+    active.compare_exchange_strong(self, nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void ProgressReporter::expect(size_t files, uint64_t bytes)
+{
+    m_expected_files.fetch_add(files, std::memory_order_relaxed);
+    m_expected_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ProgressReporter::file_done(std::string line, bool success)
+{
+    m_events.push({std::move(line), true, success});
+}
+
+void ProgressReporter::log(std::string line)
+{
+    if (auto *reporter = active.load(std::memory_order_acquire))
+        reporter->m_events.push({std::move(line), false, true});
+    else
+        // one string per write, so lines of other threads do not cut in.
+        std::cout << line + "\n";
+}
+
+void ProgressReporter::count_input(uint64_t bytes,
+                                   uint64_t frames,
+                                   uint32_t sample_rate)
+{
+    input_bytes_total.fetch_add(bytes, std::memory_order_relaxed);
+    if (sample_rate > 0)
+        input_audio_us.fetch_add(frames * 1000000 / sample_rate,
+                                 std::memory_order_relaxed);
+}
+
+uint64_t ProgressReporter::input_bytes()
+{
+    return input_bytes_total.load(std::memory_order_relaxed);
+}
+
+void ProgressReporter::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (
+        !m_wake.wait_for(lock, refresh_period, [this] { return m_stopping; }))
+    {
+        drain();
+        if (m_live_line && m_expected_files > 0)
+            draw_progress();
+    }
+
+    drain();
+    if (m_live_line && m_expected_files > 0)
+    {
+        draw_progress();
+        m_out << '\n';
+    }
+    m_out.flush();
+}
+
+void ProgressReporter::drain()
+{
+    bool printed = false;
+    while (auto event = m_events.pop())
+    {
+        if (!printed)
+            clear_progress();
+        printed = true;
+
+        m_out << event->line << '\n';
+        if (event->file_done)
+        {
+            ++m_done;
+            if (!event->success)
+                ++m_failed;
+        }
+    }
+
+    if (printed)
+        m_out.flush();
+}
+
+void ProgressReporter::draw_progress()
+{
+    const double elapsed = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - m_start)
+                               .count();
+    const uint64_t bytes = input_bytes() - m_start_bytes;
+    const double   audio_seconds =
+        static_cast<double>(audio_us() - m_start_audio_us) / 1e6;
+    const double bytes_per_second =
+        elapsed > 0 ? static_cast<double>(bytes) / elapsed : 0;
+    const size_t files = m_expected_files.load(std::memory_order_relaxed);
+
+    char line[160];
+    int  length = std::snprintf(
+        line,
+        sizeof(line),
+        "%zu/%zu files, %.1f MB/s, %.1fx realtime",
+        m_done,
+        files,
+        bytes_per_second / 1e6,
+        elapsed > 0 ? audio_seconds / elapsed : 0.0);
+
+    // the rest of the input at the rate so far.
+    const uint64_t expected = m_expected_bytes.load(std::memory_order_relaxed);
+    if (m_done < files && bytes_per_second > 0 && expected > bytes)
+    {
+        const auto eta = static_cast<unsigned long>(
+            static_cast<double>(expected - bytes) / bytes_per_second);
+        length += std::snprintf(line + length,
+                                sizeof(line) - length,
+                                ", ETA %lu:%02lu",
+                                eta / 60,
+                                eta % 60);
+    }
+    if (m_failed > 0)
+        std::snprintf(line + length,
+                      sizeof(line) - length,
+                      ", %zu failed",
+                      m_failed);
+
+    // pad over the rest of a longer line drawn before.
+    std::string text(line);
+    const size_t width = text.size();
+    if (width < m_drawn_width)
+        text.append(m_drawn_width - width, ' ');
+    m_drawn_width = width;
+
+    m_out << '\r' << text;
+    m_out.flush();
+}
+
+void ProgressReporter::clear_progress()
+{
+    if (m_drawn_width == 0)
+        return;
+
+    m_out << '\r' << std::string(m_drawn_width, ' ') << '\r';
+    m_drawn_width = 0;
+}
+
+} // namespace mp3_converter
@@ -0,0 +1,663 @@
+#include "SampleConvert.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_IX86)               \
+    || defined(__SSE2__)
+#    define MP3_CONVERTER_X86 1
+#    include <emmintrin.h>
+#    include <xmmintrin.h>
+#    if defined(__GNUC__) || defined(__clang__)
+// SSSE3 and AVX2 kernels are compiled with a target attribute and only called
+// after a runtime check, so the binary still runs on machines without them.
+#        define MP3_CONVERTER_AVX2 1
+#        include <immintrin.h>
+#    endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#    define MP3_CONVERTER_NEON 1
+#    include <arm_neon.h>
+#endif
+
+namespace {
+using mp3_converter::SampleEncoding;
+using mp3_converter::StereoDownmix;
+
+// speaker position bits of WAVE_FORMAT_EXTENSIBLE's dwChannelMask.
+constexpr uint32_t front_left            = 0x1;
+constexpr uint32_t front_right           = 0x2;
+constexpr uint32_t front_center          = 0x4;
+constexpr uint32_t low_frequency         = 0x8;
+constexpr uint32_t back_left             = 0x10;
+constexpr uint32_t back_right            = 0x20;
+constexpr uint32_t front_left_of_center  = 0x40;
+constexpr uint32_t front_right_of_center = 0x80;
+constexpr uint32_t back_center           = 0x100;
+constexpr uint32_t side_left             = 0x200;
+constexpr uint32_t side_right            = 0x400;
+constexpr uint32_t top_center            = 0x800;
+constexpr uint32_t top_front_left        = 0x1000;
+constexpr uint32_t top_front_center      = 0x2000;
+constexpr uint32_t top_front_right       = 0x4000;
+constexpr uint32_t top_back_left         = 0x8000;
+constexpr uint32_t top_back_center       = 0x10000;
+constexpr uint32_t top_back_right        = 0x20000;
+
+// -3 dB.
+constexpr float minus_3db = 0.70710678f;
+
+// the frame width the vector mix kernels load, frames with more channels
+// are mixed by the scalar kernel.
+constexpr size_t max_vector_channels = 8;
+
+/**
+ * @brief The layout a file without channel mask most likely has.
+ */
+uint32_t default_channel_mask(int num_channels)
+{
+    switch (num_channels)
+    {
+    case 3: return front_left | front_right | front_center;
+    case 4: return front_left | front_right | back_left | back_right;
+    case 5:
+        return front_left | front_right | front_center | back_left
+               | back_right;
+    case 6:
+        return front_left | front_right | front_center | low_frequency
+               | back_left | back_right;
+    case 7:
+        return front_left | front_right | front_center | low_frequency
+               | back_center | side_left | side_right;
+    case 8:
+        return front_left | front_right | front_center | low_frequency
+               | back_left | back_right | side_left | side_right;
+    default: return 0;
+    }
+}
+
+/**
+ * @brief The left and right gain of one speaker position, before scaling.
+ */
+std::pair<float, float> speaker_gains(uint32_t speaker)
+{
+    switch (speaker)
+    {
+    case front_left:
+    case front_left_of_center: return {1.0f, 0.0f};
+    case front_right:
+    case front_right_of_center: return {0.0f, 1.0f};
+    case front_center: return {minus_3db, minus_3db};
+    case back_left:
+    case side_left:
+    case top_front_left:
+    case top_back_left: return {minus_3db, 0.0f};
+    case back_right:
+    case side_right:
+    case top_front_right:
+    case top_back_right: return {0.0f, minus_3db};
+    case back_center:
+    case top_center:
+    case top_front_center:
+    case top_back_center: return {0.5f, 0.5f};
+    default:
+        // LFE and positions without a speaker are dropped.
+        return {0.0f, 0.0f};
+    }
+}
+
+void unpack24_scalar(const unsigned char *in, int32_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i, in += 3)
+    {
+        const uint32_t value = (uint32_t {in[0]} << 8)
+                               | (uint32_t {in[1]} << 16)
+                               | (uint32_t {in[2]} << 24);
+        std::memcpy(out + i, &value, sizeof(value));
+    }
+}
+
+void int32_to_float_scalar(const int32_t *in, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = static_cast<float>(in[i]) * (1.0f / 2147483648.0f);
+}
+
+/**
+ * @brief Mix frames [begin, end) with plain scalar code, also the tail of the
+ * vector kernels.
+ */
+void mix_scalar(const float *        in,
+                const StereoDownmix &mix,
+                size_t               begin,
+                size_t               end,
+                float *              left,
+                float *              right)
+{
+    const size_t channels = mix.left.size();
+    for (size_t i = begin; i < end; ++i)
+    {
+        const float *frame = in + i * channels;
+        float        l     = 0.0f;
+        float        r     = 0.0f;
+        for (size_t c = 0; c < channels; ++c)
+        {
+            l += frame[c] * mix.left[c];
+            r += frame[c] * mix.right[c];
+        }
+        left[i]  = l;
+        right[i] = r;
+    }
+}
+
+#if !defined(MP3_CONVERTER_X86) && !defined(MP3_CONVERTER_NEON)
+void mix_frames_scalar(const float *        in,
+                       const StereoDownmix &mix,
+                       size_t               num_frames,
+                       float *              left,
+                       float *              right)
+{
+    mix_scalar(in, mix, 0, num_frames, left, right);
+}
+#endif
+
+#if defined(MP3_CONVERTER_X86) || defined(MP3_CONVERTER_NEON)
+
+/**
+ * @brief The number of leading frames a vector kernel may load as full
+ * max_vector_channels wide rows, in groups of group frames, without reading
+ * past the last sample.
+ */
+size_t vector_frames(size_t num_frames, size_t channels, size_t group)
+{
+    if (channels > max_vector_channels || num_frames < group)
+        return 0;
+
+    // the last row loaded starts at frame n - 1 and must end in the buffer.
+    size_t n = num_frames - num_frames % group;
+    while (n > 0
+           && (n - 1) * channels + max_vector_channels > num_frames * channels)
+        n -= group;
+    return n;
+}
+
+/**
+ * @brief Gains padded to max_vector_channels lanes, with a mask that clears
+ * the lanes of the next frame, so stray infinities there can not turn into
+ * NaN.
+ */
+struct PaddedGains
+{
+    alignas(32) float    left[max_vector_channels] {};
+    alignas(32) float    right[max_vector_channels] {};
+    alignas(32) uint32_t mask[max_vector_channels] {};
+
+    explicit PaddedGains(const StereoDownmix &mix)
+    {
+        for (size_t c = 0; c < mix.left.size() && c < max_vector_channels; ++c)
+        {
+            left[c]  = mix.left[c];
+            right[c] = mix.right[c];
+            mask[c]  = 0xFFFFFFFFu;
+        }
+    }
+};
+
+#endif
+
+#ifdef MP3_CONVERTER_X86
+
+void int32_to_float_sse2(const int32_t *in, float *out, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    size_t       i     = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    int32_to_float_scalar(in + i, out + i, n - i);
+}
+
+void mix_frames_sse2(const float *        in,
+                     const StereoDownmix &mix,
+                     size_t               num_frames,
+                     float *              left,
+                     float *              right)
+{
+    const size_t      channels = mix.left.size();
+    const PaddedGains gains(mix);
+    const __m128      mask_lo =
+        _mm_load_ps(reinterpret_cast<const float *>(gains.mask));
+    const __m128 mask_hi =
+        _mm_load_ps(reinterpret_cast<const float *>(gains.mask + 4));
+    const __m128 left_lo  = _mm_load_ps(gains.left);
+    const __m128 left_hi  = _mm_load_ps(gains.left + 4);
+    const __m128 right_lo = _mm_load_ps(gains.right);
+    const __m128 right_hi = _mm_load_ps(gains.right + 4);
+
+    const size_t vectorized = vector_frames(num_frames, channels, 4);
+    for (size_t i = 0; i < vectorized; i += 4)
+    {
+        // one row per frame, dot products with the gains, then a transpose
+        // turns the four rows of partial sums into one sum per frame.
+        __m128 l[4];
+        __m128 r[4];
+        for (size_t k = 0; k < 4; ++k)
+        {
+            const float *frame = in + (i + k) * channels;
+            const __m128 lo    = _mm_and_ps(_mm_loadu_ps(frame), mask_lo);
+            const __m128 hi    = _mm_and_ps(_mm_loadu_ps(frame + 4), mask_hi);
+            l[k] = _mm_add_ps(_mm_mul_ps(lo, left_lo), _mm_mul_ps(hi, left_hi));
+            r[k] =
+                _mm_add_ps(_mm_mul_ps(lo, right_lo), _mm_mul_ps(hi, right_hi));
+        }
+        _MM_TRANSPOSE4_PS(l[0], l[1], l[2], l[3]);
+        _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+        _mm_storeu_ps(
+            left + i,
+            _mm_add_ps(_mm_add_ps(l[0], l[1]), _mm_add_ps(l[2], l[3])));
+        _mm_storeu_ps(
+            right + i,
+            _mm_add_ps(_mm_add_ps(r[0], r[1]), _mm_add_ps(r[2], r[3])));
+    }
+    mix_scalar(in, mix, vectorized, num_frames, left, right);
+}
+
+#endif // MP3_CONVERTER_X86
+
+#ifdef MP3_CONVERTER_AVX2
+
+__attribute__((target("ssse3"))) void
+unpack24_ssse3(const unsigned char *in, int32_t *out, size_t n)
+{
+    // moves the 3 bytes of each sample into the top of a 32 bit lane.
+    const __m128i shuffle = _mm_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+    size_t i = 0;
+    // every load reads 16 bytes of which 12 are used.
+    for (; i + 4 <= n && (i * 3) + 16 <= n * 3; i += 4)
+    {
+        const __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                         _mm_shuffle_epi8(v, shuffle));
+    }
+    unpack24_scalar(in + i * 3, out + i, n - i);
+}
+
+__attribute__((target("avx2"))) void
+unpack24_avx2(const unsigned char *in, int32_t *out, size_t n)
+{
+    // the shuffle works within 128 bit lanes, so each lane gets its own 12
+    // bytes loaded.
+    const __m256i shuffle = _mm256_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+
+    size_t i = 0;
+    for (; i + 8 <= n && (i * 3) + 28 <= n * 3; i += 8)
+    {
+        const __m128i lo =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 3));
+        const __m128i hi =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 3 + 12));
+        const __m256i v =
+            _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                            _mm256_shuffle_epi8(v, shuffle));
+    }
+    unpack24_ssse3(in + i * 3, out + i, n - i);
+}
+
+__attribute__((target("avx2"))) void
+int32_to_float_avx2(const int32_t *in, float *out, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    size_t       i     = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    int32_to_float_sse2(in + i, out + i, n - i);
+}
+
+/**
+ * @brief Horizontal sums of eight vectors, one per lane.
+ */
+__attribute__((target("avx2"))) __m256 sum_lanes_avx2(const __m256 *v)
+{
+    const __m256 a = _mm256_hadd_ps(v[0], v[1]);
+    const __m256 b = _mm256_hadd_ps(v[2], v[3]);
+    const __m256 c = _mm256_hadd_ps(v[4], v[5]);
+    const __m256 d = _mm256_hadd_ps(v[6], v[7]);
+
+    // low lanes hold the sums of the first four elements of v[0..3], high
+    // lanes those of the last four.
+    const __m256 ab = _mm256_hadd_ps(a, b);
+    const __m256 cd = _mm256_hadd_ps(c, d);
+
+    return _mm256_add_ps(_mm256_permute2f128_ps(ab, cd, 0x20),
+                         _mm256_permute2f128_ps(ab, cd, 0x31));
+}
+
+__attribute__((target("avx2"))) void
+mix_frames_avx2(const float *        in,
+                const StereoDownmix &mix,
+                size_t               num_frames,
+                float *              left,
+                float *              right)
+{
+    const size_t      channels = mix.left.size();
+    const PaddedGains gains(mix);
+    const __m256      mask =
+        _mm256_load_ps(reinterpret_cast<const float *>(gains.mask));
+    const __m256 left_gains  = _mm256_load_ps(gains.left);
+    const __m256 right_gains = _mm256_load_ps(gains.right);
+
+    const size_t vectorized = vector_frames(num_frames, channels, 8);
+    for (size_t i = 0; i < vectorized; i += 8)
+    {
+        __m256 l[8];
+        __m256 r[8];
+        for (size_t k = 0; k < 8; ++k)
+        {
+            const __m256 frame = _mm256_and_ps(
+                _mm256_loadu_ps(in + (i + k) * channels), mask);
+            l[k] = _mm256_mul_ps(frame, left_gains);
+            r[k] = _mm256_mul_ps(frame, right_gains);
+        }
+        _mm256_storeu_ps(left + i, sum_lanes_avx2(l));
+        _mm256_storeu_ps(right + i, sum_lanes_avx2(r));
+    }
+    mix_frames_sse2(in + vectorized * channels,
+                    mix,
+                    num_frames - vectorized,
+                    left + vectorized,
+                    right + vectorized);
+}
+
+#endif // MP3_CONVERTER_AVX2
+
+#ifdef MP3_CONVERTER_NEON
+
+void unpack24_neon(const unsigned char *in, int32_t *out, size_t n)
+{
+    // out of range indices (255) produce zero bytes.
+    static const uint8_t table[16] = {
+        255, 0, 1, 2, 255, 3, 4, 5, 255, 6, 7, 8, 255, 9, 10, 11};
+    const uint8x16_t shuffle = vld1q_u8(table);
+
+    size_t i = 0;
+    for (; i + 4 <= n && (i * 3) + 16 <= n * 3; i += 4)
+    {
+        const uint8x16_t v = vld1q_u8(in + i * 3);
+        vst1q_s32(out + i, vreinterpretq_s32_u8(vqtbl1q_u8(v, shuffle)));
+    }
+    unpack24_scalar(in + i * 3, out + i, n - i);
+}
+
+void int32_to_float_neon(const int32_t *in, float *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(out + i,
+                  vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(in + i)),
+                              1.0f / 2147483648.0f));
+    int32_to_float_scalar(in + i, out + i, n - i);
+}
+
+void mix_frames_neon(const float *        in,
+                     const StereoDownmix &mix,
+                     size_t               num_frames,
+                     float *              left,
+                     float *              right)
+{
+    const size_t      channels = mix.left.size();
+    const PaddedGains gains(mix);
+    const uint32x4_t  mask_lo  = vld1q_u32(gains.mask);
+    const uint32x4_t  mask_hi  = vld1q_u32(gains.mask + 4);
+    const float32x4_t left_lo  = vld1q_f32(gains.left);
+    const float32x4_t left_hi  = vld1q_f32(gains.left + 4);
+    const float32x4_t right_lo = vld1q_f32(gains.right);
+    const float32x4_t right_hi = vld1q_f32(gains.right + 4);
+
+    auto load = [](const float *p, uint32x4_t mask) {
+        return vreinterpretq_f32_u32(
+            vandq_u32(vreinterpretq_u32_f32(vld1q_f32(p)), mask));
+    };
+
+    const size_t vectorized = vector_frames(num_frames, channels, 4);
+    for (size_t i = 0; i < vectorized; i += 4)
+    {
+        float32x4_t l[4];
+        float32x4_t r[4];
+        for (size_t k = 0; k < 4; ++k)
+        {
+            const float *     frame = in + (i + k) * channels;
+            const float32x4_t lo    = load(frame, mask_lo);
+            const float32x4_t hi    = load(frame + 4, mask_hi);
+            l[k] = vmlaq_f32(vmulq_f32(lo, left_lo), hi, left_hi);
+            r[k] = vmlaq_f32(vmulq_f32(lo, right_lo), hi, right_hi);
+        }
+        // pairwise adds reduce four rows to one sum per row.
+        vst1q_f32(left + i,
+                  vpaddq_f32(vpaddq_f32(l[0], l[1]), vpaddq_f32(l[2], l[3])));
+        vst1q_f32(right + i,
+                  vpaddq_f32(vpaddq_f32(r[0], r[1]), vpaddq_f32(r[2], r[3])));
+    }
+    mix_scalar(in, mix, vectorized, num_frames, left, right);
+}
+
+#endif // MP3_CONVERTER_NEON
+
+using UnpackKernel  = void (*)(const unsigned char *, int32_t *, size_t);
+using ToFloatKernel = void (*)(const int32_t *, float *, size_t);
+using MixKernel     = void (*)(const float *,
+                           const StereoDownmix &,
+                           size_t,
+                           float *,
+                           float *);
+
+/**
+ * @struct KernelSet
+ *
+ * @brief The conversion kernels of one vector extension.
+ */
+struct KernelSet
+{
+    const char *  name;
+    UnpackKernel  unpack24;
+    ToFloatKernel int32_to_float;
+    MixKernel     mix;
+};
+
+KernelSet select_kernels()
+{
+#if defined(MP3_CONVERTER_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2", unpack24_avx2, int32_to_float_avx2, mix_frames_avx2};
+    if (__builtin_cpu_supports("ssse3"))
+        return {"ssse3", unpack24_ssse3, int32_to_float_sse2, mix_frames_sse2};
+#endif
+#if defined(MP3_CONVERTER_X86)
+    return {"sse2", unpack24_scalar, int32_to_float_sse2, mix_frames_sse2};
+#elif defined(MP3_CONVERTER_NEON)
+    return {"neon", unpack24_neon, int32_to_float_neon, mix_frames_neon};
+#else
+    return {"scalar",
+            unpack24_scalar,
+            int32_to_float_scalar,
+            mix_frames_scalar};
+#endif
+}
+
+const KernelSet &kernels()
+{
+    // thread safe initialization, the cpu check runs once.
+    static const KernelSet selected = select_kernels();
+    return selected;
+}
+
+/**
+ * @brief Convert interleaved samples of any encoding to floats in [-1, 1].
+ *
+ * @return Ptr to the floats, which is interleaved itself for float32 input.
+ */
+const float *to_float(const void *   interleaved,
+                      SampleEncoding encoding,
+                      size_t         num_samples,
+                      float *        scratch)
+{
+    const auto &set = kernels();
+
+    switch (encoding)
+    {
+    case SampleEncoding::int16:
+    {
+        const auto *in = static_cast<const int16_t *>(interleaved);
+        for (size_t i = 0; i < num_samples; ++i)
+            scratch[i] = static_cast<float>(in[i]) * (1.0f / 32768.0f);
+        return scratch;
+    }
+    case SampleEncoding::int24:
+    {
+        // unpacked in place, an int32 takes as much room as a float.
+        auto *unpacked = reinterpret_cast<int32_t *>(scratch);
+        set.unpack24(static_cast<const unsigned char *>(interleaved),
+                     unpacked,
+                     num_samples);
+        set.int32_to_float(unpacked, scratch, num_samples);
+        return scratch;
+    }
+    case SampleEncoding::int32:
+        set.int32_to_float(
+            static_cast<const int32_t *>(interleaved), scratch, num_samples);
+        return scratch;
+    case SampleEncoding::float32:
+        return static_cast<const float *>(interleaved);
+    case SampleEncoding::float64:
+    {
+        const auto *in = static_cast<const double *>(interleaved);
+        for (size_t i = 0; i < num_samples; ++i)
+            scratch[i] = static_cast<float>(in[i]);
+        return scratch;
+    }
+    }
+    return scratch;
+}
+
+} // namespace
+
+namespace mp3_converter {
+
+void unpack_pcm24(const void *packed, int32_t *out, size_t num_samples)
+{
+    kernels().unpack24(
+        static_cast<const unsigned char *>(packed), out, num_samples);
+}
+
+void unpack_pcm24_scalar(const void *packed, int32_t *out, size_t num_samples)
+{
+    unpack24_scalar(
+        static_cast<const unsigned char *>(packed), out, num_samples);
+}
+
+std::optional<SampleEncoding> sample_encoding(uint16_t audio_format,
+                                              size_t   sample_size)
+{
+    if (audio_format == 1)
+    {
+        switch (sample_size)
+        {
+        case 2: return SampleEncoding::int16;
+        case 3: return SampleEncoding::int24;
+        case 4: return SampleEncoding::int32;
+        default: return std::nullopt;
+        }
+    }
+    if (audio_format == 3)
+    {
+        switch (sample_size)
+        {
+        case 4: return SampleEncoding::float32;
+        case 8: return SampleEncoding::float64;
+        default: return std::nullopt;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<StereoDownmix> StereoDownmix::for_layout(int      num_channels,
+                                                       uint32_t channel_mask)
+{
+    if (num_channels < 1)
+        return std::nullopt;
+
+    if (channel_mask == 0)
+        channel_mask = default_channel_mask(num_channels);
+    if (channel_mask == 0)
+        return std::nullopt;
+
+    StereoDownmix mix;
+    mix.left.assign(num_channels, 0.0f);
+    mix.right.assign(num_channels, 0.0f);
+
+    // channels are stored in the order of their bits in the mask, channels
+    // beyond the set bits have no speaker and are dropped.
+    int channel = 0;
+    for (uint32_t bit = 1; bit != 0 && channel < num_channels; bit <<= 1)
+    {
+        if ((channel_mask & bit) == 0)
+            continue;
+
+        const auto gains    = speaker_gains(bit);
+        mix.left[channel]   = gains.first;
+        mix.right[channel]  = gains.second;
+        ++channel;
+    }
+
+    float left_sum  = 0.0f;
+    float right_sum = 0.0f;
+    for (int c = 0; c < num_channels; ++c)
+    {
+        left_sum += mix.left[c];
+        right_sum += mix.right[c];
+    }
+
+    const float loudest = std::max(left_sum, right_sum);
+    if (loudest <= 0.0f)
+        return std::nullopt;
+    if (loudest > 1.0f)
+    {
+        for (int c = 0; c < num_channels; ++c)
+        {
+            mix.left[c] /= loudest;
+            mix.right[c] /= loudest;
+        }
+    }
+    return mix;
+}
+
+void downmix_to_stereo(const void *         interleaved,
+                       SampleEncoding       encoding,
+                       const StereoDownmix &downmix,
+                       size_t               num_frames,
+                       float *              scratch,
+                       float *              left,
+                       float *              right)
+{
+    const float *samples = to_float(
+        interleaved, encoding, num_frames * downmix.left.size(), scratch);
+    kernels().mix(samples, downmix, num_frames, left, right);
+}
+
+const char *sample_convert_kernel_name()
+{
+    return kernels().name;
+}
+
+} // namespace mp3_converter
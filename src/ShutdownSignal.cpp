@@ -0,0 +1,97 @@
+#include "ShutdownSignal.h"
+
+#include "ProgressReporter.h"
+
+#include <csignal>
+#include <optional>
+#include <string>
+
+namespace {
+// lock-free, so it may be touched from a signal handler.
+std::atomic<int> signals_received {0};
+
+// how often the watcher looks for signals and the end of the grace period.
+constexpr std::chrono::milliseconds poll_period(50);
+
+extern "C" void count_signal(int signal_number)
+{
+    signals_received.fetch_add(1);
+
+    // some platforms reset the handler once it ran.
+    std::signal(signal_number, count_signal);
+}
+} // namespace
+
+namespace mp3_converter {
+
+ShutdownSignal::ShutdownSignal(CancellationToken &       to_cancel,
+                               std::chrono::milliseconds grace,
+                               std::function<void()>     on_request)
+    : m_to_cancel(to_cancel)
+    , m_grace(grace)
+    , m_on_request(std::move(on_request))
+{
+    signals_received = 0;
+    m_previous_interrupt = std::signal(SIGINT, count_signal);
+    m_previous_terminate = std::signal(SIGTERM, count_signal);
+
+    m_thread = std::thread(&ShutdownSignal::run, this);
+}
+
+ShutdownSignal::~ShutdownSignal()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+
+    std::signal(SIGINT, m_previous_interrupt == SIG_ERR ? SIG_DFL
+                                                        : m_previous_interrupt);
+    std::signal(SIGTERM, m_previous_terminate == SIG_ERR ? SIG_DFL
+                                                         : m_previous_terminate);
+}
+
+bool ShutdownSignal::requested() const
+{
+    return m_requested.load(std::memory_order_relaxed);
+}
+
+void ShutdownSignal::run()
+{
+    using clock = std::chrono::steady_clock;
+
+    std::optional<clock::time_point> grace_end;
+    bool                             cancelled = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_wake.wait_for(lock, poll_period, [this] { return m_stopping; }))
+    {
+        const int received = signals_received.load();
+        if (received == 0 || cancelled)
+            continue;
+
+        if (!grace_end)
+        {
+            grace_end = clock::now() + m_grace;
+            m_requested.store(true, std::memory_order_relaxed);
+            ProgressReporter::log(
+                "Interrupted, giving the conversions in flight "
+                + std::to_string(m_grace.count() / 1000)
+                + " s to finish. Interrupt again to stop them now.");
+            if (m_on_request)
+                m_on_request();
+        }
+
+        if (received > 1 || clock::now() >= *grace_end)
+        {
+            m_to_cancel.cancel();
+            cancelled = true;
+            ProgressReporter::log("Stopping the conversions in flight, their "
+                                  "partial outputs are removed.");
+        }
+    }
+}
+
+} // namespace mp3_converter
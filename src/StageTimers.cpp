@@ -0,0 +1,311 @@
+#include "StageTimers.h"
+
+namespace mp3_converter::stages {
+
+const char *stage_name(Stage stage)
+{
+    switch (stage)
+    {
+        case Stage::file:
+            return "file";
+        case Stage::read:
+            return "read";
+        case Stage::deinterleave:
+            return "deinterleave";
+        case Stage::encode:
+            return "encode";
+        case Stage::flush:
+            return "flush";
+        case Stage::write:
+            return "write";
+    }
+    return "unknown";
+}
+
+} // namespace mp3_converter::stages
+
+#ifdef MP3_CONVERTER_STAGE_TIMERS
+
+#include <array>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mp3_converter::stages {
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+struct Totals
+{
+    uint64_t calls {};
+    uint64_t nanoseconds {};
+    uint64_t bytes {};
+    uint64_t samples {};
+
+    void add(const Totals &other)
+    {
+        calls += other.calls;
+        nanoseconds += other.nanoseconds;
+        bytes += other.bytes;
+        samples += other.samples;
+    }
+};
+
+using StageTotals = std::array<Totals, num_stages>;
+
+struct Event
+{
+    Stage    stage;
+    uint32_t file;
+    int64_t  start_ns;
+    int64_t  duration_ns;
+    uint64_t bytes;
+    uint64_t samples;
+};
+
+/**
+ * @struct ThreadLog
+ *
+ * @brief What one thread recorded. Only written by its thread; owned by the
+ * registry, so it outlives the thread for the export.
+ */
+struct ThreadLog
+{
+    uint32_t                                  thread_id {};
+    std::unordered_map<uint32_t, StageTotals> per_file {};
+    std::vector<Event>                        events {};
+};
+
+struct Registry
+{
+    std::mutex                              mutex;
+    std::vector<std::unique_ptr<ThreadLog>> logs;
+    std::vector<std::string>                files {""};
+    bool                                    keep_events {false};
+    clock_type::time_point                  epoch {clock_type::now()};
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+thread_local ThreadLog *tl_log          = nullptr;
+thread_local uint32_t   tl_current_file = 0;
+
+ThreadLog &this_thread_log()
+{
+    if (tl_log == nullptr)
+    {
+        auto &                      reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.logs.push_back(std::make_unique<ThreadLog>());
+        tl_log            = reg.logs.back().get();
+        tl_log->thread_id = static_cast<uint32_t>(reg.logs.size());
+    }
+    return *tl_log;
+}
+
+std::string json_escape(const std::string &text)
+{
+    std::string escaped;
+    for (const char c : text)
+    {
+        switch (c)
+        {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    static constexpr char digits[] = "0123456789abcdef";
+                    escaped += "\\u00";
+                    escaped += digits[(c >> 4) & 0xF];
+                    escaped += digits[c & 0xF];
+                }
+                else
+                {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+void write_totals(std::ostream &out, const StageTotals &totals)
+{
+    out << '{';
+    bool first = true;
+    for (size_t i = 0; i < num_stages; ++i)
+    {
+        if (totals[i].calls == 0)
+            continue;
+        if (!first)
+            out << ", ";
+        first = false;
+
+        out << '"' << stage_name(static_cast<Stage>(i)) << "\": {\"calls\": "
+            << totals[i].calls
+            << ", \"seconds\": " << totals[i].nanoseconds / 1e9
+            << ", \"bytes\": " << totals[i].bytes
+            << ", \"samples\": " << totals[i].samples << '}';
+    }
+    out << '}';
+}
+} // namespace
+
+namespace detail {
+std::atomic<bool> recording {false};
+
+uint32_t register_file(const std::filesystem::path &file)
+{
+    auto &                      reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.files.push_back(file.string());
+    return static_cast<uint32_t>(reg.files.size() - 1);
+}
+
+uint32_t exchange_current_file(uint32_t file)
+{
+    const auto previous = tl_current_file;
+    tl_current_file     = file;
+    return previous;
+}
+
+void record(Stage                  stage,
+            clock_type::time_point start,
+            clock_type::time_point end,
+            uint64_t               bytes,
+            uint64_t               samples)
+{
+    auto &     log = this_thread_log();
+    const auto duration =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+
+    auto &totals = log.per_file[tl_current_file][static_cast<size_t>(stage)];
+    totals.add({1, static_cast<uint64_t>(duration), bytes, samples});
+
+    // set once before any work starts, so reading it unlocked is fine.
+    auto &reg = registry();
+    if (reg.keep_events)
+    {
+        const auto since_epoch =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(start
+                                                                 - reg.epoch)
+                .count();
+        log.events.push_back(
+            {stage, tl_current_file, since_epoch, duration, bytes, samples});
+    }
+}
+} // namespace detail
+
+void enable(bool keep_events)
+{
+    auto &reg       = registry();
+    reg.keep_events = keep_events;
+    reg.epoch       = clock_type::now();
+    detail::recording.store(true);
+}
+
+uint32_t current_file()
+{
+    return tl_current_file;
+}
+
+void write_summary(std::ostream &out)
+{
+    auto &                      reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    StageTotals                               overall {};
+    std::unordered_map<uint32_t, StageTotals> per_file;
+    for (const auto &log : reg.logs)
+    {
+        for (const auto &[file, totals] : log->per_file)
+        {
+            auto &merged = per_file[file];
+            for (size_t i = 0; i < num_stages; ++i)
+            {
+                merged[i].add(totals[i]);
+                overall[i].add(totals[i]);
+            }
+        }
+    }
+
+    out << std::fixed << std::setprecision(6);
+    out << "{\n  \"stages\": ";
+    write_totals(out, overall);
+    out << ",\n  \"files\": [";
+
+    bool first = true;
+    for (uint32_t file = 1; file < reg.files.size(); ++file)
+    {
+        const auto it = per_file.find(file);
+        if (it == per_file.end())
+            continue;
+
+        out << (first ? "\n" : ",\n") << "    {\"file\": \""
+            << json_escape(reg.files[file]) << "\", \"stages\": ";
+        write_totals(out, it->second);
+        out << '}';
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+}
+
+void write_trace(std::ostream &out)
+{
+    auto &                      reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    // microseconds with nanosecond digits, long runs must not turn into
+    // exponents.
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    bool first = true;
+    for (const auto &log : reg.logs)
+    {
+        out << (first ? "" : ",\n")
+            << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+               "\"tid\": "
+            << log->thread_id << ", \"args\": {\"name\": \"thread "
+            << log->thread_id << "\"}}";
+        first = false;
+
+        for (const auto &event : log->events)
+        {
+            // trace timestamps are in microseconds.
+            out << ",\n{\"name\": \"" << stage_name(event.stage)
+                << "\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 1, "
+                   "\"tid\": "
+                << log->thread_id << ", \"ts\": " << event.start_ns / 1e3
+                << ", \"dur\": " << event.duration_ns / 1e3
+                << ", \"args\": {\"file\": \""
+                << json_escape(reg.files[event.file])
+                << "\", \"bytes\": " << event.bytes
+                << ", \"samples\": " << event.samples << "}}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+} // namespace mp3_converter::stages
+
+#endif
@@ -0,0 +1,197 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+// set for worker threads, so nested submissions find their own deque.
+thread_local mp3_converter::ThreadPool *tl_pool {nullptr};
+thread_local size_t                     tl_index {};
+} // namespace
+
+namespace mp3_converter {
+
+ThreadPool::ThreadPool(unsigned int num_workers)
+{
+    num_workers    = std::max(num_workers, 1u);
+    m_active_limit = num_workers;
+
+    for (unsigned int i = 0; i < num_workers; ++i)
+        m_queues.emplace_back(std::make_unique<WorkQueue>());
+
+    for (unsigned int i = 0; i < num_workers; ++i)
+        m_workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (auto &worker : m_workers)
+        worker.join();
+}
+
+void ThreadPool::set_active_limit(unsigned int limit)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_active_limit = std::clamp(limit, 1u, size());
+    }
+    m_wake.notify_all();
+}
+
+size_t ThreadPool::queued()
+{
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    return m_queued;
+}
+
+ThreadPool *ThreadPool::current()
+{
+    return tl_pool;
+}
+
+void ThreadPool::push(std::function<void()> job, bool nested)
+{
+    auto &queue = nested ? *m_queues[tl_index]
+                         : *m_queues[m_next_queue++ % m_queues.size()];
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (nested)
+            queue.jobs.push_front({std::move(job), true});
+        else
+            queue.jobs.push_back({std::move(job), false});
+
+        // counted before the deque is unlocked, so the job can not be taken
+        // and uncounted first. Nothing locks these two the other way round.
+        std::lock_guard<std::mutex> sleep_lock(m_sleep_mutex);
+        ++m_queued;
+    }
+    // a sleeping worker above the limit would swallow a single wake up.
+    if (active_limit() < size())
+        m_wake.notify_all();
+    else
+        m_wake.notify_one();
+}
+
+std::optional<ThreadPool::QueuedJob> ThreadPool::pop(size_t home)
+{
+    // own deque first, then steal, starting with the next neighbour so
+    // thieves spread over the victims.
+    for (size_t i = 0; i < m_queues.size(); ++i)
+    {
+        auto &queue = *m_queues[(home + i) % m_queues.size()];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            auto job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            return job;
+        }
+    }
+    return std::nullopt;
+}
+
+bool ThreadPool::try_run_nested()
+{
+    return tl_pool == this && run_nested_from(tl_index);
+}
+
+bool ThreadPool::help_nested()
+{
+    if (tl_pool != this)
+        return false;
+
+    // own deque first, the sub-jobs there are the ones this worker waits for
+    // most likely.
+    for (size_t i = 0; i < m_queues.size(); ++i)
+    {
+        if (run_nested_from((tl_index + i) % m_queues.size()))
+            return true;
+    }
+    return false;
+}
+
+bool ThreadPool::run_nested_from(size_t index)
+{
+    std::optional<QueuedJob> job;
+    {
+        auto &queue = *m_queues[index];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        // only help with sub-jobs, picking up an unrelated top level job here
+        // would delay the job that is waiting until that one is done.
+        if (queue.jobs.empty() || !queue.jobs.front().nested)
+            return false;
+
+        job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        --m_queued;
+    }
+
+    run_job(*job);
+    return true;
+}
+
+uint64_t ThreadPool::jobs_finished()
+{
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    return m_jobs_finished;
+}
+
+void ThreadPool::wait_for_jobs_finished(uint64_t finished)
+{
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    m_job_finished.wait(
+        lock, [this, finished] { return m_jobs_finished != finished; });
+}
+
+void ThreadPool::run_job(QueuedJob &job)
+{
+    job.run();
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        ++m_jobs_finished;
+    }
+    m_job_finished.notify_all();
+}
+
+void ThreadPool::worker_loop(size_t index)
+{
+    tl_pool  = this;
+    tl_index = index;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_sleep_mutex);
+            m_wake.wait(lock, [this, index] {
+                return (m_queued > 0 && index < m_active_limit) || m_stopping;
+            });
+            if (m_queued == 0 && m_stopping)
+                return;
+        }
+
+        auto job = pop(index);
+        if (!job)
+            continue; // another worker was faster.
+
+        {
+            std::lock_guard<std::mutex> lock(m_sleep_mutex);
+            --m_queued;
+        }
+
+        run_job(*job);
+    }
+}
+
+} // namespace mp3_converter
@@ -1,15 +1,32 @@
 #include "WavefileConversionTask.h"
 
+#include "BufferArena.h"
+#include "ByteSink.h"
+#include "Cancellation.h"
 #include "LameEncodingTask.h"
+#include "Mp3Frames.h"
+#include "ProgressReporter.h"
+#include "SampleConvert.h"
+#include "StageTimers.h"
+#include "ThreadPool.h"
 #include "WavefileChunks.h"
+#include "WavefileReader.h"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
-#include <fstream>
-#include <iostream>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 
 // static assert type sizes
@@ -17,203 +34,1148 @@
 namespace {
 std::atomic<size_t> static_num_task {};
 
+// the length of a segment, fixed so a file is cut at the same seams and
+// encodes to the same bytes on every machine. A file is only split into two
+// segments or more, shorter ones are not worth the overlap and extra encoder
+// setup.
+constexpr unsigned long segment_seconds = 30;
+
+// mp3 frames encoded before the start and after the end of each segment, so
+// the psychoacoustic model and the MDCT overlap have settled at the seams. The
+// output for them is dropped again.
+constexpr unsigned long overlap_mp3_frames = 8;
+
+// rough size of the state lame allocates per encoder, for memory estimates.
+constexpr uint64_t lame_state_bytes = 512 * 1024;
+
 /**
- * @brief Split the samples from raw data into individual buffers based on
- * num_channels.
+ * @struct PassThrough
  *
- * @param to_file File name to Encode into.
- * @param data The uninterpreted wave data chunk.
- * @param num_channels The number of channels according to format header.
- * @param sample_rate The sample rate according to format header.
+ * @brief Decodes mono or stereo samples of a type lame takes as they are.
+ *
+ * Blocks are handed to lame as they come from the reader, which for mapped
+ * files means pointers straight into the mapping. Stereo blocks go through
+ * lame's interleaved entry points, or the vectorized deinterleave kernel for
+ * types lame can only take per channel.
+ *
+ * @tparam R The fixed-width sample type.
+ * @tparam Channels 1 or 2.
+ */
+template<typename R, int Channels>
+struct PassThrough
+{
+    static_assert(Channels == 1 || Channels == 2, "Mono or stereo only.");
+
+    using lame_type = R;
+
+    static PassThrough for_layout(const mp3_converter::WaveLayout &)
+    {
+        return {};
+    }
+
+    static constexpr size_t frame_bytes()
+    {
+        return Channels * sizeof(R);
+    }
+
+    static constexpr size_t alignment()
+    {
+        return alignof(R);
+    }
+
+    static constexpr int lame_channels()
+    {
+        return Channels;
+    }
+
+    static constexpr size_t scratch_bytes(unsigned long num_frames)
+    {
+        // stereo samples lame can not take interleaved are split first.
+        if constexpr (Channels == 2
+                      && !mp3_converter::LameEncodingTask<
+                          R>::has_interleaved_entry_point)
+            return 2 * num_frames * sizeof(R);
+        return 0;
+    }
+
+    template<typename Encoder>
+    void feed(Encoder &task, const char *block, unsigned long num_frames) const
+    {
+        const R *samples = reinterpret_cast<const R *>(block);
+        if constexpr (Channels == 1)
+            task.EncodeBlock(num_frames, samples, samples);
+        else
+            task.EncodeInterleavedBlock(num_frames, samples);
+    }
+};
+
+/**
+ * @struct Packed24
+ *
+ * @brief Decodes mono or stereo packed 24 bit samples, unpacked to 32 bit
+ * by the vectorized kernel.
+ */
+template<int Channels>
+struct Packed24
+{
+    using lame_type = int32_t;
+
+    static Packed24 for_layout(const mp3_converter::WaveLayout &)
+    {
+        return {};
+    }
+
+    static constexpr size_t frame_bytes()
+    {
+        return Channels * 3u;
+    }
+
+    static constexpr size_t alignment()
+    {
+        return 1;
+    }
+
+    static constexpr int lame_channels()
+    {
+        return Channels;
+    }
+
+    static constexpr size_t scratch_bytes(unsigned long num_frames)
+    {
+        return num_frames * Channels * sizeof(int32_t);
+    }
+
+    template<typename Encoder>
+    void feed(Encoder &task, const char *block, unsigned long num_frames) const
+    {
+        auto unpacked = mp3_converter::BufferArena::for_this_thread().acquire(
+            num_frames * Channels * sizeof(int32_t));
+        {
+            mp3_converter::stages::ScopedStage timer(
+                mp3_converter::stages::Stage::deinterleave,
+                num_frames * frame_bytes(),
+                num_frames);
+            mp3_converter::unpack_pcm24(
+                block, unpacked.as<int32_t>(), num_frames * Channels);
+        }
+        PassThrough<int32_t, Channels> {}.feed(
+            task, reinterpret_cast<const char *>(unpacked.data()), num_frames);
+    }
+};
+
+/**
+ * @struct Narrow64
+ *
+ * @brief Decodes mono or stereo 64 bit integer samples by keeping their upper
+ * 32 bits, more than lame resolves anyway.
+ */
+template<int Channels>
+struct Narrow64
+{
+    using lame_type = int32_t;
+
+    static Narrow64 for_layout(const mp3_converter::WaveLayout &)
+    {
+        return {};
+    }
+
+    static constexpr size_t frame_bytes()
+    {
+        return Channels * sizeof(int64_t);
+    }
+
+    static constexpr size_t alignment()
+    {
+        return alignof(int64_t);
+    }
+
+    static constexpr int lame_channels()
+    {
+        return Channels;
+    }
+
+    static constexpr size_t scratch_bytes(unsigned long num_frames)
+    {
+        return num_frames * Channels * sizeof(int32_t);
+    }
+
+    template<typename Encoder>
+    void feed(Encoder &task, const char *block, unsigned long num_frames) const
+    {
+        auto narrowed = mp3_converter::BufferArena::for_this_thread().acquire(
+            num_frames * Channels * sizeof(int32_t));
+        {
+            mp3_converter::stages::ScopedStage timer(
+                mp3_converter::stages::Stage::deinterleave,
+                num_frames * frame_bytes(),
+                num_frames);
+            const auto *wide = reinterpret_cast<const int64_t *>(block);
+            auto *      out  = narrowed.as<int32_t>();
+            for (size_t i = 0; i < num_frames * Channels; ++i)
+                out[i] = static_cast<int32_t>(wide[i] >> 32);
+        }
+        PassThrough<int32_t, Channels> {}.feed(
+            task, reinterpret_cast<const char *>(narrowed.data()), num_frames);
+    }
+};
+
+/**
+ * @struct Downmix
+ *
+ * @brief Decodes more than two channels of the sample encoding into planar
+ * float stereo.
+ */
+template<mp3_converter::SampleEncoding Encoding, size_t SampleBytes>
+struct Downmix
+{
+    using lame_type = float;
+
+    mp3_converter::StereoDownmix gains;
+
+    /**
+     * @throws WavefileConversionTask::wave_format_error When there is no
+     * known stereo downmix for the channel layout.
+     */
+    static Downmix for_layout(const mp3_converter::WaveLayout &layout)
+    {
+        auto gains = mp3_converter::StereoDownmix::for_layout(
+            layout.format.NumChannels, layout.channel_mask);
+        if (!gains)
+            throw mp3_converter::WavefileConversionTask::wave_format_error(
+                "Found a channel layout without known stereo downmix. "
+                "Unsupported.");
+
+        return {std::move(*gains)};
+    }
+
+    size_t frame_bytes() const
+    {
+        return gains.left.size() * SampleBytes;
+    }
+
+    static constexpr size_t alignment()
+    {
+        // packed 24 bit samples are read byte by byte.
+        return Encoding == mp3_converter::SampleEncoding::int24 ? 1
+                                                                : SampleBytes;
+    }
+
+    static constexpr int lame_channels()
+    {
+        return 2;
+    }
+
+    size_t scratch_bytes(unsigned long num_frames) const
+    {
+        return num_frames * (gains.left.size() + 2) * sizeof(float);
+    }
+
+    template<typename Encoder>
+    void feed(Encoder &task, const char *block, unsigned long num_frames) const
+    {
+        auto &arena   = mp3_converter::BufferArena::for_this_thread();
+        auto  scratch = arena.acquire(num_frames * gains.left.size()
+                                     * sizeof(float));
+        auto  left    = arena.acquire(num_frames * sizeof(float));
+        auto  right   = arena.acquire(num_frames * sizeof(float));
+
+        {
+            mp3_converter::stages::ScopedStage timer(
+                mp3_converter::stages::Stage::deinterleave,
+                num_frames * frame_bytes(),
+                num_frames);
+            mp3_converter::downmix_to_stereo(block,
+                                             Encoding,
+                                             gains,
+                                             num_frames,
+                                             scratch.as<float>(),
+                                             left.as<float>(),
+                                             right.as<float>());
+        }
+        task.EncodeBlock(num_frames, left.as<float>(), right.as<float>());
+    }
+};
+
+/**
+ * @class FanOut
+ *
+ * @brief Hands every decoded block to several lame encoders at once, one per
+ * profile, so the source is read and decoded only once.
+ *
+ * Has the encode interface of LameEncodingTask, so decoders feed it the same
+ * way. The first encoder runs on the calling thread, the others on the thread
+ * pool of the calling worker if there is one, else on std::async. Stereo
+ * samples that lame can not take interleaved are split once for all of them.
  */
 template<typename R>
-bool convert_from_raw(const std::filesystem::path &      to_file,
-                      const wavefile::chunks::DataChunk &data,
-                      unsigned long                      num_samples,
-                      int                                num_channels,
-                      int                                sample_rate)
+class FanOut
 {
-    mp3_converter::LameEncodingTask<R> lame_encoding_task(to_file);
+  public:
+    explicit FanOut(std::vector<mp3_converter::LameEncodingTask<R> *> tasks)
+        : m_tasks(std::move(tasks))
+        , m_pool(mp3_converter::ThreadPool::current())
+        , m_file_id(mp3_converter::stages::current_file())
+    {
+    }
 
-    const R *interpreted_array_ptr =
-        reinterpret_cast<const R *>(data.Data.data());
+    void EncodeBlock(unsigned long num_samples,
+                     const R *     buffer_l,
+                     const R *     buffer_r)
+    {
+        for_each_task([&](mp3_converter::LameEncodingTask<R> &task) {
+            task.EncodeBlock(num_samples, buffer_l, buffer_r);
+        });
+    }
 
-    if (num_channels == 1)
+    void EncodeInterleavedBlock(unsigned long num_samples, const R *interleaved)
     {
-        return lame_encoding_task.Encode(num_samples,
-                                         sample_rate,
-                                         num_channels,
-                                         interpreted_array_ptr,
-                                         interpreted_array_ptr);
+        if constexpr (mp3_converter::LameEncodingTask<
+                          R>::has_interleaved_entry_point)
+        {
+            for_each_task([&](mp3_converter::LameEncodingTask<R> &task) {
+                task.EncodeInterleavedBlock(num_samples, interleaved);
+            });
+        }
+        else
+        {
+            if (m_left.size() == 0)
+            {
+                constexpr auto block_frames =
+                    mp3_converter::LameEncodingTask<R>::block_frames;
+
+                auto &arena = mp3_converter::BufferArena::for_this_thread();
+                m_left      = arena.acquire(block_frames * sizeof(R));
+                m_right     = arena.acquire(block_frames * sizeof(R));
+            }
+            {
+                mp3_converter::stages::ScopedStage timer(
+                    mp3_converter::stages::Stage::deinterleave,
+                    2 * num_samples * sizeof(R),
+                    num_samples);
+                mp3_converter::deinterleave_stereo(
+                    interleaved, m_left.as<R>(), m_right.as<R>(), num_samples);
+            }
+            EncodeBlock(num_samples, m_left.as<R>(), m_right.as<R>());
+        }
     }
-    else if (num_channels == 2)
+
+  private:
+    template<typename F>
+    void for_each_task(F &&encode)
     {
-        std::vector<R> l_buffer;
-        std::vector<R> r_buffer;
-        l_buffer.reserve(num_samples);
-        r_buffer.reserve(num_samples);
-        for (size_t i = 0; i < num_samples * 2; ++i)
+        std::vector<std::future<void>> others;
+        for (size_t i = 1; i < m_tasks.size(); ++i)
         {
-            if (i % 2 == 0)
+            auto job = [this, &encode, i] {
+                mp3_converter::stages::FileScope file_scope(m_file_id);
+                encode(*m_tasks[i]);
+            };
+            others.emplace_back(m_pool
+                                    ? m_pool->submit(job)
+                                    : std::async(std::launch::async, job));
+        }
+
+        // every encoder is done with the block before the caller reuses it,
+        // the first error is the one reported.
+        std::exception_ptr error;
+        try
+        {
+            encode(*m_tasks.front());
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        for (auto &other : others)
+        {
+            try
             {
-                l_buffer.push_back(interpreted_array_ptr[i]);
+                if (m_pool)
+                    m_pool->wait(other);
+                else
+                    other.get();
             }
-            else
+            catch (...)
             {
-                r_buffer.push_back(interpreted_array_ptr[i]);
+                if (!error)
+                    error = std::current_exception();
             }
         }
-        return lame_encoding_task.Encode(num_samples,
-                                         sample_rate,
-                                         num_channels,
-                                         l_buffer.data(),
-                                         r_buffer.data());
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    std::vector<mp3_converter::LameEncodingTask<R> *> m_tasks;
+    mp3_converter::ThreadPool *                        m_pool;
+    uint32_t                                           m_file_id;
+
+    mp3_converter::PooledBuffer m_left {};
+    mp3_converter::PooledBuffer m_right {};
+};
+
+/**
+ * @brief Read num_samples samples per channel from the reader block by block
+ * and hand each block to lame through the decoder.
+ *
+ * The cancellation token of the calling thread is checked before every block.
+ *
+ * @tparam Encoder A LameEncodingTask of the decoder's lame_type, or a FanOut
+ * over several of them.
+ */
+template<typename Encoder, typename Decoder>
+void encode_samples(Encoder &                      lame_encoding_task,
+                    mp3_converter::WavefileReader &reader,
+                    const Decoder &                decoder,
+                    unsigned long                  num_samples)
+{
+    constexpr auto block_frames = mp3_converter::LameEncodingTask<
+        typename Decoder::lame_type>::block_frames;
+
+    for (unsigned long offset = 0; offset < num_samples; offset += block_frames)
+    {
+        mp3_converter::throw_if_cancelled();
+
+        const auto block = std::min(block_frames, num_samples - offset);
+
+        const size_t block_bytes = block * decoder.frame_bytes();
+        const char * block_ptr;
+        {
+            mp3_converter::stages::ScopedStage timer(
+                mp3_converter::stages::Stage::read, block_bytes, block);
+            block_ptr = reader.next_block(block_bytes, decoder.alignment());
+        }
+        mp3_converter::ProgressReporter::count_input(
+            block_bytes, block, reader.layout().format.SampleRate);
+
+        decoder.feed(lame_encoding_task, block_ptr, block);
     }
-    return false;
 }
-} // namespace
 
-namespace mp3_converter {
+/**
+ * @struct SegmentPlan
+ *
+ * @brief How a long file is split into segments that are encoded concurrently.
+ *
+ * Segment i covers the samples [i * segment_samples, (i + 1) *
+ * segment_samples). segment_samples is a multiple of frame_size, so every
+ * segment starts on the mp3 frame grid of the whole file.
+ */
+struct SegmentPlan
+{
+    unsigned long frame_size;
+    unsigned long segment_samples;
+    size_t        num_segments;
+    uint64_t      estimated_bytes;
+};
 
-WavefileConversionTask::WavefileConversionTask(
-    const std::filesystem::path &in_file)
-    : m_task_num(static_num_task++)
-    , m_wav_file_in(in_file)
+/**
+ * @class NullSink
+ *
+ * @brief Drops everything, for encoders that are only asked for parameters.
+ */
+class NullSink : public mp3_converter::ByteSink
 {
+  public:
+    void write(const unsigned char *, size_t) override
+    {
+    }
+};
+
+/**
+ * @brief The number of samples per segment a file is split into, before it is
+ * cut to the mp3 frame grid. Depends on the file only, not on the machine.
+ *
+ * @return The segment length, 0 if the file should be encoded in one piece.
+ */
+unsigned long segment_length(const mp3_converter::EncodingProfile &profile,
+                             unsigned long                         num_samples,
+                             int                                   sample_rate)
+{
+    const unsigned long segment_samples = segment_seconds * sample_rate;
+
+    if (!profile.segmented || sample_rate <= 0
+        || num_samples < 2 * segment_samples)
+        return 0;
+
+    return segment_samples;
 }
 
-bool WavefileConversionTask::run()
+/**
+ * @brief Decide whether and how to split a file for concurrent encoding.
+ *
+ * @return The plan, nullopt if the file should be encoded in one piece.
+ */
+template<typename R>
+std::optional<SegmentPlan>
+plan_segments(unsigned long                         num_samples,
+              int                                   num_channels,
+              int                                   sample_rate,
+              const mp3_converter::EncodingProfile &profile)
+{
+    const unsigned long segment_samples =
+        segment_length(profile, num_samples, sample_rate);
+    if (segment_samples == 0)
+        return std::nullopt;
+
+    // ask a throwaway encoder with the same parameters for the frame size.
+    NullSink                           probe_sink;
+    mp3_converter::LameEncodingTask<R> probe(probe_sink, profile);
+    probe.Begin(num_samples, sample_rate, num_channels, true);
+
+    // when lame resamples, input samples no longer map onto output frames in
+    // whole numbers and segments can not be cut on the frame grid.
+    if (probe.OutSampleRate() != sample_rate || probe.FrameSize() <= 0)
+        return std::nullopt;
+
+    SegmentPlan plan {};
+    plan.frame_size = static_cast<unsigned long>(probe.FrameSize());
+
+    plan.segment_samples =
+        segment_samples - segment_samples % plan.frame_size;
+    plan.num_segments =
+        (num_samples + plan.segment_samples - 1) / plan.segment_samples;
+    plan.estimated_bytes = probe.EstimatedBytes(num_samples);
+
+    return plan;
+}
+
+/**
+ * @brief Encode one segment of a file on its own lame instance.
+ *
+ * The encoder is started overlap_mp3_frames before the segment and stopped
+ * overlap_mp3_frames after it. Since it starts on the frame grid, its n-th
+ * frame holds the same samples as the frame at the same position in an
+ * encode of the whole file, so only the frames belonging to the segment are
+ * kept. Frames are independent (no bit reservoir), so the kept frames of all
+ * segments concatenate into one valid mp3 stream.
+ *
+ * @return The mp3 frames of the segment.
+ */
+template<typename Decoder>
+std::vector<unsigned char>
+encode_segment(const mp3_converter::WavefileReader & source,
+               const Decoder &                       decoder,
+               const mp3_converter::EncodingProfile &profile,
+               const SegmentPlan &                   plan,
+               size_t                                index,
+               unsigned long                         num_samples,
+               int                                   sample_rate)
 {
-    std::cout << "Thread " + std::to_string(m_task_num)
-                     + ": Starting conversion.\n";
+    using R = typename Decoder::lame_type;
+
+    using mp3_converter::lame_encoding_error;
 
-    using std::ifstream;
-    using namespace wavefile::chunks;
+    const unsigned long overlap = overlap_mp3_frames * plan.frame_size;
+    const unsigned long start   = index * plan.segment_samples;
+    const unsigned long end = std::min(start + plan.segment_samples, num_samples);
+    const bool          is_last    = end == num_samples;
+    const unsigned long feed_start = start > overlap ? start - overlap : 0;
+    const unsigned long feed_end =
+        is_last ? num_samples : std::min(end + overlap, num_samples);
 
-    ifstream i_stream;
-    i_stream.open(m_wav_file_in.string(), std::ios_base::binary);
+    mp3_converter::MemorySink           sink;
+    mp3_converter::LameEncodingTask<R> lame_encoding_task(sink, profile);
+    lame_encoding_task.Begin(
+        feed_end - feed_start, sample_rate, decoder.lame_channels(), true);
 
-    auto file_out = m_wav_file_in;
-    file_out.replace_extension("mp3");
+    auto reader = source.open_at(uint64_t {feed_start} * decoder.frame_bytes());
+    encode_samples(
+        lame_encoding_task, *reader, decoder, feed_end - feed_start);
+    lame_encoding_task.Finish();
 
-    RiffHeader header;
-    i_stream.read(reinterpret_cast<char *>(&header), sizeof(header));
+    auto &bytes = sink.bytes();
 
-    // use FourUnterminatedChars comparison operators to check for equivalency
-    // in a safe manner (ChunkID is unterminated string).
-    if (header.Chunk_header.ChunkID != "RIFF")
+    const auto begin = mp3_converter::skip_mp3_frames(
+        bytes.data(), bytes.size(), (start - feed_start) / plan.frame_size);
+    if (!begin)
+        throw lame_encoding_error("Segment encoder produced too few frames.");
+
+    // the last segment keeps everything up to and including the flush.
+    size_t length = bytes.size() - *begin;
+    if (!is_last)
     {
-        throw wave_format_error("File does not contain a RIFF file header.");
+        const auto maybe_length =
+            mp3_converter::skip_mp3_frames(bytes.data() + *begin,
+                                           bytes.size() - *begin,
+                                           (end - start) / plan.frame_size);
+        if (!maybe_length)
+            throw lame_encoding_error(
+                "Segment encoder produced too few frames.");
+        length = *maybe_length;
     }
-    if (header.Format != "WAVE")
+
+    return std::vector<unsigned char>(bytes.begin() + *begin,
+                                      bytes.begin() + *begin + length);
+}
+
+/**
+ * @brief Convert the data chunk from the reader to an mp3 stream, splitting
+ * long files into segments that are encoded concurrently.
+ *
+ * Segments are submitted to the thread pool of the calling worker if there is
+ * one, else to std::async. At most one segment per worker is in flight, the
+ * finished ones are written out in order.
+ *
+ * @param out The sink to encode into, closed at the end.
+ * @param profile The lame settings to encode with.
+ * @param reader Reader for the data chunk payload.
+ * @param decoder Turns blocks of the data chunk into samples for lame.
+ * @param num_samples The number of samples per channel in the data chunk.
+ * @param sample_rate The sample rate according to format header.
+ */
+template<typename Decoder>
+bool convert_from_raw(mp3_converter::ByteSink &             out,
+                      const mp3_converter::EncodingProfile &profile,
+                      mp3_converter::WavefileReader &       reader,
+                      const Decoder &                       decoder,
+                      unsigned long                         num_samples,
+                      int                                   sample_rate)
+{
+    using R = typename Decoder::lame_type;
+
+    const int num_channels = decoder.lame_channels();
+
+    const auto plan =
+        plan_segments<R>(num_samples, num_channels, sample_rate, profile);
+    if (!plan)
     {
-        throw wave_format_error("File does not contain a WAVE file header.");
+        mp3_converter::LameEncodingTask<R> lame_encoding_task(out, profile);
+        lame_encoding_task.Begin(num_samples, sample_rate, num_channels);
+        encode_samples(lame_encoding_task, reader, decoder, num_samples);
+        return lame_encoding_task.Finish();
     }
-    // there can now be a number of unknown chunks until we find "fmt", then
-    // "data"
 
-    // local lambda to check chunks until the one with the given identifier has
-    // been read in
-    auto find_chunk =
-        [&](const std::string &identifier) -> std::optional<CommonHeader> {
-        CommonHeader potential_chunk;
+    auto *pool = mp3_converter::ThreadPool::current();
+
+    const size_t max_in_flight =
+        pool ? pool->active_limit() : std::thread::hardware_concurrency();
+
+    out.reserve(plan->estimated_bytes);
+    std::deque<std::future<std::vector<unsigned char>>> in_flight;
+    size_t                                              next_segment = 0;
+
+    // segments are timed as part of this file, on whichever thread they run,
+    // and stop with it.
+    const auto  file_id = mp3_converter::stages::current_file();
+    const auto *token   = mp3_converter::CancellationToken::current();
+
+    try
+    {
+        while (next_segment < plan->num_segments || !in_flight.empty())
+        {
+            while (next_segment < plan->num_segments
+                   && in_flight.size() < max_in_flight)
+            {
+                auto segment_job = [&, index = next_segment] {
+                    mp3_converter::stages::FileScope  file_scope(file_id);
+                    mp3_converter::CancellationScope cancellation(token);
+                    return encode_segment(reader,
+                                          decoder,
+                                          profile,
+                                          *plan,
+                                          index,
+                                          num_samples,
+                                          sample_rate);
+                };
+                in_flight.emplace_back(
+                    pool ? pool->submit(segment_job)
+                         : std::async(std::launch::async, segment_job));
+                ++next_segment;
+            }
 
-        while (i_stream.good())
+            const auto segment_bytes = pool ? pool->wait(in_flight.front())
+                                            : in_flight.front().get();
+            in_flight.pop_front();
+            out.write(segment_bytes.data(), segment_bytes.size());
+        }
+    }
+    catch (...)
+    {
+        // the segment jobs reference this frame, they have to be done before
+        // it unwinds. Pool futures do not block on destruction.
+        for (auto &segment : in_flight)
         {
-            i_stream.read(reinterpret_cast<char *>(&potential_chunk),
-                          sizeof(CommonHeader));
-            if (potential_chunk.ChunkID == identifier)
+            try
             {
-                return potential_chunk;
+                if (pool)
+                    pool->wait(segment);
+                else
+                    segment.wait();
             }
-            else
+            catch (...)
             {
-                // skip over the unknown  chunk
-                size_t to_skip = potential_chunk.ChunkSize;
-                i_stream.seekg(to_skip, std::ios_base::cur);
+                // the first error is the one reported.
             }
         }
-        return std::nullopt;
-    };
+        throw;
+    }
 
-    auto maybe_format_start = find_chunk("fmt ");
-    if (!maybe_format_start)
-        throw wave_format_error("Did not find fmt chunk in file.");
+    return out.close();
+}
 
-    FormatHeader format_header {maybe_format_start->ChunkID,
-                                maybe_format_start->ChunkSize};
+/**
+ * @brief Convert the data chunk from the reader to one mp3 stream per profile
+ * in a single pass: every block is read and decoded once, then encoded for
+ * all profiles concurrently.
+ *
+ * Files are not split into segments here, the profiles already keep several
+ * workers busy.
+ */
+template<typename Decoder>
+bool convert_to_profiles(
+    const std::vector<mp3_converter::ByteSink *> &     outs,
+    const std::vector<mp3_converter::EncodingProfile> &profiles,
+    mp3_converter::WavefileReader &                    reader,
+    const Decoder &                                    decoder,
+    unsigned long                                      num_samples,
+    int                                                sample_rate)
+{
+    using R = typename Decoder::lame_type;
 
-    i_stream.read(reinterpret_cast<char *>(&format_header.AudioFormat),
-                  format_header.Chunk_header.ChunkSize);
+    std::vector<std::unique_ptr<mp3_converter::LameEncodingTask<R>>> tasks;
+    std::vector<mp3_converter::LameEncodingTask<R> *>                encoders;
+    for (size_t i = 0; i < profiles.size(); ++i)
+    {
+        tasks.push_back(std::make_unique<mp3_converter::LameEncodingTask<R>>(
+            *outs[i], profiles[i]));
+        tasks.back()->Begin(num_samples, sample_rate, decoder.lame_channels());
+        encoders.push_back(tasks.back().get());
+    }
 
-    const uint16_t num_channels = format_header.NumChannels;
-    if (num_channels > 2)
-        throw wave_format_error(
-            "Found more than two channels in wave file, unsuported");
+    FanOut<R> fan_out(std::move(encoders));
+    encode_samples(fan_out, reader, decoder, num_samples);
 
-    const uint16_t sample_rate = format_header.SampleRate;
+    bool success = true;
+    for (auto &task : tasks)
+        success = task->Finish() && success;
+    return success;
+}
 
-    auto maybe_data_start = find_chunk("data");
-    if (!maybe_data_start)
-        throw wave_format_error("Did not find data chunk in file.");
+/**
+ * @brief Convert a stream read front to back, as far as it goes, writing the
+ * mp3 frames to out as they are produced.
+ */
+template<typename Decoder>
+bool convert_from_stream(mp3_converter::PipeWavefileReader &   reader,
+                         const Decoder &                       decoder,
+                         const mp3_converter::EncodingProfile &profile,
+                         mp3_converter::ByteSink &             out,
+                         mp3_converter::stages::ScopedStage &  file_timer)
+{
+    using R = typename Decoder::lame_type;
 
-    // determine the data type in the data chunk
-    bool         conversion_success = false;
-    const size_t data_size          = maybe_data_start->ChunkSize;
-    // num frames = how many blocks of #num_channels are in file
-    const unsigned long num_frames = data_size / format_header.BlockAlign;
+    const auto &layout = reader.layout();
+    const bool  size_known =
+        layout.data_size != mp3_converter::WaveLayout::unknown_size;
+    const unsigned long num_samples =
+        size_known ? static_cast<unsigned long>(layout.data_size
+                                                / decoder.frame_bytes())
+                   : mp3_converter::LameEncodingTask<R>::unknown_num_samples;
 
-    DataChunk data;
-    data.Chunk_header.ChunkID   = maybe_data_start->ChunkID;
-    data.Chunk_header.ChunkSize = maybe_data_start->ChunkSize;
-    data.Data.resize(data_size);
-    i_stream.read(data.Data.data(), data_size);
+    mp3_converter::LameEncodingTask<R> lame_encoding_task(out, profile);
+    lame_encoding_task.Begin(
+        num_samples, layout.format.SampleRate, decoder.lame_channels());
 
-    if (format_header.AudioFormat == 1) // PCM format
+    const size_t frame_bytes = decoder.frame_bytes();
+    const size_t block_bytes =
+        mp3_converter::LameEncodingTask<R>::block_frames * frame_bytes;
+    for (;;)
     {
-        // integer format
-        if (format_header.BlockAlign / num_channels == sizeof(short))
-        {
-            conversion_success = convert_from_raw<short>(
-                file_out, data, num_frames, num_channels, sample_rate);
-        }
-        else if (format_header.BlockAlign / num_channels == sizeof(int))
-        {
-            conversion_success = convert_from_raw<int>(
-                file_out, data, num_frames, num_channels, sample_rate);
-        }
-        else if (format_header.BlockAlign / num_channels == sizeof(long))
+        mp3_converter::throw_if_cancelled();
+
+        std::pair<const char *, size_t> block;
         {
-            conversion_success = convert_from_raw<long>(
-                file_out, data, num_frames, num_channels, sample_rate);
+            mp3_converter::stages::ScopedStage timer(
+                mp3_converter::stages::Stage::read);
+            block = reader.next_block_up_to(block_bytes);
+            timer.add(block.second, block.second / frame_bytes);
         }
-        else
-        {
+
+        // a partial frame at the end is dropped, like for files.
+        const unsigned long frames =
+            static_cast<unsigned long>(block.second / frame_bytes);
+        if (frames == 0)
+            break;
+
+        file_timer.add(block.second, frames);
+        mp3_converter::ProgressReporter::count_input(
+            block.second, frames, layout.format.SampleRate);
+        decoder.feed(lame_encoding_task, block.first, frames);
+    }
+
+    return lame_encoding_task.Finish();
+}
+
+/**
+ * @brief Estimate the memory convert_from_raw needs at its peak, rather too
+ * much than too little.
+ *
+ * Counts the lame state and buffers of every encoder running at once, the
+ * blocks read for them and the mp3 bytes segments collect before they are
+ * written. The input itself is not counted, mapped files are read through the
+ * page cache, which the kernel reclaims as needed. Several profiles share the
+ * blocks, but each has its own encoder and file.
+ */
+template<typename Decoder>
+uint64_t estimate_peak_memory(
+    const Decoder &                                    decoder,
+    unsigned long                                      num_samples,
+    int                                                sample_rate,
+    const std::vector<mp3_converter::EncodingProfile> &profiles)
+{
+    const size_t num_profiles = profiles.size();
+
+    using R = typename Decoder::lame_type;
+
+    constexpr auto block_frames =
+        mp3_converter::LameEncodingTask<R>::block_frames;
+    const unsigned long block = std::min(block_frames, num_samples);
+
+    // the output buffer of lame, the block handed out by the reader and the
+    // one it reads ahead, and the decoder's scratch buffers.
+    const uint64_t encoder_bytes =
+        lame_state_bytes + static_cast<uint64_t>(1.25 * block_frames) + 7200
+        + 2 * uint64_t {block} * decoder.frame_bytes()
+        + decoder.scratch_bytes(block);
+    const uint64_t sink_bytes = mp3_converter::FileSink::write_block;
+
+    if (num_profiles > 1)
+        return encoder_bytes
+               + num_profiles
+                     * (lame_state_bytes
+                        + static_cast<uint64_t>(1.25 * block_frames) + 7200
+                        + sink_bytes);
+
+    const unsigned long segment_samples =
+        segment_length(profiles.front(), num_samples, sample_rate);
+    if (segment_samples == 0)
+        return encoder_bytes + sink_bytes;
+
+    const uint64_t num_segments =
+        (num_samples + segment_samples - 1) / segment_samples;
+    const uint64_t in_flight =
+        std::min<uint64_t>(std::thread::hardware_concurrency(), num_segments);
+
+    // each segment collects its frames at the highest bitrate, overlap
+    // included, and hands out a copy of the kept ones.
+    const uint64_t segment_fed =
+        segment_samples + 2 * overlap_mp3_frames * 1152;
+    const uint64_t segment_mp3_bytes =
+        segment_fed * 320 * 125 / static_cast<uint64_t>(sample_rate)
+        + 16 * 1024;
+
+    return sink_bytes + in_flight * (encoder_bytes + 2 * segment_mp3_bytes);
+}
+
+// the format tags of the samples, WAVE_FORMAT_EXTENSIBLE resolved already.
+constexpr uint16_t pcm        = 1;
+constexpr uint16_t ieee_float = 3;
+
+// the channel count of a key that stands for any number above two.
+constexpr uint16_t surround = 0;
+
+/**
+ * @struct FormatKey
+ *
+ * @brief What selects a decoder: the format tag, the bits each sample takes
+ * in a frame, and the channel count, surround for more than two.
+ */
+struct FormatKey
+{
+    uint16_t format_tag;
+    uint16_t bits_per_sample;
+    uint16_t channels;
+
+    constexpr bool operator==(const FormatKey &other) const
+    {
+        return format_tag == other.format_tag
+               && bits_per_sample == other.bits_per_sample
+               && channels == other.channels;
+    }
+};
+
+/**
+ * @struct Format
+ *
+ * @brief One entry of the format table: a key and the decoder for it.
+ */
+template<uint16_t Tag, uint16_t Bits, uint16_t Channels, typename Decoder>
+struct Format
+{
+    static constexpr FormatKey key {Tag, Bits, Channels};
+    using decoder = Decoder;
+};
+
+using mp3_converter::SampleEncoding;
+
+/**
+ * @brief Every supported format. Each entry is instantiated into its own
+ * read, decode and encode loop, a new format only needs a line here.
+ */
+using Formats = std::tuple<
+    Format<pcm, 16, 1, PassThrough<int16_t, 1>>,
+    Format<pcm, 16, 2, PassThrough<int16_t, 2>>,
+    Format<pcm, 24, 1, Packed24<1>>,
+    Format<pcm, 24, 2, Packed24<2>>,
+    Format<pcm, 32, 1, PassThrough<int32_t, 1>>,
+    Format<pcm, 32, 2, PassThrough<int32_t, 2>>,
+    Format<pcm, 64, 1, Narrow64<1>>,
+    Format<pcm, 64, 2, Narrow64<2>>,
+    Format<ieee_float, 32, 1, PassThrough<float, 1>>,
+    Format<ieee_float, 32, 2, PassThrough<float, 2>>,
+    Format<ieee_float, 64, 1, PassThrough<double, 1>>,
+    Format<ieee_float, 64, 2, PassThrough<double, 2>>,
+    Format<pcm, 16, surround, Downmix<SampleEncoding::int16, 2>>,
+    Format<pcm, 24, surround, Downmix<SampleEncoding::int24, 3>>,
+    Format<pcm, 32, surround, Downmix<SampleEncoding::int32, 4>>,
+    Format<ieee_float, 32, surround, Downmix<SampleEncoding::float32, 4>>,
+    Format<ieee_float, 64, surround, Downmix<SampleEncoding::float64, 8>>>;
+
+/**
+ * @brief Build the decoder of format F for the layout and hand it to convert.
+ */
+template<typename F, typename Convert>
+bool convert_as(const mp3_converter::WaveLayout &layout, Convert &convert)
+{
+    return convert(F::decoder::for_layout(layout));
+}
+
+template<typename Convert>
+struct DispatchEntry
+{
+    FormatKey key;
+    bool (*convert)(const mp3_converter::WaveLayout &, Convert &);
+};
+
+template<typename Convert, size_t... I>
+constexpr auto make_dispatch_table(std::index_sequence<I...>)
+{
+    return std::array<DispatchEntry<Convert>, sizeof...(I)> {
+        {{std::tuple_element_t<I, Formats>::key,
+          &convert_as<std::tuple_element_t<I, Formats>, Convert>}...}};
+}
+
+/**
+ * @brief The entry points of convert for every format of the table, generated
+ * at compile time.
+ */
+template<typename Convert>
+constexpr auto dispatch_table = make_dispatch_table<Convert>(
+    std::make_index_sequence<std::tuple_size_v<Formats>>());
+
+/**
+ * @brief Pick the decoder for the sample format of the layout from the format
+ * table and hand it to convert.
+ *
+ * @throws WavefileConversionTask::wave_format_error When the format is not
+ * supported.
+ *
+ * @return What convert returned.
+ */
+template<typename Convert>
+bool with_decoder(const mp3_converter::WaveLayout &layout, Convert &&convert)
+{
+    using namespace mp3_converter;
+    using wave_format_error = WavefileConversionTask::wave_format_error;
+
+    const auto &format_header = layout.format;
+
+    const uint16_t num_channels = format_header.NumChannels;
+    if (num_channels == 0 || format_header.BlockAlign % num_channels != 0)
+        throw wave_format_error(
+            "Block alignment is no multiple of the number of channels.");
+    const size_t sample_size = format_header.BlockAlign / num_channels;
+
+    if (layout.sample_format != pcm && layout.sample_format != ieee_float)
+        throw wave_format_error(
+            "Wave format is neither PCM nor IEEE_FLOAT. Unsupported.");
+
+    const FormatKey key {layout.sample_format,
+                         static_cast<uint16_t>(sample_size * 8),
+                         num_channels > 2 ? surround : num_channels};
+
+    using Callback = std::remove_reference_t<Convert>;
+    for (const auto &entry : dispatch_table<Callback>)
+    {
+        if (entry.key == key)
+            return entry.convert(layout, convert);
+    }
+
+    if (num_channels > 2)
+        throw wave_format_error("Found multichannel samples of a size that "
+                                "can not be downmixed. Unsupported.");
+    throw wave_format_error("Found " + std::to_string(sample_size * 8)
+                            + " bit samples. Unsupported.");
+}
+} // namespace
+
+namespace mp3_converter {
+
+WavefileConversionTask::WavefileConversionTask(
+    const std::filesystem::path &       in_file,
+    const std::vector<EncodingProfile> &profiles)
+    : m_task_num(static_num_task++)
+    , m_wav_file_in(in_file)
+    , m_profiles(profiles.empty() ? default_profiles() : profiles)
+{
+}
+
+bool WavefileConversionTask::run()
+{
+    ProgressReporter::log("Thread " + std::to_string(m_task_num)
+                          + ": Starting conversion.");
+
+    stages::FileScope file_scope(m_wav_file_in);
+
+    // opened before the outputs, so a file that is no wav leaves no temp file.
+    auto reader = open_wavefile(m_wav_file_in);
+
+    std::vector<std::unique_ptr<FileSink>> files_out;
+    std::vector<ByteSink *>                outs;
+    for (const auto &profile : m_profiles)
+    {
+        files_out.push_back(std::make_unique<FileSink>(
+            output_file(m_wav_file_in, profile)));
+        outs.push_back(files_out.back().get());
+    }
+
+    return convert(*reader, outs, m_profiles);
+}
+
+bool WavefileConversionTask::convert(
+    WavefileReader &                    reader,
+    const std::vector<ByteSink *> &     outs,
+    const std::vector<EncodingProfile> &profiles)
+{
+    if (outs.size() != profiles.size() || profiles.empty())
+        throw std::invalid_argument("Need one output per encoding profile.");
+
+    stages::ScopedStage file_timer(stages::Stage::file);
+
+    const auto &layout = reader.layout();
+
+    // num frames = how many blocks of #num_channels are in file
+    const uint64_t frames_in_file = layout.data_size / layout.format.BlockAlign;
+
+    // lame counts samples in an unsigned long, 32 bit on Windows.
+    if constexpr (sizeof(unsigned long) < sizeof(uint64_t))
+    {
+        if (frames_in_file > std::numeric_limits<unsigned long>::max())
             throw wave_format_error(
-                "Found integer samples that don't align to: this platforms "
-                "length of short, int, long. Unsupported.");
-        }
+                "Data chunk holds more samples than lame can count.");
+    }
+    const auto num_frames = static_cast<unsigned long>(frames_in_file);
+    file_timer.add(layout.data_size, num_frames);
+
+    return with_decoder(layout, [&](const auto &decoder) {
+        if (profiles.size() > 1)
+            return convert_to_profiles(outs,
+                                       profiles,
+                                       reader,
+                                       decoder,
+                                       num_frames,
+                                       layout.format.SampleRate);
+
+        return convert_from_raw(*outs.front(),
+                                profiles.front(),
+                                reader,
+                                decoder,
+                                num_frames,
+                                layout.format.SampleRate);
+    });
+}
+
+bool WavefileConversionTask::convert_stream(PipeWavefileReader &   reader,
+                                            ByteSink &             out,
+                                            const EncodingProfile &profile)
+{
+    stages::FileScope   file_scope(std::filesystem::path("-"));
+    stages::ScopedStage file_timer(stages::Stage::file);
+
+    const auto &layout = reader.layout();
+
+    return with_decoder(layout, [&](const auto &decoder) {
+        return convert_from_stream(reader, decoder, profile, out, file_timer);
+    });
+}
+
+uint64_t WavefileConversionTask::estimated_peak_memory(
+    const std::filesystem::path &       in_file,
+    const std::vector<EncodingProfile> &profiles)
+{
+    // files that can not be converted fail right after their headers.
+    uint64_t estimate = lame_state_bytes + FileSink::write_block;
+
+    try
+    {
+        auto        reader = open_wavefile(in_file);
+        const auto &layout = reader->layout();
+
+        const unsigned long num_frames = static_cast<unsigned long>(
+            layout.data_size / layout.format.BlockAlign);
+
+        with_decoder(layout, [&](const auto &decoder) {
+            estimate = estimate_peak_memory(decoder,
+                                            num_frames,
+                                            layout.format.SampleRate,
+                                            profiles.empty()
+                                                ? default_profiles()
+                                                : profiles);
+            return true;
+        });
     }
-    else if (format_header.AudioFormat == 3) // IEEE float
+    catch (const std::exception &)
     {
-        if (format_header.BlockAlign / num_channels == sizeof(float))
-        {
-            conversion_success = convert_from_raw<float>(
-                file_out, data, num_frames, num_channels, sample_rate);
-        }
-        if (format_header.BlockAlign / num_channels == sizeof(double))
-        {
-            conversion_success = convert_from_raw<double>(
-                file_out, data, num_frames, num_channels, sample_rate);
-        }
+        // the conversion reports the error.
     }
+
+    return estimate;
+}
+
+std::filesystem::path
+WavefileConversionTask::output_file(const std::filesystem::path &in_file,
+                                    const EncodingProfile &      profile)
+{
+    auto file_out = in_file;
+    if (profile.name.empty())
+        file_out.replace_extension("mp3");
     else
+        file_out.replace_extension(profile.name + ".mp3");
+    return file_out;
+}
+
+bool WavefileConversionTask::outputs_exist(
+    const std::filesystem::path &       in_file,
+    const std::vector<EncodingProfile> &profiles)
+{
+    return std::all_of(
+        profiles.begin(), profiles.end(), [&](const EncodingProfile &profile) {
+            std::error_code error;
+            return std::filesystem::is_regular_file(
+                output_file(in_file, profile), error);
+        });
+}
+
+std::string WavefileConversionTask::encoder_settings(
+    const std::vector<EncodingProfile> &profiles)
+{
+    std::string settings;
+    for (const auto &profile : profiles)
     {
-        throw wave_format_error(
-            "Wave format is neither PCM nor IEEE_FLOAT. Unsupported.");
+        if (!profile.name.empty())
+            settings += (settings.empty() ? "profiles " : " ") + profile.name;
     }
+    if (settings.empty())
+        settings = "defaults";
+
+    // segmented files are encoded without bit reservoir, cut at seams that
+    // depend on these constants.
+    if (!profiles.empty() && profiles.front().segmented)
+        settings += ", segments " + std::to_string(segment_seconds)
+                    + "s, overlap " + std::to_string(overlap_mp3_frames)
+                    + " frames";
 
-    return conversion_success;
+    return std::string("lame ") + get_lame_version() + " " + settings;
 }
 
 } // namespace mp3_converter
@@ -0,0 +1,684 @@
+#include "WavefileReader.h"
+
+#include "WavefileConversionTask.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#    include <io.h>
+#else
+#    include <unistd.h>
+#endif
+
+namespace {
+using wave_format_error =
+    mp3_converter::WavefileConversionTask::wave_format_error;
+
+// blocks of a mapped file prefetched ahead of the one handed out.
+constexpr uint64_t read_ahead_blocks = 4;
+
+// data chunk size of a header written before the size was known.
+constexpr uint32_t open_chunk_size = 0xFFFFFFFFu;
+
+/**
+ * @brief Read from fd until num_bytes arrived or the stream ended.
+ *
+ * @throws std::system_error When reading fails.
+ *
+ * @return The number of bytes read.
+ */
+size_t read_full(int fd, void *to, size_t num_bytes)
+{
+    auto * bytes = static_cast<char *>(to);
+    size_t done  = 0;
+    while (done < num_bytes)
+    {
+#ifdef _WIN32
+        const auto chunk = std::min<size_t>(num_bytes - done, 1u << 30);
+        const long read =
+            _read(fd, bytes + done, static_cast<unsigned>(chunk));
+#else
+        const long read =
+            static_cast<long>(::read(fd, bytes + done, num_bytes - done));
+#endif
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read < 0)
+            throw std::system_error(errno,
+                                    std::generic_category(),
+                                    "Reading the wav stream failed");
+        if (read == 0)
+            break;
+        done += static_cast<size_t>(read);
+    }
+    return done;
+}
+
+/**
+ * @brief Pull until num_bytes arrived or the stream ended.
+ *
+ * @return The number of bytes pulled.
+ */
+size_t pull_full(const mp3_converter::PipeWavefileReader::Pull &pull,
+                 void *                                         to,
+                 size_t                                         num_bytes)
+{
+    auto * bytes = static_cast<char *>(to);
+    size_t done  = 0;
+    while (done < num_bytes)
+    {
+        const size_t pulled = pull(bytes + done, num_bytes - done);
+        if (pulled == 0)
+            break;
+        done += std::min(pulled, num_bytes - done);
+    }
+    return done;
+}
+
+/**
+ * @brief Hand out num_bytes at block, copied into copy if block is not
+ * aligned for the samples.
+ */
+const char *aligned_block(const char *                 block,
+                          size_t                       num_bytes,
+                          size_t                       alignment,
+                          mp3_converter::PooledBuffer &copy)
+{
+    if (reinterpret_cast<uintptr_t>(block) % alignment == 0)
+        return block;
+
+    // samples can not be read from a misaligned address without UB, copy them
+    // into new'd memory which is aligned for every fundamental type.
+    if (copy.size() == 0)
+        copy = mp3_converter::BufferArena::for_this_thread().acquire(num_bytes);
+    copy.resize(num_bytes);
+    std::memcpy(copy.data(), block, num_bytes);
+    return reinterpret_cast<const char *>(copy.data());
+}
+
+/**
+ * @struct MemoryCursor
+ *
+ * @brief Walks over the bytes of a mapped file or a buffer.
+ */
+struct MemoryCursor
+{
+    const char *data;
+    size_t      size;
+    size_t      position {};
+
+    bool read(void *to, size_t num_bytes)
+    {
+        if (size - position < num_bytes)
+            return false;
+        std::memcpy(to, data + position, num_bytes);
+        position += num_bytes;
+        return true;
+    }
+
+    bool skip(uint64_t num_bytes)
+    {
+        if (size - position < num_bytes)
+            return false;
+        position += num_bytes;
+        return true;
+    }
+};
+
+/**
+ * @struct StreamCursor
+ *
+ * @brief Walks over the bytes of a seekable stream.
+ */
+struct StreamCursor
+{
+    std::istream &stream;
+
+    bool read(void *to, size_t num_bytes)
+    {
+        stream.read(static_cast<char *>(to), num_bytes);
+        return static_cast<size_t>(stream.gcount()) == num_bytes;
+    }
+
+    bool skip(uint64_t num_bytes)
+    {
+        stream.seekg(num_bytes, std::ios_base::cur);
+        return stream.good();
+    }
+
+    uint64_t position() const
+    {
+        return static_cast<uint64_t>(stream.tellg());
+    }
+};
+
+/**
+ * @struct PipeCursor
+ *
+ * @brief Walks over the bytes of a stream that can only be read front to back.
+ */
+struct PipeCursor
+{
+    const mp3_converter::PipeWavefileReader::Pull &pull;
+    uint64_t                                       position {};
+
+    bool read(void *to, size_t num_bytes)
+    {
+        const size_t read = pull_full(pull, to, num_bytes);
+        position += read;
+        return read == num_bytes;
+    }
+
+    bool skip(uint64_t num_bytes)
+    {
+        // nothing to seek, read over it.
+        char discarded[4096];
+        while (num_bytes > 0)
+        {
+            const auto chunk = std::min<uint64_t>(num_bytes, sizeof(discarded));
+            if (!read(discarded, static_cast<size_t>(chunk)))
+                return false;
+            num_bytes -= chunk;
+        }
+        return true;
+    }
+};
+
+uint64_t position_of(const MemoryCursor &cursor)
+{
+    return cursor.position;
+}
+
+uint64_t position_of(const StreamCursor &cursor)
+{
+    return cursor.position();
+}
+
+uint64_t position_of(const PipeCursor &cursor)
+{
+    return cursor.position;
+}
+
+/**
+ * @brief The bytes left behind the cursor, unknown_size for pipes and
+ * streams that can not seek.
+ */
+uint64_t remaining_of(const MemoryCursor &cursor)
+{
+    return cursor.size - cursor.position;
+}
+
+uint64_t remaining_of(StreamCursor &cursor)
+{
+    // a fifo or device given by its path can not tell.
+    const auto here = cursor.stream.tellg();
+    if (here < 0)
+        return mp3_converter::WaveLayout::unknown_size;
+    cursor.stream.seekg(0, std::ios_base::end);
+    const auto end = cursor.stream.tellg();
+    cursor.stream.seekg(here);
+    return static_cast<uint64_t>(end - here);
+}
+
+uint64_t remaining_of(const PipeCursor &)
+{
+    return mp3_converter::WaveLayout::unknown_size;
+}
+
+/**
+ * @brief Parse RIFF, fmt and data headers through the given cursor, leaving it
+ * at the start of the data chunk payload.
+ *
+ * RF64 and BW64 files, whose sizes beyond 4 GiB are kept in a ds64 chunk, are
+ * read the same way.
+ */
+template<typename Cursor>
+mp3_converter::WaveLayout read_layout(Cursor &cursor)
+{
+    using namespace wavefile::chunks;
+
+    RiffHeader header;
+    if (!cursor.read(&header, sizeof(header)))
+        throw wave_format_error("File is too short for a RIFF file header.");
+
+    // use FourUnterminatedChars comparison operators to check for equivalency
+    // in a safe manner (ChunkID is unterminated string).
+    const bool is_rf64 = header.Chunk_header.ChunkID == "RF64"
+                         || header.Chunk_header.ChunkID == "BW64";
+    if (header.Chunk_header.ChunkID != "RIFF" && !is_rf64)
+    {
+        throw wave_format_error("File does not contain a RIFF file header.");
+    }
+    if (header.Format != "WAVE")
+    {
+        throw wave_format_error("File does not contain a WAVE file header.");
+    }
+
+    // the 64 bit sizes of an RF64 file, from the ds64 chunk that has to come
+    // first.
+    DataSize64               sizes64 {};
+    std::vector<ChunkSize64> table64;
+    if (is_rf64)
+    {
+        if (!cursor.read(&sizes64.Chunk_header, sizeof(CommonHeader))
+            || sizes64.Chunk_header.ChunkID != "ds64")
+            throw wave_format_error("RF64 file lacks its ds64 chunk.");
+
+        constexpr size_t ds64_fields_size =
+            sizeof(DataSize64) - sizeof(CommonHeader);
+        const uint64_t ds64_chunk_size = sizes64.Chunk_header.ChunkSize;
+        if (ds64_chunk_size < ds64_fields_size
+            || !cursor.read(&sizes64.RiffSizeLow, ds64_fields_size))
+            throw wave_format_error("ds64 chunk is too short.");
+
+        const uint64_t table_size =
+            uint64_t {sizes64.TableLength} * sizeof(ChunkSize64);
+        if (ds64_chunk_size - ds64_fields_size < table_size)
+            throw wave_format_error("ds64 chunk is too short for its table.");
+
+        table64.resize(sizes64.TableLength);
+        if (!table64.empty()
+            && !cursor.read(table64.data(), static_cast<size_t>(table_size)))
+            throw wave_format_error("ds64 chunk is too short for its table.");
+
+        if (!cursor.skip(ds64_chunk_size - ds64_fields_size - table_size
+                         + (ds64_chunk_size & 1u)))
+            throw wave_format_error("ds64 chunk is too short.");
+    }
+
+    // the size of a chunk's payload, looked up in ds64 where it does not fit
+    // the header.
+    auto size_of = [&](const CommonHeader &chunk) -> uint64_t {
+        if (!is_rf64 || chunk.ChunkSize != open_chunk_size)
+            return chunk.ChunkSize;
+        if (chunk.ChunkID == "data")
+            return sizes64.DataSize();
+        for (const auto &entry : table64)
+        {
+            if (entry.ChunkID.chars == chunk.ChunkID.chars)
+                return entry.ChunkSize();
+        }
+        return chunk.ChunkSize;
+    };
+    // there can now be a number of unknown chunks until we find "fmt", then
+    // "data"
+
+    // local lambda to check chunks until the one with the given identifier has
+    // been read in
+    auto find_chunk =
+        [&](const std::string &identifier) -> std::optional<CommonHeader> {
+        CommonHeader potential_chunk;
+
+        while (cursor.read(&potential_chunk, sizeof(CommonHeader)))
+        {
+            if (potential_chunk.ChunkID == identifier)
+            {
+                return potential_chunk;
+            }
+            // skip over the unknown  chunk, chunks are padded to an even
+            // number of bytes.
+            const uint64_t chunk_size = size_of(potential_chunk);
+            const uint64_t to_skip    = chunk_size + (chunk_size & 1u);
+            if (!cursor.skip(to_skip))
+                break;
+        }
+        return std::nullopt;
+    };
+
+    auto maybe_format_start = find_chunk("fmt ");
+    if (!maybe_format_start)
+        throw wave_format_error("Did not find fmt chunk in file.");
+
+    mp3_converter::WaveLayout layout;
+    layout.format.Chunk_header = *maybe_format_start;
+
+    // read no more than the structs hold, other extended fmt chunks carry
+    // fields we do not need after BitsPerSample.
+    constexpr size_t format_fields_size =
+        sizeof(FormatHeader) - sizeof(CommonHeader);
+    const size_t format_chunk_size = maybe_format_start->ChunkSize;
+    if (format_chunk_size < format_fields_size
+        || !cursor.read(&layout.format.AudioFormat, format_fields_size))
+        throw wave_format_error("fmt chunk is too short.");
+
+    size_t read_size     = format_fields_size;
+    layout.sample_format = layout.format.AudioFormat;
+    if (layout.format.AudioFormat == WAVE_FORMAT_EXTENSIBLE)
+    {
+        FormatExtension extension;
+        if (format_chunk_size < format_fields_size + sizeof(extension)
+            || !cursor.read(&extension, sizeof(extension)))
+            throw wave_format_error(
+                "fmt chunk is too short for its extension.");
+
+        read_size += sizeof(extension);
+        layout.sample_format =
+            static_cast<uint16_t>(extension.SubFormat[0]
+                                  | (extension.SubFormat[1] << 8));
+        layout.channel_mask = extension.ChannelMask;
+    }
+
+    if (!cursor.skip(format_chunk_size - read_size + (format_chunk_size & 1u)))
+        throw wave_format_error("fmt chunk is too short.");
+
+    if (layout.format.NumChannels == 0 || layout.format.BlockAlign == 0)
+        throw wave_format_error("fmt chunk declares no channels or samples.");
+
+    auto maybe_data_start = find_chunk("data");
+    if (!maybe_data_start)
+        throw wave_format_error("Did not find data chunk in file.");
+
+    layout.data_offset = position_of(cursor);
+    layout.data_size   = size_of(*maybe_data_start);
+
+    // the writer did not know the size when it wrote the header, the data
+    // runs to the end of the file. RF64 writers leave ds64 at 0 until done.
+    if (maybe_data_start->ChunkSize == open_chunk_size
+        && (!is_rf64 || layout.data_size == 0))
+        layout.data_size = remaining_of(cursor);
+
+    // a truncated file, reading it would run past its end. Pipes are checked
+    // as the data arrives.
+    const uint64_t available = remaining_of(cursor);
+    if (available != mp3_converter::WaveLayout::unknown_size
+        && layout.data_size > available)
+        throw wave_format_error("Data chunk ended before its given size.");
+
+    return layout;
+}
+} // namespace
+
+namespace mp3_converter {
+
+MappedWavefileReader::MappedWavefileReader(MappedFile file)
+    : m_file(std::make_shared<const MappedFile>(std::move(file)))
+{
+    MemoryCursor cursor {m_file->data(), m_file->size()};
+    m_layout = read_layout(cursor);
+
+    m_file->advise_sequential();
+}
+
+MappedWavefileReader::MappedWavefileReader(
+    std::shared_ptr<const MappedFile> file,
+    const WaveLayout &                layout,
+    uint64_t                          position)
+    : m_file(std::move(file))
+    , m_position(position)
+{
+    m_layout = layout;
+}
+
+std::unique_ptr<WavefileReader>
+MappedWavefileReader::open_at(uint64_t data_position) const
+{
+    return std::unique_ptr<WavefileReader>(
+        new MappedWavefileReader(m_file, m_layout, data_position));
+}
+
+const char *MappedWavefileReader::next_block(size_t num_bytes,
+                                             size_t alignment)
+{
+    const uint64_t start = m_layout.data_offset + m_position;
+    if (start > m_file->size() || m_file->size() - start < num_bytes)
+        throw wave_format_error("Data chunk ended before its given size.");
+
+    const char *block = m_file->data() + start;
+    m_position += num_bytes;
+
+    // keep a few blocks ahead of the reader in flight, topping the window up
+    // once less than half of it is left.
+    const uint64_t window = read_ahead_blocks * uint64_t {num_bytes};
+    const uint64_t end    = start + num_bytes;
+    if (m_prefetched_until < end + window / 2)
+    {
+        const uint64_t from = std::max(m_prefetched_until, end);
+        m_file->prefetch(static_cast<size_t>(from),
+                         static_cast<size_t>(end + window - from));
+        m_prefetched_until = end + window;
+    }
+
+    return aligned_block(block, num_bytes, alignment, m_aligned_copy);
+}
+
+MemoryWavefileReader::MemoryWavefileReader(const void *data, size_t size)
+    : m_data(static_cast<const char *>(data))
+    , m_size(size)
+{
+    MemoryCursor cursor {m_data, m_size};
+    m_layout = read_layout(cursor);
+}
+
+const char *MemoryWavefileReader::next_block(size_t num_bytes,
+                                             size_t alignment)
+{
+    const uint64_t start = m_layout.data_offset + m_position;
+    if (start > m_size || m_size - start < num_bytes)
+        throw wave_format_error("Data chunk ended before its given size.");
+
+    m_position += num_bytes;
+    return aligned_block(m_data + start, num_bytes, alignment, m_aligned_copy);
+}
+
+MemoryWavefileReader::MemoryWavefileReader(const char *      data,
+                                           size_t            size,
+                                           const WaveLayout &layout,
+                                           uint64_t          position)
+    : m_data(data)
+    , m_size(size)
+    , m_position(position)
+{
+    m_layout = layout;
+}
+
+std::unique_ptr<WavefileReader>
+MemoryWavefileReader::open_at(uint64_t data_position) const
+{
+    return std::unique_ptr<WavefileReader>(
+        new MemoryWavefileReader(m_data, m_size, m_layout, data_position));
+}
+
+StreamWavefileReader::StreamWavefileReader(const std::filesystem::path &file)
+    : m_file(file)
+{
+    m_stream.open(file.string(), std::ios_base::binary);
+
+    StreamCursor cursor {m_stream};
+    m_layout = read_layout(cursor);
+}
+
+StreamWavefileReader::~StreamWavefileReader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_ahead_mutex);
+        m_stopping = true;
+    }
+    m_ahead_changed.notify_all();
+
+    if (m_ahead_thread.joinable())
+        m_ahead_thread.join();
+}
+
+const char *StreamWavefileReader::next_block(size_t num_bytes,
+                                             size_t /*alignment*/)
+{
+    size_t read = 0;
+    if (finish_read_ahead() && m_ahead_position == m_position
+        && m_ahead_size == num_bytes)
+    {
+        read = num_bytes;
+        std::swap(m_block, m_ahead);
+    }
+    else
+    {
+        // nothing read ahead, or not what the caller wants now. New'd memory
+        // is aligned for every fundamental type.
+        if (m_block.size() == 0)
+            m_block = BufferArena::for_this_thread().acquire(num_bytes);
+        m_block.resize(num_bytes);
+        read = read_at(m_block.data(), m_position, num_bytes);
+    }
+
+    if (read != num_bytes)
+        throw wave_format_error("Data chunk ended before its given size.");
+    m_position += num_bytes;
+
+    // guess the next block has the same size, as all but the last one have.
+    const uint64_t left =
+        m_layout.data_size > m_position ? m_layout.data_size - m_position : 0;
+    if (left > 0)
+    {
+        // borrowed here, so the buffers go back to the caller's arena.
+        const auto size =
+            static_cast<size_t>(std::min<uint64_t>(left, num_bytes));
+        if (m_ahead.size() == 0)
+            m_ahead = BufferArena::for_this_thread().acquire(size);
+        m_ahead.resize(size);
+
+        if (!m_ahead_thread.joinable())
+            m_ahead_thread = std::thread([this] { read_ahead_loop(); });
+        {
+            std::lock_guard<std::mutex> lock(m_ahead_mutex);
+            m_ahead_position = m_position;
+            m_ahead_size     = size;
+            m_ahead_state    = ReadAhead::requested;
+        }
+        m_ahead_changed.notify_all();
+    }
+
+    return reinterpret_cast<const char *>(m_block.data());
+}
+
+bool StreamWavefileReader::finish_read_ahead()
+{
+    std::unique_lock<std::mutex> lock(m_ahead_mutex);
+    m_ahead_changed.wait(
+        lock, [this] { return m_ahead_state != ReadAhead::requested; });
+
+    const bool complete =
+        m_ahead_state == ReadAhead::done && m_ahead_read == m_ahead_size;
+    m_ahead_state = ReadAhead::idle;
+    return complete;
+}
+
+void StreamWavefileReader::read_ahead_loop()
+{
+    std::unique_lock<std::mutex> lock(m_ahead_mutex);
+    for (;;)
+    {
+        m_ahead_changed.wait(lock, [this] {
+            return m_ahead_state == ReadAhead::requested || m_stopping;
+        });
+        if (m_stopping)
+            return;
+
+        const uint64_t position = m_ahead_position;
+        const size_t   size     = m_ahead_size;
+        lock.unlock();
+        const size_t read = read_at(m_ahead.data(), position, size);
+        lock.lock();
+
+        m_ahead_read  = read;
+        m_ahead_state = ReadAhead::done;
+        m_ahead_changed.notify_all();
+    }
+}
+
+size_t StreamWavefileReader::read_at(unsigned char *to,
+                                     uint64_t       data_position,
+                                     size_t         num_bytes)
+{
+    m_stream.clear();
+    m_stream.seekg(
+        static_cast<std::streamoff>(m_layout.data_offset + data_position));
+    m_stream.read(reinterpret_cast<char *>(to),
+                  static_cast<std::streamsize>(num_bytes));
+    return static_cast<size_t>(m_stream.gcount());
+}
+
+std::unique_ptr<WavefileReader>
+StreamWavefileReader::open_at(uint64_t data_position) const
+{
+    auto reader        = std::make_unique<StreamWavefileReader>(m_file);
+    reader->m_position = data_position;
+    return reader;
+}
+
+PipeWavefileReader::PipeWavefileReader(int fd)
+    : PipeWavefileReader([fd](void *buffer, size_t num_bytes) {
+        return read_full(fd, buffer, num_bytes);
+    })
+{
+}
+
+PipeWavefileReader::PipeWavefileReader(Pull pull)
+    : m_pull(std::move(pull))
+{
+    PipeCursor cursor {m_pull};
+    m_layout = read_layout(cursor);
+
+    // writers that can not seek back into a pipe may also leave the size at 0.
+    if (m_layout.data_size == 0)
+        m_layout.data_size = WaveLayout::unknown_size;
+}
+
+const char *PipeWavefileReader::next_block(size_t num_bytes,
+                                           size_t /*alignment*/)
+{
+    const auto block = next_block_up_to(num_bytes);
+    if (block.second != num_bytes)
+        throw wave_format_error("Data chunk ended before its given size.");
+    return block.first;
+}
+
+std::pair<const char *, size_t>
+PipeWavefileReader::next_block_up_to(size_t num_bytes)
+{
+    const bool size_known = m_layout.data_size != WaveLayout::unknown_size;
+    if (size_known)
+        num_bytes = static_cast<size_t>(
+            std::min<uint64_t>(num_bytes, m_layout.data_size - m_position));
+
+    // new'd memory is aligned for every fundamental type.
+    if (m_block.size() == 0)
+        m_block = BufferArena::for_this_thread().acquire(num_bytes);
+    m_block.resize(num_bytes);
+
+    const size_t read = pull_full(m_pull, m_block.data(), num_bytes);
+    if (read != num_bytes && size_known)
+        throw wave_format_error("Data chunk ended before its given size.");
+    m_position += read;
+
+    return {reinterpret_cast<const char *>(m_block.data()), read};
+}
+
+std::unique_ptr<WavefileReader>
+PipeWavefileReader::open_at(uint64_t /*data_position*/) const
+{
+    throw std::logic_error("A wav stream from a pipe can not be reopened.");
+}
+
+std::unique_ptr<WavefileReader>
+open_wavefile(const std::filesystem::path &file)
+{
+    try
+    {
+        return std::make_unique<MappedWavefileReader>(MappedFile(file));
+    }
+    catch (const std::system_error &)
+    {
+        // not mappable (empty, special file, address space exhausted...), the
+        // stream reader will either cope or report a readable error.
+        return std::make_unique<StreamWavefileReader>(file);
+    }
+}
+
+} // namespace mp3_converter
@@ -1,45 +1,225 @@
+#include "AdmissionControl.h"
+#include "BoundedQueue.h"
+#include "ByteSink.h"
+#include "Cancellation.h"
+#include "ConcurrencyController.h"
+#include "ConversionDaemon.h"
+#include "DuplicateIndex.h"
+#include "EncodeManifest.h"
+#include "FileConversion.h"
+#include "MappedFile.h"
+#include "Mp3Encoder.h"
+#include "ProgramOptions.h"
+#include "ProgressReporter.h"
+#include "ShutdownSignal.h"
+#include "StageTimers.h"
+#include "ThreadPool.h"
 #include "WavefileConversionTask.h"
+#include "WavefileReader.h"
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <filesystem>
+#include <fstream>
 #include <future>
+#include <functional>
 #include <iostream>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#    include <fcntl.h>
+#    include <io.h>
+#else
+#    include <unistd.h>
+#endif
 
 using namespace std::filesystem;
 
 namespace {
+// files found by the recursive scan that may wait for a free worker.
+constexpr size_t discovery_queue_capacity = 1024;
+
+// bytes read ahead from a file queued for conversion, enough for the headers
+// and the first blocks of samples.
+constexpr size_t header_prefetch_bytes = 64 * 1024;
+
+// workers per core adaptive concurrency may activate at most, for storage so
+// slow that most workers wait on it.
+constexpr unsigned int max_workers_per_core = 4;
+
+// how long conversions in flight may take to finish after SIGINT or SIGTERM
+// before they are cancelled.
+constexpr std::chrono::seconds shutdown_grace(10);
+
 void print_usage()
 {
     std::cout << "Converts all .wav files in a given folder to mp3 files in "
                  "the same folder\n\n"
-              << "Usage: mp3_converter [dir]\n"
+              << "Usage: mp3_converter [options] [dir]\n"
+              << "       mp3_converter [options] - < in.wav > out.mp3\n"
               << "Start this program with a single dir as a paramter.\n"
-              << "The parameter is not traversed recursively!\n"
+              << "The parameter is not traversed recursively, unless asked "
+                 "to!\n"
+              << "With - instead of a dir, a wav stream is read from stdin and "
+                 "the mp3 is\n"
+              << "written to stdout while it is encoded.\n\n"
+              << "Options:\n"
+              << "  -r, --recursive    Also convert wav files in all sub "
+                 "folders. Conversion\n"
+              << "                     starts while the folders are still "
+                 "being scanned.\n"
+              << "  -i, --incremental  Skip files that did not change since "
+                 "their mp3 was\n"
+              << "                     written, as recorded in "
+              << mp3_converter::EncodeManifest::file_name << ".\n"
+              << "  --daemon SOCKET    Keep running and convert the jobs "
+                 "sent to the Unix\n"
+              << "                     socket SOCKET on a warm pool, "
+                 "protocol in README.\n"
+              << "  -p, --profile P    Write name.P.mp3 with lame profile P: "
+                 "V0 to V9 or a\n"
+              << "                     bitrate such as 128k, optionally with "
+                 "-mono. Repeat to\n"
+              << "                     encode several from one read of each "
+                 "file.\n"
+              << "  --dedup            Encode files with the same audio "
+                 "once, the others get\n"
+              << "                     reflinks, hard links or copies of its "
+                 "mp3s.\n"
+              << "  --segment          Encode files of a minute and more in "
+                 "30 s segments on\n"
+              << "                     all cores. Faster for a few long "
+                 "files, but without\n"
+              << "                     lame's bit reservoir: a little lower "
+                 "quality.\n"
+              << "  --adaptive         Tune the number of workers to the "
+                 "measured throughput\n"
+              << "                     while converting, instead of a fixed "
+                 "1.2 per core.\n"
+              << "  --max-memory SIZE  Start files only while their "
+                 "estimated peak memory\n"
+              << "                     fits into SIZE together, e.g. 512M or "
+                 "4G.\n"
+              << "  --timeout DURATION Fail a file whose conversion takes "
+                 "longer, e.g. 90s,\n"
+              << "                     500ms or 5m. Seconds without a "
+                 "suffix.\n"
+              << "  --stats FILE       Write time, bytes and samples spent per "
+                 "stage and\n"
+              << "                     file as json.\n"
+              << "  --trace FILE       Write every timed stage as a Chrome "
+                 "trace.\n"
+              << "  -h, --help         Print this message.\n"
               << std::endl;
 }
 
-std::vector<path> list_all_wav_files(const path &directory)
+/**
+ * @struct WavFile
+ *
+ * @brief A wav file found in the directory, with its size as the estimate of
+ * how long it takes to convert.
+ */
+struct WavFile
 {
-    std::vector<path> files;
+    path      file;
+    uintmax_t size;
+};
 
-    directory_iterator dir_contents(directory);
+/**
+ * @struct Conversion
+ *
+ * @brief A submitted conversion and the file it converts, the first one of a
+ * batch of small files.
+ */
+struct Conversion
+{
+    path              file;
+    std::future<bool> result;
+};
 
-    for (const auto &file : dir_contents)
-    {
-        if (file.is_regular_file() && file.path().extension() == ".wav")
-        {
-            files.emplace_back(file.path());
-        }
-    }
+std::vector<WavFile> list_all_wav_files(const path &directory)
+{
+    std::vector<WavFile> files;
+
+    const auto error = mp3_converter::for_each_wav_file(
+        directory, false, [&](const directory_entry &file) {
+            // the directory entry usually has the size cached from
+            // iterating, so this does not cost an extra stat. A file removed
+            // since it was listed is skipped.
+            std::error_code size_error;
+            const auto      size = file.file_size(size_error);
+            if (!size_error)
+                files.push_back({file.path(), size});
+            return true;
+        });
+    if (error)
+        throw std::filesystem::filesystem_error(
+            "Scanning failed", directory, error);
 
     return files;
 }
 
-// credit for the following two classes to:
+/**
+ * @brief Walk the whole tree below directory and push every wav file into the
+ * queue as soon as it is found, then close the queue.
+ *
+ * Unreadable folders are skipped instead of ending the scan.
+ */
+void discover_wav_files(const path &                      directory,
+                        mp3_converter::BoundedQueue<path> &discovered)
+{
+    const auto error = mp3_converter::for_each_wav_file(
+        directory, true, [&](const directory_entry &entry) {
+            return discovered.push(entry.path());
+        });
+
+    if (error)
+        std::cerr << "Scanning " + directory.string()
+                         + " stopped early: " + error.message() + "\n";
+
+    discovered.close();
+}
+
+/**
+ * @class DiscoveryThread
+ *
+ * @brief Runs discover_wav_files on its own thread and joins it on every way
+ * out of the scope, also while an exception unwinds. The queue is closed
+ * first, so the scan is not left waiting for room in it.
+ */
+class DiscoveryThread
+{
+  public:
+    DiscoveryThread(const path &                       directory,
+                    mp3_converter::BoundedQueue<path> &discovered)
+        : m_discovered(discovered)
+        , m_thread(discover_wav_files, directory, std::ref(discovered))
+    {
+    }
+
+    ~DiscoveryThread()
+    {
+        m_discovered.close();
+        m_thread.join();
+    }
+
+    DiscoveryThread(const DiscoveryThread &) = delete;
+    DiscoveryThread &operator=(const DiscoveryThread &) = delete;
+
+  private:
+    mp3_converter::BoundedQueue<path> &m_discovered;
+    std::thread                        m_thread;
+};
+
+// credit for the following classes to:
 // https://stackoverflow.com/questions/17196402/is-using-stdasync-many-times-for-small-tasks-performance-friendly
 class Semaphore
 {
@@ -69,48 +249,267 @@ class Semaphore
     }
 };
 
-class Semaphore_waiter_notifier
+class Semaphore_notifier
 {
     Semaphore &s;
 
   public:
-    Semaphore_waiter_notifier(Semaphore &s)
+    Semaphore_notifier(Semaphore &s)
         : s {s}
     {
-        s.wait();
     }
 
-    ~Semaphore_waiter_notifier()
+    ~Semaphore_notifier()
     {
         s.notify();
     }
 };
 
-// start a few more threads than hardware concurrency is good for.
-Semaphore thread_limiter(
-    static_cast<unsigned int>(std::thread::hardware_concurrency() * 1.2));
+/**
+ * @brief Whether stdout is an interactive terminal rather than a file or pipe.
+ */
+bool stdout_is_terminal()
+{
+#ifdef _WIN32
+    return _isatty(_fileno(stdout)) != 0;
+#else
+    return isatty(STDOUT_FILENO) != 0;
+#endif
+}
+
+/**
+ * @brief Wrap a conversion job so it reports its file as soon as it
+ * completes, whatever the outcome. Exceptions still reach the job's future.
+ */
+std::function<bool()> reporting_job(std::function<bool()>            job,
+                                    size_t                           index,
+                                    const path &                     file,
+                                    mp3_converter::ProgressReporter &reporter)
+{
+    return [job = std::move(job), index, file, &reporter] {
+        const std::string msg_prefix {"Thread " + std::to_string(index) + ": "};
+        try
+        {
+            const bool success = job();
+            reporter.file_done(success ? msg_prefix + "converted file "
+                                             + file.string()
+                                       : msg_prefix + "failed.",
+                               success);
+            return success;
+        }
+        catch (const std::exception &e)
+        {
+            reporter.file_done(msg_prefix + "converting file " + file.string()
+                                   + " failed with exception: " + e.what(),
+                               false);
+            throw;
+        }
+    };
+}
+
+/**
+ * @brief Wrap a conversion job so it gives up once its deadline passed or the
+ * shutdown was cancelled, and does not start at all after a shutdown was asked
+ * for. Jobs not started count into not_started and report nothing.
+ */
+std::function<bool()>
+cancellable_job(std::function<bool()>                  job,
+                const mp3_converter::ShutdownSignal &  signal,
+                const mp3_converter::CancellationToken &shutdown,
+                std::chrono::milliseconds              timeout,
+                std::atomic<size_t> &                  not_started)
+{
+    return [job = std::move(job), &signal, &shutdown, timeout, &not_started] {
+        if (signal.requested())
+        {
+            ++not_started;
+            return false;
+        }
+
+        mp3_converter::CancellationToken token(&shutdown, timeout);
+        mp3_converter::CancellationScope cancellation(&token);
+        return job();
+    };
+}
+
+unsigned int num_cores()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// start a few more workers than hardware concurrency, so the cores stay busy
+// while some workers wait for the disk. Adaptive concurrency starts one per
+// core and may activate the rest.
+unsigned int num_workers(const mp3_converter::ProgramOptions &options)
+{
+    if (options.adaptive)
+        return num_cores() * max_workers_per_core;
+    return static_cast<unsigned int>(num_cores() * 1.2);
+}
+
+/**
+ * @brief Write the stage timings to the files asked for on the command line.
+ *
+ * @return False if a file could not be written.
+ */
+bool write_stage_reports(const mp3_converter::ProgramOptions &options)
+{
+    namespace stages = mp3_converter::stages;
+
+    bool success = true;
+    auto write   = [&](const path &file, void (*writer)(std::ostream &)) {
+        if (file.empty())
+            return;
+
+        std::ofstream out(file);
+        writer(out);
+        out.flush();
+        if (!out)
+        {
+            std::cerr << "Could not write " + file.string() + "\n";
+            success = false;
+        }
+    };
+
+    write(options.stats_file, stages::write_summary);
+    write(options.trace_file, stages::write_trace);
+    return success;
+}
+
+/**
+ * @brief Convert the wav stream on stdin to mp3 on stdout. Messages go to
+ * stderr only, stdout carries nothing but the mp3.
+ *
+ * @return The exit code.
+ */
+int convert_standard_streams(const mp3_converter::ProgramOptions &options)
+{
+#ifdef _WIN32
+    // no newline translation on either stream.
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    int exit_code = 0;
+    try
+    {
+        // unbuffered, so every block of frames leaves as soon as it is done.
+        mp3_converter::DescriptorSink out(1);
+
+        mp3_converter::CancellationToken token(nullptr, options.timeout);
+        mp3_converter::CancellationScope cancellation(&token);
+
+        auto pull = [](void *buffer, size_t num_bytes) {
+            return std::fread(buffer, 1, num_bytes, stdin);
+        };
+        auto push = [&out](const unsigned char *data, size_t size) {
+            out.write(data, size);
+        };
+        if (!mp3_converter::encode_wav_stream(
+                pull, push, options.profiles.front())
+            || !out.close())
+        {
+            std::cerr << "Converting the wav stream failed.\n";
+            exit_code = -1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Converting the wav stream failed with exception: "
+                  << e.what() << "\n";
+        exit_code = -1;
+    }
+
+    if (mp3_converter::stages::enabled() && !write_stage_reports(options))
+        exit_code = -1;
+    return exit_code;
+}
+
+/**
+ * @brief Serve jobs on the daemon socket until a client asks to shut down.
+ *
+ * @return The exit code.
+ */
+int serve_daemon(const mp3_converter::ProgramOptions &options)
+{
+    // prints the workers' lines, a daemon's output is mostly a log file.
+    mp3_converter::ProgressReporter reporter(std::cout, false);
+
+    // the pool and the manifests stay warm from one job to the next.
+    mp3_converter::ThreadPool pool(num_workers(options));
+
+    std::optional<mp3_converter::ConcurrencyController> controller;
+    if (options.adaptive)
+        controller.emplace(pool, num_cores());
+
+    // cancelled once the grace period after a signal ran out.
+    mp3_converter::CancellationToken shutdown;
+
+    int exit_code = 0;
+    try
+    {
+        mp3_converter::ConversionDaemon daemon(options.daemon_socket,
+                                               pool,
+                                               options.profiles,
+                                               options.max_memory,
+                                               options.timeout,
+                                               &shutdown);
+
+        // a signal stops accepting like a shutdown request does.
+        mp3_converter::ShutdownSignal signal(
+            shutdown, shutdown_grace, [&daemon] { daemon.stop(); });
+
+        mp3_converter::ProgressReporter::log("Listening on "
+                                             + options.daemon_socket.string());
+        daemon.serve();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << std::string(e.what()) + "\n";
+        exit_code = -1;
+    }
+
+    if (mp3_converter::stages::enabled() && !write_stage_reports(options))
+        exit_code = -1;
+    return exit_code;
+}
+
 } // namespace
 
 int main(int argc, char *argv[])
 {
-    if (argc == 1)
+    mp3_converter::ProgramOptions options;
+    try
     {
-        print_usage();
-        return 0;
+        options = mp3_converter::parse_program_options(argc, argv);
     }
-
-    if (argc > 2)
+    catch (const mp3_converter::usage_error &e)
     {
-        std::cerr << "Too many parameters!\n\n";
+        std::cerr << e.what() << "\n\n";
+        print_usage();
         return -1;
     }
-    if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help")
+
+    if (options.show_help)
     {
         print_usage();
         return 0;
     }
 
-    path potential_dir(argv[1]);
+    const bool want_stage_reports =
+        !options.stats_file.empty() || !options.trace_file.empty();
+    if (want_stage_reports && !mp3_converter::stages::compiled_in())
+        std::cerr << "Built without stage timers (ENABLE_STAGE_TIMERS), "
+                     "--stats and --trace are ignored.\n";
+    else if (want_stage_reports)
+        mp3_converter::stages::enable(!options.trace_file.empty());
+
+    if (options.streaming)
+        return convert_standard_streams(options);
+    if (!options.daemon_socket.empty())
+        return serve_daemon(options);
+
+    const path &potential_dir = options.directory;
     if (!is_directory(potential_dir))
     {
         std::cerr << "Given parameter: " << potential_dir
@@ -120,63 +519,340 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    auto wav_file_list = list_all_wav_files(potential_dir);
-    if (wav_file_list.size() == 0)
-    {
-        std::cerr << "No wav files found in folder " << potential_dir
-                  << ". Did no work." << std::endl;
-        return -1;
-    }
-
     // we got valid parameters.
 
-    auto conversion_task = [](const path &wav_file) {
-        Semaphore_waiter_notifier {thread_limiter};
-        mp3_converter::WavefileConversionTask task(wav_file);
-        return task.run();
+    // outlives the jobs that follow it, see cancellable_job.
+    mp3_converter::CancellationToken shutdown;
+    mp3_converter::ShutdownSignal    signal(shutdown, shutdown_grace);
+    std::atomic<size_t>              not_started {0};
+
+    // the only thread writing to stdout from here on. Jobs report their file
+    // as they complete, so a slow file does not hold back the ones after it.
+    mp3_converter::ProgressReporter reporter(std::cout, stdout_is_terminal());
+
+    mp3_converter::ThreadPool pool(num_workers(options));
+
+    std::optional<mp3_converter::ConcurrencyController> controller;
+    if (options.adaptive)
+        controller.emplace(pool, num_cores());
+
+    // while scanning recursively, only submit a few jobs per worker ahead, so
+    // the pool does not queue up the whole tree while the workers are busy.
+    // Outlives the jobs, they all end before their results are collected.
+    Semaphore in_flight(pool.size() * 2);
+
+    // with a memory budget, jobs wait for their estimated peak memory before
+    // they go to the pool. One job per worker is admitted at most, so there
+    // are always a few waiting ones to pick a smaller file from.
+    std::optional<mp3_converter::AdmissionControl> admission;
+    if (options.max_memory > 0)
+        admission.emplace(pool, options.max_memory, pool.size());
+
+    std::vector<Conversion> conversions;
+
+    // numbers the report lines of the files in the order they are submitted.
+    size_t files_submitted = 0;
+
+    // a file's conversion with its deadline and its report line.
+    auto file_job = [&](const path &file, std::function<bool()> job) {
+        job = reporting_job(std::move(job), files_submitted++, file, reporter);
+        return cancellable_job(
+            std::move(job), signal, shutdown, options.timeout, not_started);
+    };
+
+    // a batch's files are converted one after the other, so it needs as much
+    // memory as its largest.
+    auto peak_memory = [&](const std::vector<path> &files) {
+        uint64_t peak = 0;
+        if (admission)
+            for (const auto &file : files)
+                peak = std::max(
+                    peak,
+                    mp3_converter::WavefileConversionTask::
+                        estimated_peak_memory(file, options.profiles));
+        return peak;
     };
 
-    std::vector<std::future<bool>> futures;
+    auto submit = [&](uint64_t peak_memory, std::function<bool()> job) {
+        if (!admission)
+            return pool.submit(std::move(job));
+        return admission->submit(peak_memory, std::move(job));
+    };
 
-    std::for_each(
-        wav_file_list.cbegin(), wav_file_list.cend(), [&](const auto &path) {
-            std::future<bool> wav_task =
-                std::async(std::launch::async, conversion_task, path);
-            futures.emplace_back(std::move(wav_task));
-        });
+    std::optional<mp3_converter::EncodeManifest> manifest;
+    const auto                                   settings =
+        mp3_converter::WavefileConversionTask::encoder_settings(
+            options.profiles);
+    if (options.incremental)
+        manifest.emplace(potential_dir);
+
+    // files skipped since their mp3 is up to date, decided by a stat only.
+    size_t up_to_date = 0;
+
+    std::optional<mp3_converter::DuplicateIndex> duplicates;
+    if (options.deduplicate)
+        duplicates.emplace();
+
+    auto make_job = [&](const path &file) -> std::function<bool()> {
+        const auto &profiles = options.profiles;
+        auto *const index    = duplicates ? &*duplicates : nullptr;
+        if (manifest)
+            return [&manifest, &settings, &profiles, index, file] {
+                return mp3_converter::convert_incrementally(
+                    file, *manifest, settings, profiles, index);
+            };
+        if (index)
+            return [&profiles, index, file] {
+                return mp3_converter::convert_deduplicated(
+                    file, *index, profiles);
+            };
+        return [&profiles, file] {
+            return mp3_converter::convert_file(file, profiles);
+        };
+    };
+
+    // small files are converted back to back as one job, see convert_batch.
+    // Each still has its own deadline and report line.
+    auto batch_job = [&](const std::vector<path> &files) {
+        std::vector<std::function<bool()>> jobs;
+        for (const auto &file : files)
+            jobs.push_back(file_job(file, make_job(file)));
 
-    for (size_t i = 0; i < futures.size(); ++i)
+        return [jobs = std::move(jobs)] {
+            return mp3_converter::convert_batch(jobs) == jobs.size();
+        };
+    };
+
+    if (options.recursive)
     {
-        const std::string msg_prefix {"Thread " + std::to_string(i) + ": "};
-        try
+        // the scan runs on its own thread and feeds a bounded queue, so the
+        // first conversions start right away instead of after the scan.
+        mp3_converter::BoundedQueue<path> discovered(discovery_queue_capacity);
+        DiscoveryThread discovery(potential_dir, discovered);
+
+        std::vector<path> batch;
+        auto              submit_batch = [&] {
+            if (batch.empty())
+                return;
+
+            in_flight.wait();
+            conversions.push_back(
+                {batch.front(),
+                 submit(peak_memory(batch),
+                        [&in_flight, job = batch_job(batch)] {
+                            Semaphore_notifier release_slot {in_flight};
+                            return job();
+                        })});
+            batch.clear();
+        };
+
+        while (auto file = discovered.pop())
         {
-            auto &thread_result = futures[i];
+            // ends the scan, it finds the queue closed.
+            if (signal.requested())
+            {
+                discovered.close();
+                break;
+            }
 
-            constexpr std::chrono::minutes timeout(2);
+            if (manifest
+                && manifest->is_up_to_date(*file, settings, options.profiles))
+            {
+                ++up_to_date;
+                continue;
+            }
 
-            auto success = thread_result.get();
+            std::error_code error;
+            const auto      size = std::filesystem::file_size(*file, error);
+            reporter.expect(1, error ? 0 : size);
 
-            if (success)
+            if (!error && size <= mp3_converter::small_file_bytes)
             {
-                // using to_string instead of operator since this is
-                // multi_threaded io and submitting one stream prevents it from
-                // being cut of by asynchronous I/O.
-                std::cout << msg_prefix + "converted file "
-                                 + wav_file_list[i].string() + "\n";
+                // handed over once full, or right away while the workers run
+                // out of work, so they never wait for a batch to fill.
+                batch.push_back(*file);
+                if (batch.size() >= mp3_converter::max_batch_files
+                    || pool.queued() == 0)
+                    submit_batch();
+                continue;
             }
+
+            in_flight.wait();
+
+            // queued behind at most two jobs per worker, the header read can
+            // start right away.
+            mp3_converter::prefetch_file_head(*file, header_prefetch_bytes);
+            // the slot is given back outside the file's job, which does not
+            // run at all once a shutdown was asked for.
+            conversions.push_back(
+                {*file,
+                 submit(peak_memory({*file}),
+                        [&in_flight, job = file_job(*file, make_job(*file))] {
+                            Semaphore_notifier release_slot {in_flight};
+                            return job();
+                        })});
+        }
+
+        // a batch still filling when the shutdown came is not started either.
+        if (signal.requested())
+            not_started += batch.size();
+        else
+            submit_batch();
+    }
+    else
+    {
+        auto wav_file_list = list_all_wav_files(potential_dir);
+
+        // largest first, the data chunk makes up nearly all of a wav file.
+        // That way the batch does not end waiting for a big file that started
+        // last.
+        std::stable_sort(wav_file_list.begin(),
+                         wav_file_list.end(),
+                         [](const WavFile &lhs, const WavFile &rhs) {
+                             return lhs.size > rhs.size;
+                         });
+
+        std::vector<WavFile> to_convert;
+        uintmax_t            to_convert_bytes = 0;
+        for (const auto &wav : wav_file_list)
+        {
+            if (manifest
+                && manifest->is_up_to_date(
+                    wav.file, settings, options.profiles))
+                ++up_to_date;
             else
             {
-                std::cout << msg_prefix + "failed.\n";
+                to_convert.push_back(wav);
+                to_convert_bytes += wav.size;
             }
         }
-        catch (const std::exception &e)
+        reporter.expect(to_convert.size(), to_convert_bytes);
+
+        // sorted, so the small files are all at the end.
+        const auto first_small = std::partition_point(
+            to_convert.begin(), to_convert.end(), [](const WavFile &wav) {
+                return wav.size > mp3_converter::small_file_bytes;
+            });
+
+        // files with the same audio have the same size, so they are next to
+        // each other. Moving the repeated sizes to the end of their group
+        // lets the first of each encode before the others wait for it.
+        if (duplicates)
         {
-            std::cout << msg_prefix + "converting file "
-                             + wav_file_list[i].string()
-                             + " failed with exception: " + e.what() + "\n";
+            for (const auto &[first, last] :
+                 {std::pair {to_convert.begin(), first_small},
+                  std::pair {first_small, to_convert.end()}})
+            {
+                std::vector<WavFile> repeated;
+                auto                 kept = first;
+                for (auto wav = first; wav != last; ++wav)
+                {
+                    if (wav != first && wav->size == (wav - 1)->size)
+                        repeated.push_back(*wav);
+                    else
+                        *kept++ = *wav;
+                }
+                std::copy(repeated.begin(), repeated.end(), kept);
+            }
+        }
+
+        const auto num_large =
+            static_cast<size_t>(first_small - to_convert.begin());
+
+        // each job starts the header read of the file that is started after
+        // all workers moved on, so it is in memory by the time it is opened.
+        for (size_t i = 0; i < num_large && !signal.requested(); ++i)
+        {
+            const size_t next = i + pool.active_limit();
+            const path & file = to_convert[i].file;
+            conversions.push_back(
+                {file,
+                 submit(peak_memory({file}),
+                        file_job(file,
+                                 [job       = make_job(file),
+                                  next_file = next < to_convert.size()
+                                                  ? to_convert[next].file
+                                                  : path()] {
+                                     if (!next_file.empty())
+                                         mp3_converter::prefetch_file_head(
+                                             next_file, header_prefetch_bytes);
+                                     return job();
+                                 }))});
+        }
+
+        // a few batches per worker at least, so a handful of small files
+        // still spread over all of them.
+        const size_t batch_files = std::clamp<size_t>(
+            (to_convert.size() - num_large) / (pool.size() * size_t {4}),
+            1,
+            mp3_converter::max_batch_files);
+        for (size_t i = num_large; i < to_convert.size() && !signal.requested();
+             i += batch_files)
+        {
+            std::vector<path> batch;
+            for (size_t j = i; j < std::min(i + batch_files, to_convert.size());
+                 ++j)
+                batch.push_back(to_convert[j].file);
+
+            conversions.push_back(
+                {batch.front(), submit(peak_memory(batch), batch_job(batch))});
         }
     }
 
+    if (up_to_date > 0)
+        reporter.log(std::to_string(up_to_date)
+                     + " files are up to date, skipped them.");
+
+    if (conversions.size() == 0 && up_to_date == 0 && !signal.requested())
+    {
+        std::cerr << "No wav files found in folder " << potential_dir
+                  << ". Did no work." << std::endl;
+        return -1;
+    }
+
+    // the jobs reported themselves, only wait for the last ones to end.
+    for (auto &conversion : conversions)
+        conversion.result.wait();
+
+    int exit_code = 0;
+
+    if (duplicates && duplicates->duplicates() > 0)
+    {
+        char summary[160];
+        std::snprintf(summary,
+                      sizeof(summary),
+                      "%zu files had the audio of another file: %.1f MB of "
+                      "wav not encoded, %.1f MB of mp3 shared.",
+                      duplicates->duplicates(),
+                      static_cast<double>(duplicates->wav_bytes_saved()) / 1e6,
+                      static_cast<double>(duplicates->mp3_bytes_shared())
+                          / 1e6);
+        reporter.log(summary);
+    }
+
+    if (signal.requested())
+    {
+        reporter.log("Interrupted, " + std::to_string(not_started)
+                     + " queued files were not started.");
+        exit_code = -1;
+    }
+
+    if (want_stage_reports && mp3_converter::stages::compiled_in()
+        && !write_stage_reports(options))
+        exit_code = -1;
+
+    if (manifest)
+    {
+        try
+        {
+            manifest->save();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << "\n";
+            exit_code = -1;
+        }
+    }
 
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,136 @@
+#include "EncodingProfile.h"
+#include "FileConversion.h"
+#include "SyntheticWav.h"
+#include "ThreadPool.h"
+#include "WavefileConversionTask.h"
+
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/**
+ * Converts wav files to several profiles at once on a thread pool, so the
+ * encoders and output files of all but the first profile are driven from
+ * other workers than the one converting the file, and compares every mp3 with
+ * the same profile converted on its own.
+ *
+ * Meant to be run in a build with -DBUILD_WITH_TSAN=ON as well, which fails
+ * it on any data race between the workers.
+ *
+ * Usage: multi_profile_test [folder], a temporary folder by default.
+ */
+
+namespace {
+namespace fs    = std::filesystem;
+namespace bench = mp3_converter::bench;
+
+// rounds over all files, so workers reuse the buffers of earlier files.
+constexpr int rounds = 3;
+
+// more than files, so idle workers steal the encoders of other profiles
+// while busy ones convert a file of their own.
+constexpr unsigned int workers = 8;
+
+std::vector<bench::SyntheticFormat> test_formats()
+{
+    return {{"stereo16", 1, 2, 16, 44100, 4.0},
+            {"mono16", 1, 1, 16, 22050, 3.0},
+            {"stereo24", 1, 2, 24, 48000, 2.0},
+            {"stereo_float", 3, 2, 32, 44100, 2.0}};
+}
+
+std::string contents(const fs::path &file)
+{
+    std::ifstream in(file, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>()};
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    using mp3_converter::EncodingProfile;
+    using mp3_converter::WavefileConversionTask;
+
+    const fs::path folder =
+        argc > 1 ? fs::path(argv[1])
+                 : fs::temp_directory_path() / "mp3_converter_multi_profile";
+    const fs::path alone  = folder / "alone";
+    const fs::path fanned = folder / "fanned";
+    fs::remove_all(folder);
+    fs::create_directories(alone);
+    fs::create_directories(fanned);
+
+    const std::vector<EncodingProfile> profiles = {
+        EncodingProfile {},
+        EncodingProfile::parse("V2"),
+        EncodingProfile::parse("128k-mono")};
+
+    std::vector<fs::path> files;
+    for (const auto &format : test_formats())
+    {
+        const auto name = format.name + ".wav";
+        bench::write_synthetic_wav(alone / name, format);
+        bench::write_synthetic_wav(fanned / name, format);
+        files.push_back(name);
+    }
+
+    int failures = 0;
+
+    for (const auto &file : files)
+    {
+        for (const auto &profile : profiles)
+        {
+            if (!mp3_converter::convert_file(alone / file, {profile}))
+            {
+                std::cerr << "Converting " << file << " to profile '"
+                          << profile.name << "' alone failed.\n";
+                ++failures;
+            }
+        }
+    }
+
+    for (int round = 0; round < rounds; ++round)
+    {
+        mp3_converter::ThreadPool      pool(workers);
+        std::vector<std::future<bool>> done;
+        for (const auto &file : files)
+            done.push_back(pool.submit([&, file] {
+                return mp3_converter::convert_file(fanned / file, profiles);
+            }));
+
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (!done[i].get())
+            {
+                std::cerr << "Converting " << files[i]
+                          << " to all profiles failed.\n";
+                ++failures;
+            }
+        }
+
+        for (const auto &file : files)
+        {
+            for (const auto &profile : profiles)
+            {
+                const auto mp3 =
+                    WavefileConversionTask::output_file(file, profile);
+                const auto expected = contents(alone / mp3);
+                if (expected.empty() || expected != contents(fanned / mp3))
+                {
+                    std::cerr << mp3 << " differs from the one encoded alone"
+                              << " in round " << round << ".\n";
+                    ++failures;
+                }
+            }
+        }
+    }
+
+    if (failures == 0)
+        fs::remove_all(folder);
+    return failures == 0 ? 0 : 1;
+}